@@ -0,0 +1,1148 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+// Micro benchmarks of the hot paths of the chess library and the solver.
+// Each benchmark runs a fixed number of iterations and outputs a line
+//   name ns/op
+// so that the results can be compared between commits.
+//
+// With option -c, the problems of a corpus (the data of contrib/test.pl)
+// are instead solved several times; with -s also for various numbers of
+// threads. See Help().
+
+#include <config.h>
+
+#include <unistd.h>  // getopt
+
+#include <cmath>  // sqrt
+#include <cstdint>
+#include <cstdlib>  // atoi, exit, strtod, strtoull
+
+#include <algorithm>  // find
+#include <fstream>
+#include <iomanip>  // setprecision, setw
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <osformat.h>  // NOLINT(build/include_order)
+
+#include "chessproblem/chess.h"
+#include "chessproblem/chessproblem.h"
+#include "chessproblem/flights.h"
+#include "chessproblem/m_attribute.h"
+#include "chessproblem/parse.h"
+#include "chessproblem/timer.h"
+
+using chessproblem::CheckNum;
+
+namespace {
+
+// Prevent that the benchmarked calls are optimized away
+volatile std::uint64_t sink;
+
+// Positions from contrib/test.pl (except for the initial position)
+class Position {
+ public:
+  const char *name_;
+  const char *white_;
+  const char *black_;
+  chess::Figure color_;
+};
+
+const Position positions[] = {
+  { "initial",
+    "Ke1,Qd1,Ra1,Rh1,Bc1,Bf1,Nb1,Ng1,a2,b2,c2,d2,e2,f2,g2,h2",
+    "Ke8,Qd8,Ra8,Rh8,Bc8,Bf8,Nb8,Ng8,a7,b7,c7,d7,e7,f7,g7,h7",
+    chess::kWhite },
+  { "middlegame",
+    "Kh1,Qf8,Re5,Nh5,Nc4,Bd3,c5,a6",
+    "Kd7,Qd8,Rb8,Re7,Bd4,Bc8,Ne8,Ng7,d5,d6,c6,c7,b7,a7,f5,h6",
+    chess::kWhite },
+  { "open",
+    "Kh1,Qa3,Rb3,Rd1,Bh2,Bf3,Ng2,Nf8,g3,e2",
+    "Ke5,Qb6,Rb8,Rd6,Bc7,Bc6,Nb7,Ng7,b5,c5,c4,d4,e3,f4,f6,g5",
+    chess::kWhite },
+  { "sparse",
+    "Kc1,Nh1,Bh2",
+    "Ke8,Rd8,Qf8,e7,d7,f7,g7", chess::kBlack }
+};
+
+// Positions for IsCheckMate()
+const Position check_positions[] = {
+  { "mate", "Kb3,Be4,Bd4", "Ka1", chess::kBlack },
+  { "check", "Kc4,Be4,Bd4", "Ka1", chess::kBlack }
+};
+
+// Problems from contrib/test.pl for Solve()
+class Problem {
+ public:
+  const char *name_;
+  ChessProblem::Mode mode_;
+  int moves_;
+  const char *white_;
+  const char *black_;
+  int iterations_;
+};
+
+const Problem kMicroProblems[] = {
+  { "mate2", ChessProblem::kMate, 2,
+    "Ka1,Qd7,Bd1,Be3,d3,g3", "Kf6", 20 },
+  { "mate3", ChessProblem::kMate, 3,
+    "Kg4,Rc8,Rf2,Ba8,Bf3,c3,c4", "Ke5,Bc6,d6,d7", 5 },
+  { "selfmate2", ChessProblem::kSelfMate, 2,
+    "Kc1,Qf5,Ne1", "Kh8,Bd1,a2,c2,c3,e2", 20 },
+  { "helpmate3", ChessProblem::kHelpMate, 3,
+    "Kc1,Nh1,Bh2", "Ke8,Rd8,Qf8,e7,d7,f7,g7", 5 }
+};
+
+ATTRIBUTE_NODISCARD ATTRIBUTE_NONNULL_ bool PlaceFigures(chess::Field *field,
+    const char *white, const char *black) {
+  field->clear();
+  return (chessproblem::PlaceFigures(field, chess::kWhite, white) &&
+    chessproblem::PlaceFigures(field, chess::kBlack, black));
+}
+
+// The color must be set before
+ATTRIBUTE_NONNULL_ void SetCastlingEp(chess::Field *field) {
+  field->set_ep(chess::kNoEnPassant);
+  field->set_castling(field->CalcCastling(chess::kAllCastling));
+}
+
+ATTRIBUTE_NONNULL_ void SetUp(chess::Field *field, const Position& position) {
+  bool placed(PlaceFigures(field, position.white_, position.black_));
+  field->set_color(position.color_);
+  SetCastlingEp(field);
+  if (!placed || !field->LegalValues()) {
+    osformat::SayError("illegal position %s") % position.name_;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// Output value with a fixed number of decimals
+class Fixed {
+ public:
+  double value_;
+  int precision_;
+
+  Fixed(double value, int precision) : value_(value), precision_(precision) {
+  }
+};
+
+std::ostream& operator<<(std::ostream& os, const Fixed& fixed) {
+  std::ios_base::fmtflags flags(os.flags());
+  std::streamsize precision(os.precision());
+  os << std::fixed << std::setprecision(fixed.precision_) << fixed.value_;
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
+
+// start is the result of chessproblem::Nanoseconds() before the ops
+void Report(const std::string& name, std::uint64_t ops,
+    std::uint64_t start) {
+  double ns(static_cast<double>(chessproblem::Nanoseconds() - start));
+  osformat::Say("%s %s") % name % Fixed(ns / static_cast<double>(ops), 1);
+}
+
+void BenchGenerator(const Position& position) {
+  constexpr int kIterations = 200000;
+  chess::Field field;
+  SetUp(&field, position);
+  chess::MoveList moves;
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    moves.clear();
+    field.Generator(&moves);
+    sink = sink + moves.size();
+  }
+  Report(std::string("Generator/") + position.name_, kIterations, start);
+}
+
+void BenchPushPop(const Position& position) {
+  constexpr int kIterations = 20000;
+  chess::Field field;
+  SetUp(&field, position);
+  chess::MoveList moves;
+  field.Generator(&moves);
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    for (const auto& my_move : moves) {
+      field.PushMove(&my_move);
+      sink = sink + field.get_hash();
+      field.PopMove();
+    }
+  }
+  Report(std::string("PushMove+PopMove/") + position.name_,
+    static_cast<std::uint64_t>(kIterations) * moves.size(), start);
+}
+
+void BenchThreatened(const Position& position) {
+  constexpr int kIterations = 20000;
+  chess::Field field;
+  SetUp(&field, position);
+  chess::Figure color(field.get_color());
+  std::uint64_t ops(0);
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    for (chess::Pos row(0); row != chess::Field::kRows; ++row) {
+      chess::Pos pos(chess::Field::kFieldStart +
+        row * (chess::Field::kColumns + 2));
+      for (chess::Pos column(0); column != chess::Field::kColumns;
+        ++column, ++pos) {
+        sink = sink + (field.IsThreatened(pos, color) ? 1 : 0);
+        ++ops;
+      }
+    }
+  }
+  Report(std::string("IsThreatened/") + position.name_, ops, start);
+}
+
+void BenchCopy(const Position& position) {
+  constexpr int kIterations = 200000;
+  chess::Field field;
+  SetUp(&field, position);
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    chess::Field copy(field);
+    sink = sink + copy.get_hash();
+  }
+  Report(std::string("FieldCopy/") + position.name_, kIterations,
+    start);
+}
+
+void BenchCheckMate(const Position& position) {
+  constexpr int kIterations = 200000;
+  chess::Field field;
+  SetUp(&field, position);
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    sink = sink + (field.IsCheckMate() ? 1 : 0);
+  }
+  Report(std::string("IsCheckMate/") + position.name_, kIterations, start);
+}
+
+void BenchFlights(const Position& position,
+    chessproblem::FlightBatch::Kernel kernel, const char *kernel_name) {
+  constexpr int kIterations = 20000;
+  chess::Field field;
+  SetUp(&field, position);
+  chess::MoveList moves;
+  field.Generator(&moves);
+  chessproblem::FlightBatch batch;
+  batch.SetPosition(&field);
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != kIterations; ++i) {
+    for (const auto& my_move : moves) {
+      batch.Add(&my_move);
+      if (batch.full()) {
+        batch.Test(kernel);
+        sink = sink + (batch.MayBeMate(0) ? 1 : 0);
+        batch.clear();
+      }
+    }
+    if (!batch.empty()) {
+      batch.Test(kernel);
+      sink = sink + (batch.MayBeMate(0) ? 1 : 0);
+      batch.clear();
+    }
+  }
+  Report(std::string("FlightBatch/") + kernel_name + "/" + position.name_,
+    static_cast<std::uint64_t>(kIterations) * moves.size(), start);
+}
+
+void BenchSolve(const Problem& problem) {
+  std::uint64_t start(chessproblem::Nanoseconds());
+  for (int i(0); i != problem.iterations_; ++i) {
+    ChessProblem chessproblem(problem.mode_, problem.moves_);
+    chessproblem.set_max_parallel(1);
+    if (!PlaceFigures(&chessproblem, problem.white_, problem.black_)) {
+      osformat::SayError("illegal problem %s") % problem.name_;
+      std::exit(EXIT_FAILURE);
+    }
+    chessproblem.set_color();
+    SetCastlingEp(&chessproblem);
+    sink = sink + static_cast<std::uint64_t>(chessproblem.Solve());
+  }
+  Report(std::string("Solve/") + problem.name_,
+    static_cast<std::uint64_t>(problem.iterations_), start);
+}
+
+// The problems of a corpus are solved by the runner
+
+constexpr int kRunsDefault = 3;
+constexpr int kMinSlowdownDefault = 5;
+
+class CorpusOptions {
+ public:
+  std::string corpus_, output_, baseline_;
+  int runs_, max_parallel_, min_slowdown_;
+
+  // Only problems containing one of these strings are solved
+  std::vector<std::string> select_;
+
+  // The grid of -s and -J
+  std::vector<int> scaling_, min_half_moves_depths_;
+
+  CorpusOptions()
+    : runs_(kRunsDefault), max_parallel_(1),
+    min_slowdown_(kMinSlowdownDefault) {
+  }
+};
+
+// A problem line of the corpus and its expected solutions
+class CorpusProblem {
+ public:
+  std::string name_;
+  ChessProblem::Mode mode_;
+  int moves_;
+  char color_;  // 'w', 'b', or '\0' for the default of mode_
+  char ep_;  // The column of -e or '\0'
+  bool iterative_deepening_;  // -d
+  chess::Castling castling_;
+  std::string white_, black_;
+  std::vector<std::string> expected_;
+
+  CorpusProblem()
+    : mode_(ChessProblem::kUnknown), moves_(0), color_('\0'), ep_('\0'),
+    iterative_deepening_(false), castling_(chess::kAllCastling) {
+  }
+};
+
+// The measurements of all runs of a problem
+class CorpusResult {
+ public:
+  std::string name_;
+  std::vector<double> milliseconds_;
+  std::uint64_t nodes_;  // Of the last run
+  std::uint64_t total_nodes_, total_threads_;  // The sums over all runs
+  std::vector<std::string> solutions_;
+  bool correct_;
+
+  CorpusResult() : nodes_(0), total_nodes_(0), total_threads_(0),
+    correct_(true) {
+  }
+};
+
+class CastlingField {
+ public:
+  const char *field_;
+  chess::Castling castling_;
+};
+
+const CastlingField castling_fields[] = {
+  { "e1", chess::kNoWhiteCastling },
+  { "a1", chess::kNoWhiteLongCastling },
+  { "h1", chess::kNoWhiteShortCastling },
+  { "e8", chess::kNoBlackCastling },
+  { "a8", chess::kNoBlackLongCastling },
+  { "h8", chess::kNoBlackShortCastling }
+};
+
+// Collect the solutions as the output of chessproblem would show them
+class CorpusSolver : public ChessProblem {
+  ATTRIBUTE_NONNULL_ bool Output(chess::Field *field) const override {
+    solutions_->push_back(field->get_move_stack().str());
+    // contrib/test.pl writes a solution without moves as "-"
+    if (solutions_->back().empty()) {
+      solutions_->back() = "-";
+    }
+    return true;
+  }
+
+ public:
+  std::vector<std::string> *solutions_;
+
+  explicit CorpusSolver(std::vector<std::string> *solutions)
+    : ChessProblem(), solutions_(solutions) {
+  }
+};
+
+// Remove leading and trailing white space from *str
+ATTRIBUTE_NONNULL_ void Trim(std::string *str) {
+  const char *space = " \t\r\n";
+  std::string::size_type start(str->find_first_not_of(space));
+  if (start == std::string::npos) {
+    str->clear();
+    return;
+  }
+  str->erase(str->find_last_not_of(space) + 1);
+  str->erase(0, start);
+}
+
+// Parse the options of a problem line like contrib/test.pl passes them
+// to chessproblem. Options only for the output are ignored.
+ATTRIBUTE_NONNULL_ bool ParseOptions(CorpusProblem *problem,
+    const std::string& options) {
+  std::istringstream stream(options);
+  std::vector<std::string> words;
+  for (std::string word; stream >> word; ) {
+    words.push_back(word);
+  }
+  for (std::vector<std::string>::size_type i(0); i != words.size(); ++i) {
+    const std::string& word = words[i];
+    if ((word.size() < 2) || (word[0] != '-')) {
+      return false;
+    }
+    for (std::string::size_type j(1); j != word.size(); ++j) {
+      char c(word[j]);
+      if ((c == 'p') || (c == 'P') || (c == 'q') || (c == 'Q')) {
+        continue;
+      }
+      if ((c == 'b') || (c == 'w')) {
+        problem->color_ = c;
+        continue;
+      }
+      if (c == 'd') {
+        problem->iterative_deepening_ = true;
+        continue;
+      }
+      std::string arg(word, j + 1);
+      if (arg.empty()) {
+        if (++i == words.size()) {
+          return false;
+        }
+        arg = words[i];
+      }
+      j = word.size() - 1;
+      switch (c) {
+        case 'm':
+        case 'M':
+          problem->mode_ = ChessProblem::kMate;
+          break;
+        case 's':
+        case 'S':
+          problem->mode_ = ChessProblem::kSelfMate;
+          break;
+        case 'H':
+          problem->mode_ = ChessProblem::kHelpMate;
+          break;
+        case 'e':
+          if ((arg[0] < 'a') || (arg[0] > 'h')) {
+            return false;
+          }
+          problem->ep_ = arg[0];
+          continue;
+        case 'c':
+          for (std::string::size_type k(0); k < arg.size(); k += 3) {
+            std::string field(arg, k, 2);
+            bool found(false);
+            for (const auto& castling : castling_fields) {
+              if (field == castling.field_) {
+                problem->castling_ = chess::UnsetCastling(problem->castling_,
+                  castling.castling_);
+                found = true;
+              }
+            }
+            if (!found) {
+              return false;
+            }
+          }
+          continue;
+        default:
+          return false;
+      }
+      problem->moves_ = std::atoi(arg.c_str());
+      if (problem->moves_ <= 0) {
+        return false;
+      }
+    }
+  }
+  return (problem->mode_ != ChessProblem::kUnknown);
+}
+
+// Parse a problem line: options "white figures" "black figures"
+ATTRIBUTE_NONNULL_ bool ParseProblem(CorpusProblem *problem,
+    const std::string& line) {
+  std::string::size_type white(line.find_first_of("\"'"));
+  if (white == std::string::npos) {
+    return false;
+  }
+  std::string::size_type white_end(line.find(line[white], white + 1));
+  if (white_end == std::string::npos) {
+    return false;
+  }
+  std::string::size_type black(line.find_first_of("\"'", white_end + 1));
+  if (black == std::string::npos) {
+    return false;
+  }
+  std::string::size_type black_end(line.find(line[black], black + 1));
+  if (black_end == std::string::npos) {
+    return false;
+  }
+  problem->name_ = line;
+  problem->white_ = line.substr(white + 1, white_end - white - 1);
+  problem->black_ = line.substr(black + 1, black_end - black - 1);
+  return ParseOptions(problem, line.substr(0, white) + ' ' +
+    line.substr(black_end + 1));
+}
+
+// Read the problems after the line __END__ (or all if there is none).
+// The format is that of contrib/test.pl: A problem line is followed by
+// a line with the solutions separated by ";" or by "No solution exists".
+ATTRIBUTE_NONNULL_ void ReadCorpus(std::vector<CorpusProblem> *problems,
+    const std::string& name) {
+  std::ifstream file(name);
+  if (!file) {
+    osformat::SayError("cannot read %s") % name;
+    std::exit(EXIT_FAILURE);
+  }
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(file, line); ) {
+    std::string::size_type comment(line.find('#'));
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+    Trim(&line);
+    if (line == "__END__") {
+      lines.clear();
+    } else if (!line.empty()) {
+      lines.push_back(line);
+    }
+  }
+  if ((lines.size() % 2) != 0) {
+    osformat::SayError("%s: the last problem has no solution line") % name;
+    std::exit(EXIT_FAILURE);
+  }
+  for (std::vector<std::string>::size_type i(0); i != lines.size(); i += 2) {
+    CorpusProblem problem;
+    if (!ParseProblem(&problem, lines[i])) {
+      osformat::SayError("%s: problem line not understood: %s")
+        % name % lines[i];
+      std::exit(EXIT_FAILURE);
+    }
+    if (lines[i + 1].compare(0, 2, "No") != 0) {
+      std::istringstream stream(lines[i + 1]);
+      for (std::string solution; std::getline(stream, solution, ';'); ) {
+        Trim(&solution);
+        problem.expected_.push_back(solution);
+      }
+    }
+    problems->push_back(problem);
+  }
+}
+
+// A min_half_moves_depth of 0 means the default
+ATTRIBUTE_NODISCARD ATTRIBUTE_NONNULL_ bool SetUpProblem(
+    CorpusSolver *solver, const CorpusProblem& problem, int max_parallel,
+    int min_half_moves_depth) {
+  solver->set_mode(problem.mode_, problem.moves_);
+  solver->set_iterative_deepening(problem.iterative_deepening_);
+  solver->set_max_parallel(max_parallel);
+  if (min_half_moves_depth > 0) {
+    solver->set_min_half_moves_depth(min_half_moves_depth);
+  }
+  if (!PlaceFigures(solver, problem.white_.c_str(),
+    problem.black_.c_str()) || !solver->HaveKings()) {
+    return false;
+  }
+  if (problem.color_ == '\0') {
+    solver->set_color();
+  } else {
+    solver->set_color((problem.color_ == 'w') ? chess::kWhite : chess::kBlack);
+  }
+  chess::EnPassant ep(chess::kNoEnPassant);
+  if (problem.ep_ != '\0') {
+    ep = chess::Field::CalcPos(problem.ep_,
+      (solver->get_color() == chess::kWhite) ? '6' : '3');
+    if (!solver->IsEnPassantValid(ep, true)) {
+      return false;
+    }
+  }
+  solver->set_ep(ep);
+  solver->set_castling(solver->CalcCastling(problem.castling_));
+  return solver->LegalValues();
+}
+
+// The solutions must be the same as sets
+bool SameSolutions(const std::vector<std::string>& found,
+    const std::vector<std::string>& expected) {
+  for (const auto& solution : found) {
+    if (std::find(expected.begin(), expected.end(), solution) ==
+      expected.end()) {
+      return false;
+    }
+  }
+  for (const auto& solution : expected) {
+    if (std::find(found.begin(), found.end(), solution) == found.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double Mean(const std::vector<double>& values) {
+  double sum(0);
+  for (auto value : values) {
+    sum += value;
+  }
+  return (sum / static_cast<double>(values.size()));
+}
+
+// The sample variance; values must have at least 2 entries
+double Variance(const std::vector<double>& values) {
+  double mean(Mean(values));
+  double sum(0);
+  for (auto value : values) {
+    sum += (value - mean) * (value - mean);
+  }
+  return (sum / static_cast<double>(values.size() - 1));
+}
+
+// The one-sided 95% quantile of Student's t distribution by the
+// Cornish-Fisher expansion; the error is below 1% for at least 3
+// degrees of freedom.
+double StudentQuantile95(double degrees) {
+  const double z(1.6448536);  // The quantile of the normal distribution
+  double z2(z * z);
+  return (z + z * (z2 + 1) / (4 * degrees) +
+    z * ((5 * z2 + 16) * z2 + 3) / (96 * degrees * degrees) +
+    z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) /
+    (384 * degrees * degrees * degrees));
+}
+
+// Welch's t-test: Return true if the mean of current is significantly
+// larger than that of baseline; store the t statistic into *t.
+ATTRIBUTE_NONNULL_ bool SignificantlySlower(
+    const std::vector<double>& baseline, const std::vector<double>& current,
+    double *t) {
+  *t = 0;
+  if ((baseline.size() < 2) || (current.size() < 2)) {
+    return false;
+  }
+  double baseline_var(Variance(baseline) /
+    static_cast<double>(baseline.size()));
+  double current_var(Variance(current) / static_cast<double>(current.size()));
+  double diff(Mean(current) - Mean(baseline));
+  double var(baseline_var + current_var);
+  if (var <= 0.0) {
+    return (diff > 0);
+  }
+  *t = diff / std::sqrt(var);
+  double degrees(var * var /
+    (baseline_var * baseline_var / static_cast<double>(baseline.size() - 1) +
+    current_var * current_var / static_cast<double>(current.size() - 1)));
+  return (*t > StudentQuantile95(degrees));
+}
+
+ATTRIBUTE_NONNULL_ void WriteJsonString(std::ostream *os,
+    const std::string& str) {
+  *os << '"';
+  for (char c : str) {
+    if ((c == '"') || (c == '\\')) {
+      *os << '\\';
+    }
+    *os << c;
+  }
+  *os << '"';
+}
+
+// Read a string starting at the quote at position *pos of json and move
+// *pos behind it. Only the escapes produced by WriteJsonString() are
+// supported.
+ATTRIBUTE_NONNULL_ std::string ReadJsonString(const std::string& json,
+    std::string::size_type *pos) {
+  std::string res;
+  std::string::size_type i(*pos + 1);
+  for (; (i < json.size()) && (json[i] != '"'); ++i) {
+    if ((json[i] == '\\') && (i + 1 < json.size())) {
+      ++i;
+    }
+    res.append(1, json[i]);
+  }
+  *pos = i + 1;
+  return res;
+}
+
+void WriteJson(const std::string& name, const CorpusOptions& options,
+    const std::vector<CorpusResult>& results) {
+  std::ofstream file(name);
+  file << "{\n  \"runs\": " << options.runs_ <<
+    ",\n  \"max_parallel\": " << options.max_parallel_ <<
+    ",\n  \"problems\": [";
+  const char *separator = "\n";
+  for (const auto& result : results) {
+    file << separator << "    {\n      \"name\": ";
+    WriteJsonString(&file, result.name_);
+    file << ",\n      \"milliseconds\": [";
+    const char *comma = "";
+    for (auto milliseconds : result.milliseconds_) {
+      file << comma << Fixed(milliseconds, 4);
+      comma = ", ";
+    }
+    file << "],\n      \"nodes\": " << result.nodes_ <<
+      ",\n      \"solutions\": [";
+    comma = "";
+    for (const auto& solution : result.solutions_) {
+      file << comma;
+      WriteJsonString(&file, solution);
+      comma = ", ";
+    }
+    file << "],\n      \"correct\": " <<
+      (result.correct_ ? "true" : "false") << "\n    }";
+    separator = ",\n";
+  }
+  file << "\n  ]\n}\n";
+  if (!file) {
+    osformat::SayError("cannot write %s") % name;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// Read name, milliseconds, and nodes of the problems of a file written by
+// WriteJson(); this is not a general JSON parser.
+ATTRIBUTE_NONNULL_ void ReadJson(std::vector<CorpusResult> *results,
+    const std::string& name) {
+  std::ifstream file(name);
+  if (!file) {
+    osformat::SayError("cannot read %s") % name;
+    std::exit(EXIT_FAILURE);
+  }
+  std::ostringstream content;
+  content << file.rdbuf();
+  std::string json(content.str());
+  std::string::size_type pos(json.find("\"name\""));
+  while (pos != std::string::npos) {
+    CorpusResult result;
+    pos = json.find('"', json.find(':', pos));
+    if (pos == std::string::npos) {
+      break;
+    }
+    result.name_ = ReadJsonString(json, &pos);
+    std::string::size_type next(json.find("\"name\"", pos));
+    std::string::size_type key(json.find("\"milliseconds\"", pos));
+    if (key < next) {
+      const char *number = json.c_str() + json.find('[', key) + 1;
+      for (;;) {
+        char *end;
+        double value(std::strtod(number, &end));
+        if (end == number) {
+          break;
+        }
+        result.milliseconds_.push_back(value);
+        number = end;
+        while ((*number == ',') || (*number == ' ')) {
+          ++number;
+        }
+      }
+    }
+    key = json.find("\"nodes\"", pos);
+    if (key < next) {
+      result.nodes_ = std::strtoull(json.c_str() + json.find(':', key) + 1,
+        nullptr, 10);
+    }
+    results->push_back(result);
+    pos = next;
+  }
+}
+
+// Compare with the baseline and output the result. Return true if slower.
+bool Compare(const CorpusResult& result,
+    const std::vector<CorpusResult>& baseline, int min_slowdown) {
+  for (const auto& old : baseline) {
+    if (old.name_ != result.name_) {
+      continue;
+    }
+    if (old.nodes_ != result.nodes_) {
+      osformat::Say("  nodes: %s (baseline %s)") % result.nodes_ % old.nodes_;
+    }
+    if (old.milliseconds_.empty()) {
+      return false;
+    }
+    double old_mean(Mean(old.milliseconds_));
+    double percent((old_mean > 0) ?
+      ((Mean(result.milliseconds_) / old_mean - 1) * 100) : 0);
+    double t;
+    bool slower(SignificantlySlower(old.milliseconds_, result.milliseconds_,
+      &t) && (percent > min_slowdown));
+    osformat::Say("  %s%s%% (baseline %s ms, t = %s)%s")
+      % ((percent >= 0) ? "+" : "")
+      % Fixed(percent, 1)
+      % Fixed(old_mean, 3)
+      % Fixed(t, 2)
+      % (slower ? ": SLOWER" : "");
+    return slower;
+  }
+  osformat::Say("  not in baseline");
+  return false;
+}
+
+// Solve problem runs times; the first run only warms up the caches and is
+// not measured. A min_half_moves_depth of 0 means the default.
+ATTRIBUTE_NONNULL_ void SolveRuns(CorpusResult *result,
+    const CorpusProblem& problem, int runs, int max_parallel,
+    int min_half_moves_depth) {
+  result->name_ = problem.name_;
+  for (int run(-1); run != runs; ++run) {
+    std::vector<std::string> solutions;
+    CorpusSolver solver(&solutions);
+    if (!SetUpProblem(&solver, problem, max_parallel, min_half_moves_depth)) {
+      osformat::SayError("illegal problem %s") % problem.name_;
+      std::exit(EXIT_FAILURE);
+    }
+    std::uint64_t start(chessproblem::Nanoseconds());
+    solver.Solve();
+    double milliseconds(static_cast<double>(chessproblem::Nanoseconds() -
+      start) / 1000000);
+    if (run < 0) {
+      continue;
+    }
+    result->milliseconds_.push_back(milliseconds);
+    result->nodes_ = solver.get_nodes();
+    result->total_nodes_ += result->nodes_;
+    result->total_threads_ += static_cast<std::uint64_t>(
+      solver.get_threads_started());
+    result->solutions_ = solutions;
+  }
+  result->correct_ = SameSolutions(result->solutions_, problem.expected_);
+}
+
+ATTRIBUTE_NONNULL_ void SelectProblems(std::vector<CorpusProblem> *problems,
+    const CorpusOptions& options) {
+  ReadCorpus(problems, options.corpus_);
+  if (options.select_.empty()) {
+    return;
+  }
+  std::vector<CorpusProblem> selected;
+  for (const auto& problem : *problems) {
+    for (const auto& select : options.select_) {
+      if (problem.name_.find(select) != std::string::npos) {
+        selected.push_back(problem);
+        break;
+      }
+    }
+  }
+  problems->swap(selected);
+}
+
+int RunCorpus(const CorpusOptions& options) {
+  std::vector<CorpusProblem> problems;
+  SelectProblems(&problems, options);
+  std::vector<CorpusResult> baseline;
+  if (!options.baseline_.empty()) {
+    ReadJson(&baseline, options.baseline_);
+  }
+  std::vector<CorpusResult> results;
+  int wrong(0), slower(0);
+  for (const auto& problem : problems) {
+    CorpusResult result;
+    SolveRuns(&result, problem, options.runs_, options.max_parallel_, 0);
+    double deviation((options.runs_ > 1) ?
+      std::sqrt(Variance(result.milliseconds_)) : 0);
+    osformat::Say("%s\n  %s ms (deviation %s), %s nodes%s")
+      % problem.name_
+      % Fixed(Mean(result.milliseconds_), 3)
+      % Fixed(deviation, 3)
+      % result.nodes_
+      % (result.correct_ ? "" : ": WRONG SOLUTIONS");
+    if (!result.correct_) {
+      ++wrong;
+    }
+    if (!options.baseline_.empty() &&
+      Compare(result, baseline, options.min_slowdown_)) {
+      ++slower;
+    }
+    results.push_back(result);
+  }
+  if (!options.output_.empty()) {
+    WriteJson(options.output_, options, results);
+  }
+  osformat::Say("%s problems, %s wrong, %s slower")
+    % results.size() % wrong % slower;
+  return (((wrong == 0) && (slower == 0)) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+#ifndef NO_CHESSPROBLEM_THREADS
+
+// A line of the output of RunScaling(); operator<< writes it for the table
+class ScalingRow {
+ public:
+  int max_parallel_;
+  int min_half_moves_depth_;  // 0 for the sequential solver
+  double milliseconds_, speedup_, efficiency_, nodes_, overhead_, threads_;
+
+  // Compare result with the sequential solver
+  ScalingRow(const CorpusResult& result, const CorpusResult& sequential,
+      int max_parallel, int min_half_moves_depth);
+
+  // Write the line for the CSV file (without the newline)
+  ATTRIBUTE_NONNULL_ void Csv(std::ostream *os, const std::string& name)
+      const;
+};
+
+// operator<< writes the header of the table
+class ScalingHeader {
+};
+
+ScalingRow::ScalingRow(const CorpusResult& result,
+    const CorpusResult& sequential, int max_parallel,
+    int min_half_moves_depth)
+  : max_parallel_(max_parallel), min_half_moves_depth_(min_half_moves_depth),
+  milliseconds_(Mean(result.milliseconds_)) {
+  double runs(static_cast<double>(result.milliseconds_.size()));
+  double sequential_milliseconds(Mean(sequential.milliseconds_));
+  double sequential_nodes(static_cast<double>(sequential.total_nodes_) /
+    static_cast<double>(sequential.milliseconds_.size()));
+  speedup_ = ((milliseconds_ > 0) ?
+    (sequential_milliseconds / milliseconds_) : 1);
+  efficiency_ = speedup_ / max_parallel * 100;
+  nodes_ = static_cast<double>(result.total_nodes_) / runs;
+  overhead_ = ((sequential_nodes > 0) ?
+    ((nodes_ / sequential_nodes - 1) * 100) : 0);
+  threads_ = static_cast<double>(result.total_threads_) / runs;
+}
+
+std::ostream& operator<<(std::ostream& os,
+    const ScalingHeader& /* header */) {
+  os << std::setw(4) << "-j" << std::setw(4) << "-J" <<
+    std::setw(12) << "ms" << std::setw(9) << "speedup" <<
+    std::setw(12) << "efficiency" << std::setw(12) << "nodes" <<
+    std::setw(10) << "overhead" << std::setw(9) << "threads";
+  return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const ScalingRow& row) {
+  std::ios_base::fmtflags flags(os.flags());
+  std::streamsize precision(os.precision());
+  os << std::setw(4) << row.max_parallel_ << std::setw(4);
+  if (row.min_half_moves_depth_ > 0) {
+    os << row.min_half_moves_depth_;
+  } else {
+    os << '-';
+  }
+  os << std::fixed <<
+    std::setprecision(3) << std::setw(12) << row.milliseconds_ <<
+    std::setprecision(2) << std::setw(9) << row.speedup_ <<
+    std::setprecision(1) << std::setw(11) << row.efficiency_ << '%' <<
+    std::setprecision(0) << std::setw(12) << row.nodes_ <<
+    std::setprecision(1) << std::setw(9) << row.overhead_ << '%' <<
+    std::setw(9) << row.threads_;
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
+
+void ScalingRow::Csv(std::ostream *os, const std::string& name) const {
+  std::ios_base::fmtflags flags(os->flags());
+  std::streamsize precision(os->precision());
+  *os << '"';
+  for (char c : name) {
+    *os << c;
+    if (c == '"') {
+      *os << c;
+    }
+  }
+  *os << "\"," << max_parallel_ << ',';
+  if (min_half_moves_depth_ > 0) {
+    *os << min_half_moves_depth_;
+  }
+  *os << std::fixed << std::setprecision(4) << ',' << milliseconds_ << ',' <<
+    speedup_ << ',' << efficiency_ << ',' << nodes_ << ',' << overhead_ <<
+    ',' << threads_;
+  os->flags(flags);
+  os->precision(precision);
+}
+
+// Solve the problems for all combinations of the numbers of threads and
+// minimal depths and compare with the sequential solver
+int RunScaling(const CorpusOptions& options) {
+  std::vector<CorpusProblem> problems;
+  SelectProblems(&problems, options);
+  std::vector<int> min_half_moves_depths(options.min_half_moves_depths_);
+  if (min_half_moves_depths.empty()) {
+    min_half_moves_depths.push_back(ChessProblem::kMinHalfMovesDepthDefault);
+  }
+  // set_max_parallel() possibly reduces the number to the hardware
+  std::vector<int> parallels;
+  for (auto max_parallel : options.scaling_) {
+    ChessProblem probe;
+    probe.set_max_parallel(max_parallel);
+    int parallel(probe.get_max_parallel());
+    if (parallel < max_parallel) {
+      osformat::SayError("warning: -s %s forced to %s")
+        % max_parallel % parallel;
+    }
+    if (std::find(parallels.begin(), parallels.end(), parallel) ==
+      parallels.end()) {
+      parallels.push_back(parallel);
+    }
+  }
+  std::ostringstream csv;
+  csv << "problem,max_parallel,min_half_moves_depth,milliseconds,speedup,"
+    "efficiency,nodes,node_overhead,threads\n";
+  int wrong(0);
+  for (const auto& problem : problems) {
+    CorpusResult sequential;
+    SolveRuns(&sequential, problem, options.runs_, 1, 0);
+    ScalingRow sequential_row(sequential, sequential, 1, 0);
+    osformat::Say("%s\n%s\n%s")
+      % problem.name_ % ScalingHeader() % sequential_row;
+    sequential_row.Csv(&csv, problem.name_);
+    csv << '\n';
+    for (auto min_half_moves_depth : min_half_moves_depths) {
+      for (auto parallel : parallels) {
+        CorpusResult result;
+        SolveRuns(&result, problem, options.runs_, parallel,
+          min_half_moves_depth);
+        ScalingRow row(result, sequential, parallel, min_half_moves_depth);
+        osformat::Say("%s%s") % row
+          % (result.correct_ ? "" : "  WRONG SOLUTIONS");
+        row.Csv(&csv, problem.name_);
+        csv << '\n';
+        if (!result.correct_) {
+          ++wrong;
+        }
+      }
+    }
+  }
+  if (!options.output_.empty()) {
+    std::ofstream file(options.output_);
+    file << csv.str();
+    if (!file) {
+      osformat::SayError("cannot write %s") % options.output_;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  return ((wrong == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+#endif  // NO_CHESSPROBLEM_THREADS
+
+void Help() {
+  osformat::Say("Usage: bench [options]\n"
+"Without options, run the micro benchmarks and output \"name ns/op\".\n"
+"\n"
+"Options:\n"
+"-c X Solve the problems of the corpus file X (e.g. contrib/test.pl)\n"
+"     several times and output the times, nodes, and solutions of each\n"
+"-r X Solve each problem X times. Default value is %s.\n"
+"-j X Use up to X parallel threads\n"
+"-p X Solve only the problems containing the string X; can be repeated\n"
+"-s X With -c: Instead, compare the sequential solver with the solver using\n"
+"     up to X threads for each X of the comma-separated list X and output\n"
+"     speedup, efficiency, node overhead, and started threads\n"
+"-J X With -s: For a new thread require at least X half moves depth for\n"
+"     each X of the comma-separated list X. Default value is %s.\n"
+"-o X Write the results of -c as JSON (of -s as CSV) to file X\n"
+"-b X Compare the results of -c with the JSON file X written earlier by -o\n"
+"     and report slowdowns which are significant (one-sided Welch t-test\n"
+"     with 95%% confidence) and larger than -m\n"
+"-m X Report only slowdowns of more than X percent. Default value is %s.\n"
+"-h   Output this help text and exit\n"
+"\n"
+"The return value of -c is nonzero if a result is wrong or slower.")
+  % kRunsDefault
+#ifndef NO_CHESSPROBLEM_THREADS
+  % ChessProblem::kMinHalfMovesDepthDefault
+#else
+  % "(ignored: compiled without threading support)"
+#endif
+  % kMinSlowdownDefault;
+}
+
+// Append the numbers of the comma-separated list
+ATTRIBUTE_NONNULL_ void CheckList(std::vector<int> *list, const char *nums,
+    int min_value, char c) {
+  std::istringstream stream(nums);
+  for (std::string num; std::getline(stream, num, ','); ) {
+    list->push_back(CheckNum(num.c_str(), min_value, c));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  CorpusOptions options;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:r:j:p:s:J:o:b:m:h")) != -1) {
+    switch (opt) {
+      case 'c':
+        options.corpus_ = optarg;
+        break;
+      case 'r':
+        options.runs_ = CheckNum(optarg, 1, 'r');
+        break;
+      case 'j':
+        options.max_parallel_ = CheckNum(optarg, 1, 'j');
+        break;
+      case 'p':
+        options.select_.push_back(optarg);
+        break;
+      case 's':
+        CheckList(&options.scaling_, optarg, 1, 's');
+        break;
+      case 'J':
+        CheckList(&options.min_half_moves_depths_, optarg, 1, 'J');
+        break;
+      case 'o':
+        options.output_ = optarg;
+        break;
+      case 'b':
+        options.baseline_ = optarg;
+        break;
+      case 'm':
+        options.min_slowdown_ = CheckNum(optarg, 0, 'm');
+        break;
+      case 'h':
+        Help();
+        std::exit(EXIT_SUCCESS);
+        break;
+      default:
+        std::exit(EXIT_FAILURE);
+        break;
+    }
+  }
+  if (optind < argc) {
+    osformat::SayError("No arguments are admissible");
+    std::exit(EXIT_FAILURE);
+  }
+  if (!options.scaling_.empty()) {
+    if (options.corpus_.empty()) {
+      osformat::SayError("Option -s requires -c");
+      std::exit(EXIT_FAILURE);
+    }
+#ifndef NO_CHESSPROBLEM_THREADS
+    return RunScaling(options);
+#else
+    osformat::SayError("Option -s needs threading support");
+    std::exit(EXIT_FAILURE);
+#endif
+  }
+  if (!options.corpus_.empty()) {
+    return RunCorpus(options);
+  }
+  for (const auto& position : positions) {
+    BenchGenerator(position);
+  }
+  for (const auto& position : positions) {
+    BenchPushPop(position);
+  }
+  for (const auto& position : positions) {
+    BenchThreatened(position);
+  }
+  for (const auto& position : check_positions) {
+    BenchCheckMate(position);
+  }
+  for (const auto& position : positions) {
+    BenchCopy(position);
+  }
+  for (const auto& position : positions) {
+    BenchFlights(position, chessproblem::FlightBatch::kScalar, "scalar");
+    if (chessproblem::FlightBatch::Supported(
+      chessproblem::FlightBatch::kSse4)) {
+      BenchFlights(position, chessproblem::FlightBatch::kSse4, "sse4");
+    }
+    if (chessproblem::FlightBatch::Supported(
+      chessproblem::FlightBatch::kAvx2)) {
+      BenchFlights(position, chessproblem::FlightBatch::kAvx2, "avx2");
+    }
+  }
+  for (const auto& problem : kMicroProblems) {
+    BenchSolve(problem);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/breadthfirst.h"
+#include <config.h>
+
+#include <algorithm>  // sort
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <cstdio>
+#include <cstring>  // memcmp, memcpy
+
+#include <queue>
+#ifndef NO_CHESSPROBLEM_THREADS
+#include <thread>  // NOLINT(build/c++11)
+#endif
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+#include "chessproblem/m_likely.h"
+
+namespace chessproblem {
+
+const std::size_t BreadthFirst::kPackedSize;
+const std::size_t BreadthFirst::kBatchSize;
+
+BreadthFirst::BreadthFirst(std::size_t megabytes, int max_threads)
+  : max_records_((megabytes << 20) / sizeof(Record)),
+  max_threads_((max_threads > 0) ? max_threads : 1), nodes_(0) {
+  if (max_records_ == 0) {
+    max_records_ = 1;
+  }
+}
+
+BreadthFirst::~BreadthFirst() {
+  Close();
+}
+
+void BreadthFirst::Close() {
+  for (auto file : levels_) {
+    std::fclose(file);
+  }
+  levels_.clear();
+  for (auto file : runs_) {
+    std::fclose(file);
+  }
+  runs_.clear();
+}
+
+namespace {
+
+template<class Record> bool RecordLess(const Record& a, const Record& b) {
+  int cmp(std::memcmp(a.key_, b.key_, sizeof(a.key_)));
+  return ((cmp < 0) || ((cmp == 0) && (a.parent_ < b.parent_)));
+}
+
+}  // namespace
+
+bool BreadthFirst::Spill() {
+  if (records_.empty()) {
+    return true;
+  }
+  std::sort(records_.begin(), records_.end(), RecordLess<Record>);
+  std::FILE *run(std::tmpfile());
+  if (UNLIKELY(run == nullptr)) {
+    return false;
+  }
+  runs_.push_back(run);
+  if (UNLIKELY(std::fwrite(records_.data(), sizeof(Record), records_.size(),
+    run) != records_.size())) {
+    return false;
+  }
+  records_.clear();
+  return true;
+}
+
+bool BreadthFirst::Merge() {
+  if (runs_.size() == 1) {
+    // No need to copy
+    levels_.push_back(runs_.front());
+    runs_.clear();
+    return true;
+  }
+  std::FILE *level(std::tmpfile());
+  if (UNLIKELY(level == nullptr)) {
+    return false;
+  }
+  levels_.push_back(level);
+  // A k-way merge of the heads of the runs
+  std::vector<Record> heads(runs_.size());
+  auto greater = [&heads](std::size_t a, std::size_t b) {
+    return RecordLess(heads[b], heads[a]);
+  };
+  std::priority_queue<std::size_t, std::vector<std::size_t>,
+    decltype(greater)> queue(greater);
+  for (std::size_t i(0); i != runs_.size(); ++i) {
+    std::rewind(runs_[i]);
+    if (std::fread(&heads[i], sizeof(Record), 1, runs_[i]) == 1) {
+      queue.push(i);
+    }
+  }
+  bool success(true);
+  while (!queue.empty()) {
+    std::size_t i(queue.top());
+    queue.pop();
+    if (UNLIKELY(std::fwrite(&heads[i], sizeof(Record), 1, level) != 1)) {
+      success = false;
+      break;
+    }
+    if (std::fread(&heads[i], sizeof(Record), 1, runs_[i]) == 1) {
+      queue.push(i);
+    }
+  }
+  for (auto run : runs_) {
+    if (UNLIKELY(std::ferror(run))) {
+      success = false;
+    }
+    std::fclose(run);
+  }
+  runs_.clear();
+  return success;
+}
+
+bool BreadthFirst::Solve(chess::Field *field, int half_moves,
+    chess::Figure mating_color, std::vector<chess::MoveList> *solutions) {
+  half_moves_ = half_moves;
+  mating_color_ = mating_color;
+  records_.clear();
+  mates_.clear();
+  records_.emplace_back();
+  Record& root = records_.back();
+  if (UNLIKELY(!field->Pack(root.key_))) {
+    return false;
+  }
+  root.move_type_ = chess::Move::kNull;
+  root.from_ = root.to_ = chess::Field::kNpos;
+  root.parent_ = 0;
+  bool success(Spill() && Merge());
+  for (int depth(0); success && (depth != half_moves_); ++depth) {
+    success = Expand(depth);
+  }
+  if (success) {
+    success = Reconstruct(solutions);
+  }
+  Close();
+  records_.clear();
+  mates_.clear();
+  return success;
+}
+
+bool BreadthFirst::Expand(int depth) {
+  std::FILE *level(levels_[static_cast<std::size_t>(depth)]);
+  std::rewind(level);
+  // The first record of each distinct position of the batch
+  std::vector<Record> batch;
+  std::uint64_t position(0);  // The number of the first position in batch
+  Record record;
+  bool have(std::fread(&record, sizeof(Record), 1, level) == 1);
+  while (have) {
+    batch.clear();
+    while (have && (batch.size() < kBatchSize)) {
+      batch.push_back(record);
+      // Skip the other records of the same position
+      while ((have = (std::fread(&record, sizeof(Record), 1, level) == 1)) &&
+        (std::memcmp(record.key_, batch.back().key_, kPackedSize) == 0)) {
+      }
+    }
+    nodes_ += batch.size();
+#ifndef NO_CHESSPROBLEM_THREADS
+    // Each thread should have a reasonable amount of work
+    std::size_t threads(batch.size() / 64 + 1);
+    if (threads > static_cast<std::size_t>(max_threads_)) {
+      threads = static_cast<std::size_t>(max_threads_);
+    }
+    std::vector<std::vector<Record>> records(threads);
+    std::vector<std::vector<Mate>> mates(threads);
+    std::vector<std::thread> pool;
+    std::size_t size(batch.size() / threads);
+    for (std::size_t i(1); i != threads; ++i) {
+      std::size_t begin(i * size);
+      std::size_t end((i + 1 == threads) ? batch.size() : (begin + size));
+      pool.emplace_back(&BreadthFirst::ExpandRange, this, depth,
+        batch.data() + begin, batch.data() + end, position + begin,
+        &records[i], &mates[i]);
+    }
+    ExpandRange(depth, batch.data(), batch.data() +
+      ((threads == 1) ? batch.size() : size), position, &records[0],
+      &mates[0]);
+    for (auto& thread : pool) {
+      thread.join();
+    }
+    for (std::size_t i(0); i != threads; ++i) {
+      records_.insert(records_.end(), records[i].begin(), records[i].end());
+      mates_.insert(mates_.end(), mates[i].begin(), mates[i].end());
+    }
+#else  // defined(NO_CHESSPROBLEM_THREADS)
+    ExpandRange(depth, batch.data(), batch.data() + batch.size(), position,
+      &records_, &mates_);
+#endif  // NO_CHESSPROBLEM_THREADS
+    position += batch.size();
+    if ((records_.size() >= max_records_) && UNLIKELY(!Spill())) {
+      return false;
+    }
+  }
+  if (UNLIKELY(std::ferror(level))) {
+    return false;
+  }
+  if (depth + 1 == half_moves_) {
+    // The last half moves were only tested for mate
+    return true;
+  }
+  return (Spill() && Merge());
+}
+
+void BreadthFirst::ExpandRange(int depth, const Record *begin,
+    const Record *end, std::uint64_t first_position,
+    std::vector<Record> *records, std::vector<Mate> *mates) const {
+  chess::Field field;
+  int remaining_half_moves(half_moves_ - depth);
+  std::uint64_t position(first_position);
+  for (const Record *it(begin); it != end; ++it, ++position) {
+    field.Unpack(it->key_);
+    if (UNLIKELY(!field.CanMate(mating_color_)) ||
+      UNLIKELY(field.HelpMateTooFar(mating_color_, remaining_half_moves))) {
+      continue;
+    }
+    chess::MoveList moves;
+    if (UNLIKELY(!field.Generator(&moves))) {
+      if (((remaining_half_moves & 1) == 0) && field.IsInCheck()) {
+        // An early mate, that is, a cook having less moves
+        mates->emplace_back();
+        Mate& mate = mates->back();
+        mate.depth_ = depth;
+        mate.position_ = position;
+      }
+      continue;
+    }
+    for (const auto& my_move : moves) {
+      if (remaining_half_moves == 1) {
+        if (LIKELY(!field.GivesCheck(my_move))) {
+          continue;
+        }
+        chess::push_guard guard(&field, &my_move, true);
+        if (UNLIKELY(field.IsCheckMate())) {
+          mates->emplace_back();
+          Mate& mate = mates->back();
+          mate.depth_ = depth;
+          mate.position_ = position;
+          mate.moves_.push_back(my_move);
+        }
+        continue;
+      }
+      chess::push_guard guard(&field, &my_move);
+      records->emplace_back();
+      Record& record = records->back();
+      // This cannot fail, since the number of figures cannot increase
+      field.Pack(record.key_);
+      record.move_type_ = static_cast<unsigned char>(my_move.move_type_);
+      record.from_ = static_cast<unsigned char>(my_move.from_);
+      record.to_ = static_cast<unsigned char>(my_move.to_);
+      record.parent_ = position;
+    }
+  }
+}
+
+bool BreadthFirst::Reconstruct(std::vector<chess::MoveList> *solutions) {
+  // Process the deepest mates first
+  std::sort(mates_.begin(), mates_.end(),
+    [](const Mate& a, const Mate& b) { return (a.depth_ > b.depth_); });
+  std::vector<Mate> current;
+  auto next_mate(mates_.begin());
+  for (int depth(half_moves_ - 1); depth != 0; --depth) {
+    for (; (next_mate != mates_.end()) && (next_mate->depth_ == depth);
+      ++next_mate) {
+      current.push_back(*next_mate);
+    }
+    if (current.empty()) {
+      continue;
+    }
+    std::sort(current.begin(), current.end(),
+      [](const Mate& a, const Mate& b) {
+        return (a.position_ < b.position_);
+      });
+    // Scan the level: Each record of a position in current gives a line
+    std::vector<Mate> previous;
+    std::FILE *level(levels_[static_cast<std::size_t>(depth)]);
+    std::rewind(level);
+    Record record;
+    unsigned char key[kPackedSize];
+    std::uint64_t position(0);
+    bool first(true);
+    auto it(current.cbegin());
+    while ((it != current.cend()) &&
+      (std::fread(&record, sizeof(Record), 1, level) == 1)) {
+      if (first) {
+        first = false;
+      } else if (std::memcmp(record.key_, key, kPackedSize) != 0) {
+        ++position;
+      }
+      std::memcpy(key, record.key_, kPackedSize);
+      while ((it != current.cend()) && (it->position_ < position)) {
+        ++it;
+      }
+      for (auto match(it); (match != current.cend()) &&
+        (match->position_ == position); ++match) {
+        previous.emplace_back();
+        Mate& line = previous.back();
+        line.depth_ = depth - 1;
+        line.position_ = record.parent_;
+        line.moves_.emplace_back(
+          static_cast<chess::Move::MoveType>(record.move_type_),
+          record.from_, record.to_);
+        line.moves_.insert(line.moves_.end(), match->moves_.begin(),
+          match->moves_.end());
+      }
+    }
+    if (UNLIKELY(std::ferror(level))) {
+      return false;
+    }
+    current.swap(previous);
+  }
+  // The remaining mates and lines start in the initial position
+  for (; next_mate != mates_.end(); ++next_mate) {
+    current.push_back(*next_mate);
+  }
+  for (const auto& line : current) {
+    solutions->push_back(line.moves_);
+  }
+  return true;
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,136 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_BREADTHFIRST_H_
+#define CHESSPROBLEM_BREADTHFIRST_H_ 1
+
+#include <config.h>
+
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <cstdio>  // FILE
+#include <cstring>  // memset
+
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+A level-synchronous (breadth-first) solver for kHelpMate.
+
+The positions of each level (depth) are kept as a sorted file of records;
+each record consists of the packed position, a link to its parent (the
+number of the distinct parent position in the previous level), and the move
+from the parent. Each distinct position is expanded only once, even if it
+is reached by many lines. The records of a new level are collected in
+memory; whenever the memory limit is reached, they are sorted and spilled
+to a temporary file, and at the end of the level these runs are merged.
+The expansion of each batch of positions is split among several threads.
+
+When all levels are done, the solutions are reconstructed backwards by
+scanning the level files and following the parent links.
+
+This class itself is not thread-safe.
+*/
+
+class BreadthFirst {
+ public:
+  // The size of the records in memory is limited by about megabytes.
+  // At most max_threads threads are used for the expansion.
+  BreadthFirst(std::size_t megabytes, int max_threads);
+
+  ~BreadthFirst();
+
+  // Append all helpmates of mating_color within half_moves to *solutions:
+  // Each solution is the list of moves starting from field.
+  // Return false if temporary files could not be used or if field has too
+  // many figures for Field::Pack().
+  ATTRIBUTE_NONNULL_ bool Solve(chess::Field *field, int half_moves,
+      chess::Figure mating_color, std::vector<chess::MoveList> *solutions);
+
+  // The number of distinct positions expanded by all Solve() calls
+  ATTRIBUTE_NODISCARD std::uint64_t get_nodes() const {
+    return nodes_;
+  }
+
+  BreadthFirst(const BreadthFirst& b) = delete;
+  BreadthFirst& operator=(const BreadthFirst& b) = delete;
+
+ private:
+  // The size of the packed position, see chess::Field::Pack()
+  constexpr static const std::size_t kPackedSize = chess::Field::kPackedSize;
+
+  // The number of positions which are read and expanded at once
+  constexpr static const std::size_t kBatchSize = 4096;
+
+  // Plain data which is written to the files as it is.
+  // The constructor zeroes also the padding so that no uninitialized bytes
+  // are written.
+  class Record {
+   public:
+    unsigned char key_[kPackedSize];  // the packed position
+    unsigned char move_type_, from_, to_;
+    std::uint64_t parent_;
+
+    Record() {
+      std::memset(static_cast<void *>(this), 0, sizeof(*this));
+    }
+  };
+
+  // The end of a solution: position number and depth of the position from
+  // which the (possibly empty) list of moves leads to mate
+  class Mate {
+   public:
+    int depth_;
+    std::uint64_t position_;
+    chess::MoveList moves_;
+  };
+
+  std::size_t max_records_;
+  int max_threads_;
+  int half_moves_;
+  chess::Figure mating_color_;
+  std::uint64_t nodes_;
+
+  // Indexed by depth
+  std::vector<std::FILE *> levels_;
+
+  // The sorted runs of the level which is currently generated
+  std::vector<std::FILE *> runs_;
+
+  std::vector<Record> records_;
+  std::vector<Mate> mates_;
+
+  // Sort records_ and write them to a new run. Return false on failure.
+  bool Spill();
+
+  // Merge runs_ into a new level. Return false on failure.
+  bool Merge();
+
+  // Generate level depth + 1 from level depth. Return false on failure.
+  bool Expand(int depth);
+
+  // Expand the positions of the records from begin to end (exclusive),
+  // the first having the number first_position.
+  // The new records and mates are appended to *records and *mates.
+  ATTRIBUTE_NONNULL_ void ExpandRange(int depth, const Record *begin,
+      const Record *end, std::uint64_t first_position,
+      std::vector<Record> *records, std::vector<Mate> *mates) const;
+
+  // Follow the parent links of mates_. Return false on failure.
+  ATTRIBUTE_NONNULL_ bool Reconstruct(
+      std::vector<chess::MoveList> *solutions);
+
+  void Close();
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_BREADTHFIRST_H_
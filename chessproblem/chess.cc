@@ -9,9 +9,18 @@
 #include <config.h>
 
 #include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <cstring>  // memcpy
+#ifdef HAVE_PEXT
+#include <immintrin.h>
+#endif
 
+#include <algorithm>  // equal, fill
 #include <string>
-#include <utility>  // move
+#include <type_traits>
+#include <utility>  // move, pair
+#include <vector>
 
 #include "chessproblem/m_attribute.h"
 #include "chessproblem/m_likely.h"
@@ -71,6 +80,10 @@ const PosDelta
   Field::kBlackPawnHit2,
   Field::kBlackPawnMove;
 
+const unsigned int Field::kPackedFigures;
+const std::size_t Field::kPackedSize;
+const int Field::kSymmetries;
+
 const PosDelta Field::bishop_deltas[] = {
   kUpLeft, kUpRight, kDownLeft, kDownRight
 };
@@ -99,6 +112,118 @@ const PosDelta Field::black_pawn_hit_deltas[] = {
   kBlackPawnHit2
 };
 
+namespace {
+
+// The random numbers for Field::get_hash(), generated by splitmix64
+class HashKeys {
+ public:
+  Hash figure_[kMaxFigure + 1][Field::kFieldSize];
+  Hash ep_[Field::kFieldSize];
+  Hash castling_[kUnknownCastling + 1];
+  Hash color_;
+
+  HashKeys() : state_(0x9E3779B97F4A7C15U) {
+    for (auto& figure : figure_) {
+      for (auto& key : figure) {
+        key = Next();
+      }
+    }
+    for (auto& key : ep_) {
+      key = Next();
+    }
+    for (auto& key : castling_) {
+      key = Next();
+    }
+    color_ = Next();
+  }
+
+ private:
+  Hash state_;
+
+  Hash Next() {
+    Hash z(state_ += 0x9E3779B97F4A7C15U);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9U;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBU;
+    return z ^ (z >> 31);
+  }
+};
+
+const HashKeys hash_keys;
+
+// The symmetries of the board for Field::get_canonical_hash():
+// Index 0 is the identity, index 1 is left-right mirroring, and the
+// others are only used without pawns.
+class Symmetries {
+ public:
+  constexpr static const int kCount = Field::kSymmetries;
+  Pos map_[kCount][Field::kFieldSize];
+
+  Symmetries() {
+    for (auto& map : map_) {
+      for (auto& pos : map) {
+        pos = Field::kNpos;
+      }
+    }
+    constexpr const Pos kMaxColumn = Field::kColumns - 1;
+    constexpr const Pos kMaxRow = Field::kRows - 1;
+    for (Pos row(0); row <= kMaxRow; ++row) {
+      for (Pos column(0); column <= kMaxColumn; ++column) {
+        Pos pos(Calc(row, column));
+        map_[0][pos] = pos;
+        map_[1][pos] = Calc(row, kMaxColumn - column);
+        map_[2][pos] = Calc(kMaxRow - row, column);
+        map_[3][pos] = Calc(kMaxRow - row, kMaxColumn - column);
+        if (kCount == 8) {
+          map_[4][pos] = Calc(column, row);
+          map_[5][pos] = Calc(column, kMaxRow - row);
+          map_[6][pos] = Calc(kMaxColumn - column, row);
+          map_[7][pos] = Calc(kMaxColumn - column, kMaxRow - row);
+        }
+      }
+    }
+  }
+
+ private:
+  constexpr static Pos Calc(Pos row, Pos column) {
+    return Field::kFieldStart + row * (Field::kColumns + 2) + column;
+  }
+};
+
+const int Symmetries::kCount;
+
+const Symmetries symmetries;
+
+// The keys of hash_keys.figure_ for the positions mapped by the symmetries
+// 1, ..., kCount - 1, arranged for Field::FlipHash()
+class SymmetricKeys {
+ public:
+  Hash figure_[kMaxFigure + 1][Field::kFieldSize][Symmetries::kCount - 1];
+
+  SymmetricKeys() {
+    for (Figure figure(0); figure <= kMaxFigure; ++figure) {
+      for (Pos pos(0); pos != Field::kFieldSize; ++pos) {
+        for (int i(1); i != Symmetries::kCount; ++i) {
+          figure_[figure][pos][i - 1] =
+            hash_keys.figure_[figure][symmetries.map_[i][pos]];
+        }
+      }
+    }
+  }
+};
+
+const SymmetricKeys symmetric_keys;
+
+static_assert(Field::kColumns * Field::kRows <= 64,
+  "the board does not fit into a bitboard");
+
+// The bit of a field (on the board) in Field::occupied_ and in Field::Pack()
+constexpr unsigned int BitboardBit(Pos pos) {
+  return ((pos - Field::kFieldStart) / (Field::kColumns + 2) * Field::kColumns
+    + (pos - Field::kFieldStart) % (Field::kColumns + 2));
+}
+
+}  // namespace
+
 void Move::Append(string *res, Figure from_figure, Figure to_figure) const {
   switch (move_type_) {
     case Move::kShortCastling:
@@ -107,6 +232,9 @@ void Move::Append(string *res, Figure from_figure, Figure to_figure) const {
     case Move::kLongCastling:
       res->append("0-0-0");
       return;
+    case Move::kNull:
+      res->append("--");
+      return;
     case Move::kEnPassant:
       to_figure = kEmpty + 1;  // Display a hit
     default:
@@ -246,6 +374,10 @@ Pos Field::CalcPos(const string& letter_number) {
 }
 
 void Field::ClearField() {
+  hash_ = 0;
+  symmetric_hashes_.fill(0);
+  count_.fill(0);
+  light_bishops_.fill(0);
   color_ = kWhiteKing;
   ep_ = kUnknownEnPassant;
   castling_ = kUnknownCastling;
@@ -264,6 +396,19 @@ void Field::ClearField() {
   while (i < kFieldSize) {
     field_[i++] = kNoFigure;
   }
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  for (auto& attacks : attacks_) {
+    attacks.fill(0);
+  }
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  for (auto& targets : targets_) {
+    targets.size_ = 0;
+  }
+#endif
+#ifdef HAVE_PEXT
+  occupied_ = 0;
+#endif
 }
 
 void Field::clear() {
@@ -281,6 +426,21 @@ void Field::assign(const Field& f) noexcept {
   pos_lists_ = f.pos_lists_;
   kings_ = f.kings_;
   move_stack_ = f.move_stack_;
+  copy_make_ = f.copy_make_;
+  positions_ = f.positions_;
+  hash_ = f.hash_;
+  symmetric_hashes_ = f.symmetric_hashes_;
+  count_ = f.count_;
+  light_bishops_ = f.light_bishops_;
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  attacks_ = f.attacks_;
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  targets_ = f.targets_;
+#endif
+#ifdef HAVE_PEXT
+  occupied_ = f.occupied_;
+#endif
   RecreateRefs();
 }
 
@@ -292,9 +452,56 @@ void Field::assign(Field&& f) noexcept {
   pos_lists_ = std::move(f.pos_lists_);
   kings_ = std::move(f.kings_);
   move_stack_ = std::move(f.move_stack_);
+  copy_make_ = f.copy_make_;
+  positions_ = std::move(f.positions_);
+  hash_ = f.hash_;
+  symmetric_hashes_ = f.symmetric_hashes_;
+  count_ = f.count_;
+  light_bishops_ = f.light_bishops_;
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  attacks_ = f.attacks_;
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  targets_ = f.targets_;
+#endif
+#ifdef HAVE_PEXT
+  occupied_ = f.occupied_;
+#endif
   RecreateRefs();
 }
 
+#ifdef HAVE_PEXT
+inline void Field::FlipOccupied(Pos pos) const {
+  occupied_ ^= (std::uint64_t(1) << BitboardBit(pos));
+}
+#else
+inline void Field::FlipOccupied(Pos /* pos */) const {
+}
+#endif
+
+inline void Field::AddCount(Figure figure, Pos pos) {
+  ++count_[figure];
+  if (UNLIKELY(UncoloredFigure(figure) == kBishop) && IsLightSquare(pos)) {
+    ++light_bishops_[Color2Index(FigureColor(figure))];
+  }
+}
+
+inline void Field::SubCount(Figure figure, Pos pos) {
+  --count_[figure];
+  if (UNLIKELY(UncoloredFigure(figure) == kBishop) && IsLightSquare(pos)) {
+    --light_bishops_[Color2Index(FigureColor(figure))];
+  }
+}
+
+inline void Field::FlipHash(Figure figure, Pos pos) {
+  hash_ ^= hash_keys.figure_[figure][pos];
+  const Hash (&keys)[Symmetries::kCount - 1] =
+    symmetric_keys.figure_[figure][pos];
+  for (std::size_t i(0); i != symmetric_hashes_.size(); ++i) {
+    symmetric_hashes_[i] ^= keys[i];
+  }
+}
+
 void Field::PlaceFigure(Figure figure, Pos pos) {
   assert((pos >= kFieldStart) && (pos < kFieldEnd));
   auto i(FigureColor(figure));
@@ -306,11 +513,30 @@ void Field::PlaceFigure(Figure figure, Pos pos) {
   Figure& field = field_[pos];
   Pointer& ref = refs_[pos];
   assert(field != kNoFigure);
+  if (LIKELY(field == kEmpty)) {
+    FlipOccupied(pos);
+  }
   if (UNLIKELY(field != kEmpty)) {
     pos_lists_[Color2Index(FigureColor(field))].erase(ref);
+    FlipHash(field, pos);
+    SubCount(field, pos);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+    AddAttacks(&attacks_, field, pos, -1);
+  } else {
+    AddRays(pos, -1);
+#endif
   }
   field = figure;
   ref = pos_list.begin();
+  FlipHash(figure, pos);
+  AddCount(figure, pos);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AddAttacks(&attacks_, figure, pos, 1);
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  CalcTargets(&targets_[pos], pos);
+  UpdateTargets(pos);
+#endif
 }
 
 void Field::RemoveFigure(Pos pos) {
@@ -318,7 +544,20 @@ void Field::RemoveFigure(Pos pos) {
   Figure& field = field_[pos];
   assert((field != kEmpty) && (field != kNoFigure));
   pos_lists_[Color2Index(FigureColor(field))].erase(refs_[pos]);
+  FlipHash(field, pos);
+  SubCount(field, pos);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AddAttacks(&attacks_, field, pos, -1);
+#endif
+  FlipOccupied(pos);
   field = kEmpty;
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AddRays(pos, 1);
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  targets_[pos].size_ = 0;
+  UpdateTargets(pos);
+#endif
 }
 
 void Field::MoveFigure(Pos from, Pos to) {
@@ -333,14 +572,43 @@ void Field::MoveFigure(Pos from, Pos to) {
   Figure& to_field = field_[to];
   Pointer& to_ref = refs_[to];
   assert(to_field != kNoFigure);
+  FlipOccupied(from);
+  if (LIKELY(to_field == kEmpty)) {
+    FlipOccupied(to);
+  }
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  // First vacate from, then occupy to: The rays are always updated for
+  // the current figure placement
+  AddAttacks(&attacks_, figure, from, -1);
+  from_field = kEmpty;
+  AddRays(from, 1);
+#endif
   if (UNLIKELY(to_field != kEmpty)) {
     pos_lists_[Color2Index(FigureColor(to_field))].erase(to_ref);
+    FlipHash(to_field, to);
+    SubCount(to_field, to);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+    AddAttacks(&attacks_, to_field, to, -1);
+  } else {
+    AddRays(to, -1);
+#endif
   }
+  FlipHash(figure, from);
+  FlipHash(figure, to);
   from_field = kEmpty;
   to_field = figure;
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AddAttacks(&attacks_, figure, to, 1);
+#endif
   Pointer from_ref(refs_[from]);
   *from_ref = to;
   to_ref = from_ref;
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  targets_[from].size_ = 0;
+  CalcTargets(&targets_[to], to);
+  UpdateTargets(from);
+  UpdateTargets(to);
+#endif
 }
 
 bool Field::LegalState() const {
@@ -363,13 +631,72 @@ bool Field::LegalState() const {
   }
   PosList::size_type count[kIndexMax + 1];
   count[Color2Index(kWhite)] = count[Color2Index(kBlack)] = 0;
+  Hash hash(0);
+  std::array<Hash, kSymmetries - 1> symmetric_hashes;
+  symmetric_hashes.fill(0);
+  std::array<unsigned char, kMaxFigure + 1> figures;
+  std::array<unsigned char, kIndexMax + 1> light_bishops;
+  figures.fill(0);
+  light_bishops.fill(0);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AttackMaps attacks;
+  for (auto& a : attacks) {
+    a.fill(0);
+  }
+#endif
+#ifdef HAVE_PEXT
+  std::uint64_t occupied(0);
+#endif
   for (Pos pos(kFieldStart); pos < kFieldEnd; ++pos) {
     Figure figure(field_[pos]);
     if ((figure != kEmpty) && (figure != kNoFigure)) {
       ++count[Color2Index(FigureColor(figure))];
+      hash ^= hash_keys.figure_[figure][pos];
+      for (std::size_t i(0); i != symmetric_hashes.size(); ++i) {
+        symmetric_hashes[i] ^=
+          hash_keys.figure_[figure][symmetries.map_[i + 1][pos]];
+      }
+      ++figures[figure];
+      if ((UncoloredFigure(figure) == kBishop) && IsLightSquare(pos)) {
+        ++light_bishops[Color2Index(FigureColor(figure))];
+      }
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+      AddAttacks(&attacks, figure, pos, 1);
+#endif
+#ifdef HAVE_PEXT
+      occupied |= (std::uint64_t(1) << BitboardBit(pos));
+#endif
+    }
+  }
+#ifdef HAVE_PEXT
+  if (occupied != occupied_) {
+    return false;
+  }
+#endif
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  if (attacks != attacks_) {
+    return false;
+  }
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  for (Pos pos(kFieldStart); pos < kFieldEnd; ++pos) {
+    if (field_[pos] == kNoFigure) {
+      continue;
+    }
+    MoveTargets targets;
+    CalcTargets(&targets, pos);
+    const MoveTargets& current = targets_[pos];
+    if ((targets.size_ != current.size_) ||
+      !std::equal(targets.to_.begin(), targets.to_.begin() + targets.size_,
+        current.to_.begin())) {
+      return false;
     }
   }
-  return (count[Color2Index(kWhite)] == pos_lists_[Color2Index(kWhite)].size())
+#endif
+  return (hash == hash_) && (symmetric_hashes == symmetric_hashes_) &&
+      (figures == count_) &&
+      (light_bishops == light_bishops_)
+      && (count[Color2Index(kWhite)] == pos_lists_[Color2Index(kWhite)].size())
       && (count[Color2Index(kBlack)] == pos_lists_[Color2Index(kBlack)].size());
 }
 
@@ -451,245 +778,1599 @@ bool Field::HaveData() const {
 }
 
 bool Field::HaveKings() const {
-  return ((field_[kings_[Color2Index(kWhite)]] = kWhiteKing) &&
-    (field_[kings_[Color2Index(kBlack)]] = kBlackKing));
+  return ((field_[kings_[Color2Index(kWhite)]] == kWhiteKing) &&
+    (field_[kings_[Color2Index(kBlack)]] == kBlackKing));
 }
 
-void Field::PushMove(const Move *my_move) {
-  assert(LegalValues());
-  Castling castling(castling_);
-  Figure color(color_);
-  Pos from(my_move->from_), to(my_move->to_);
-  move_stack_.emplace_back(my_move, ep_, castling, field_[from], field_[to]);
-  ep_ = 0;
-  Move::MoveType move_type(my_move->move_type_);
-  switch (move_type) {
-    case Move::kEnPassant:
-      RemoveFigure(AddDelta(to,
-        ((color == kWhite) ? kBlackPawnMove : kWhitePawnMove)));
-      MoveFigure(from, to);
-      break;
-    case Move::kDouble:
-      MoveFigure(from, to);
-      ep_ = AddDelta(to,
-        (color == kWhite) ? kBlackPawnMove : kWhitePawnMove);
-      break;
-    case Move::kQueen:
-      MoveFigure(from, to);
-      field_[to] = ColoredFigure(kQueen, color);
-      break;
-    case Move::kKnight:
-      MoveFigure(from, to);
-      field_[to] = ColoredFigure(kKnight, color);
-      break;
-    case Move::kRook:
-      MoveFigure(from, to);
-      field_[to] = ColoredFigure(kRook, color);
-      break;
-    case Move::kBishop:
-      MoveFigure(from, to);
-      field_[to] = ColoredFigure(kBishop, color);
-      break;
-    case Move::kShortCastling:
-      MoveFigure(to, AddDelta(from, kRight));
-      MoveFigure(from, AddDelta(from, kRight + kRight));
-      castling_ = UnsetCastling(castling,
-        (color == kWhite) ? kNoWhiteCastling : kNoBlackCastling);
-      break;
-    case Move::kLongCastling:
-      MoveFigure(to, AddDelta(from, kLeft));
-      MoveFigure(from, AddDelta(from, kLeft + kLeft));
-      castling_ = UnsetCastling(castling,
-        (color == kWhite) ? kNoWhiteCastling : kNoBlackCastling);
-      break;
-    default:
-    // case Move::kNormal:
-      switch (from) {
-        case kPosWhiteShortRook:
-          if (color == kWhite) {
-            castling_ = UnsetCastling(castling, kNoWhiteShortCastling);
-          }
-          break;
-        case kPosWhiteLongRook:
-          if (color == kWhite) {
-            castling_ = UnsetCastling(castling, kNoWhiteLongCastling);
-          }
-          break;
-        case kPosWhiteKing:
-          if (color == kWhite) {
-            castling_ = UnsetCastling(castling, kNoWhiteCastling);
-          }
-        case kPosBlackShortRook:
-          if (color != kWhite) {
-            castling_ = UnsetCastling(castling, kNoBlackShortCastling);
-          }
-          break;
-        case kPosBlackLongRook:
-          if (color != kWhite) {
-            castling_ = UnsetCastling(castling, kNoBlackLongCastling);
-          }
-          break;
-        case kPosBlackKing:
-          if (color != kWhite) {
-            castling_ = UnsetCastling(castling, kNoBlackCastling);
-          }
-          break;
-        default:
-          break;
-      }
-      MoveFigure(from, to);
-      break;
+Hash Field::get_hash() const {
+  Hash hash(hash_ ^ hash_keys.castling_[castling_]);
+  if (color_ != kWhite) {
+    hash ^= hash_keys.color_;
   }
-  color_ = InvertColor(color);
-}
-
-const Move *Field::PopMove() {
-  const MoveStore& save_move = move_stack_.back();
-  const Move *my_move(save_move.move_);
-  ep_ = save_move.ep_;
-  castling_ = save_move.castling_;
-  Figure to_figure(save_move.to_figure_);
-  Pos from(my_move->from_), to(my_move->to_);
-  Figure color(InvertColor(color_));
-  Move::MoveType move_type(my_move->move_type_);
-  switch (move_type) {
-    case Move::kEnPassant:
-      MoveFigure(to, from);
-      if (color == kWhite) {
-        PlaceFigure(kBlackPawn, AddDelta(to, kBlackPawnMove));
-      } else {
-        PlaceFigure(kWhitePawn, AddDelta(to, kWhitePawnMove));
-      }
-      break;
-    case Move::kShortCastling:
-      MoveFigure(AddDelta(from, kRight), to);
-      MoveFigure(AddDelta(from, kRight + kRight), from);
-      break;
-    case Move::kLongCastling:
-      MoveFigure(AddDelta(from, kLeft), to);
-      MoveFigure(AddDelta(from, kLeft + kLeft), from);
-      break;
-    case Move::kQueen:
-    case Move::kKnight:
-    case Move::kRook:
-    case Move::kBishop:
-      field_[to] = ColoredFigure(kPawn, color);
-      ATTRIBUTE_FALLTHROUGH
-    default:
-    // case Move::kNormal:
-    // case Move::kDouble:
-      MoveFigure(to, from);
-      if (to_figure != kEmpty) {
-        PlaceFigure(to_figure, to);
-      }
-      break;
+  if (UNLIKELY(ep_ != kNoEnPassant) && IsEnPassantValid(ep_, true)) {
+    hash ^= hash_keys.ep_[ep_];
   }
-  color_ = color;
-  move_stack_.pop_back();
-  return my_move;
+  return hash;
 }
 
-bool Field::IsThreatened(Pos pos, Figure color) const {
-  Figure invert_color(InvertColor(color));
-  Figure check_queen(ColoredFigure(kQueen, invert_color));
-  Figure check_king(ColoredFigure(kKing, invert_color));
-  Figure check_figure(ColoredFigure(kBishop, invert_color));
-  for (auto curr_delta : bishop_deltas) {
-    Pos destpos(LongAddDelta(pos, curr_delta));
-    Figure figure(field_[destpos]);
-    if ((figure == check_figure) || (figure == check_queen) ||
-      ((figure == check_king) &&
-        (destpos == AddDelta(pos, curr_delta)))) {
-      return true;
-    }
+Hash Field::get_canonical_hash() const {
+  if (castling_ != kNoCastling) {
+    return get_hash();
   }
-  check_figure = ColoredFigure(kRook, invert_color);
-  for (auto curr_delta : rook_deltas) {
-    Pos destpos(LongAddDelta(pos, curr_delta));
-    Figure figure(field_[destpos]);
-    if ((figure == check_figure) || (figure == check_queen) ||
-      ((figure == check_king) &&
-        (destpos == AddDelta(pos, curr_delta)))) {
-      return true;
-    }
+  bool have_pawns((count_[kWhitePawn] != 0) || (count_[kBlackPawn] != 0));
+  EnPassant ep(kNoEnPassant);
+  if (have_pawns && UNLIKELY(ep_ != kNoEnPassant) &&
+    IsEnPassantValid(ep_, true)) {
+    ep = ep_;
   }
-  check_figure = ColoredFigure(kKnight, invert_color);
-  for (auto curr_delta : knight_deltas) {
-    Figure figure(field_[AddDelta(pos, curr_delta)]);
-    if (figure == check_figure) {
-      return true;
-    }
+  // The part of the hash besides the figures
+  Hash state(hash_keys.castling_[kNoCastling]);
+  if (color_ != kWhite) {
+    state ^= hash_keys.color_;
   }
-  if (color == kWhite) {
-    if ((field_[AddDelta(pos, kWhitePawnHit1)] == kBlackPawn) ||
-        (field_[AddDelta(pos, kWhitePawnHit2)] == kBlackPawn)) {
-      return true;
+  Hash result(state ^ hash_);
+  if (UNLIKELY(ep != kNoEnPassant)) {
+    result ^= hash_keys.ep_[ep];
+  }
+  // With pawns, only the mirroring of the columns is a symmetry
+  std::size_t count(have_pawns ? 1 : symmetric_hashes_.size());
+  for (std::size_t i(0); i != count; ++i) {
+    Hash hash(state ^ symmetric_hashes_[i]);
+    if (UNLIKELY(ep != kNoEnPassant)) {
+      hash ^= hash_keys.ep_[symmetries.map_[i + 1][ep]];
     }
-  } else {
-    if ((field_[AddDelta(pos, kBlackPawnHit1)] == kWhitePawn) ||
-        (field_[AddDelta(pos, kBlackPawnHit2)] == kWhitePawn)) {
-      return true;
+    if (hash < result) {
+      result = hash;
     }
   }
-  return false;
+  return result;
 }
 
-Pos Field::CastlingRook(int *in_check, Pos pos, const PosDelta dir) const {
-  if (*in_check > 0) {
-    return kNpos;
-  }
-  // Rely on castling variable: assume that king and rook are correct.
-  // However, there must not be any figure in between:
-  Pos rook_pos(LongAddDelta(pos, dir));
-  if (field_[AddDelta(rook_pos, dir)] != kNoFigure) {
-    return kNpos;
+inline void Field::ChangeFigure(Pos pos, Figure figure) {
+  Figure& field = field_[pos];
+  FlipHash(field, pos);
+  FlipHash(figure, pos);
+  SubCount(field, pos);
+  AddCount(figure, pos);
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  AddAttacks(&attacks_, field, pos, -1);
+  AddAttacks(&attacks_, figure, pos, 1);
+#endif
+  field = figure;
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  CalcTargets(&targets_[pos], pos);
+#endif
+}
+
+bool Field::CanMate(Figure color) const {
+  if ((count_[ColoredFigure(kPawn, color)] != 0) ||
+    (count_[ColoredFigure(kRook, color)] != 0) ||
+    (count_[ColoredFigure(kQueen, color)] != 0)) {
+    return true;
   }
-  Figure color(color_);
-  // The king must not be threatened (in check) and neither the two next fields
-  if (*in_check == 0) {
-    if (IsThreatened(pos, color)) {
-      *in_check = 1;
-      return kNpos;
-    }
-    *in_check = -1;  // no need to test for in_check for opposite dir value
+  Pos knights(count_[ColoredFigure(kKnight, color)]);
+  Pos bishops(count_[ColoredFigure(kBishop, color)]);
+  if (knights + bishops == 0) {
+    return false;
   }
-  pos = AddDelta(pos, dir);
-  if (IsThreatened(pos, color)) {
-    return kNpos;
+  // Only a bare king cannot block its own flight squares
+  if (pos_lists_[Color2Index(InvertColor(color))].size() != 1) {
+    return true;
   }
-  pos = AddDelta(pos, dir);
-  if (IsThreatened(pos, color)) {
-    return kNpos;
+  if (knights == 0) {
+    Pos light(light_bishops_[Color2Index(color)]);
+    return ((light != 0) && (light != bishops));
   }
-  return rook_pos;
+  return ((knights != 1) || (bishops != 0));
 }
 
-bool Field::IsValidMove(const Pos from, const Pos to) const {
-  Figure& field_from = field_[from];
-  Figure figure_from(field_from);
-  Figure& field_to = field_[to];
-  Figure figure_to(field_to);
-  field_from = kEmpty;
-  field_to = figure_from;
-  Pos king_field(kings_[Color2Index(color_)]);
-  if (king_field == from) {
-    king_field = to;
+namespace {
+
+// The table for Field::CheckDistance()
+class CheckDistances {
+ public:
+  constexpr static const Pos
+    kSquares = Field::kColumns * Field::kRows;
+  constexpr static const unsigned char kUnreachable = 255;
+  // The board size as int for the square arithmetic
+  constexpr static const int
+    kColumns = static_cast<int>(Field::kColumns),
+    kRows = static_cast<int>(Field::kRows);
+  enum Type {
+    kTypeKnight, kTypeBishop, kTypeRook, kTypeQueen,
+    kTypeWhitePawn, kTypeBlackPawn, kTypes
+  };
+
+  // distance_[type][from][to] is the number of moves which a figure of type
+  // at from needs on an empty board until it attacks to.
+  unsigned char distance_[kTypes][kSquares][kSquares];
+
+  CheckDistances();
+
+  static int Square(Pos pos) {
+    return static_cast<int>((pos / (Field::kColumns + 2) - 2) * Field::kColumns
+      + (pos % (Field::kColumns + 2) - 1));
   }
-  bool result(!IsThreatened(king_field));
-  field_from = figure_from;
-  field_to = figure_to;
-  return result;
-}
 
-bool Field::GenerateLong(MoveList *moves, Pos from, PosDelta dir) const {
-  Figure color(color_);
-  for (Pos to(AddDelta(from, dir)); ; to = AddDelta(to, dir)) {
-    Figure figure(field_[to]);
-    if ((figure == kNoFigure) ||
-      ((figure != kEmpty) && FigureColor(figure) == color)) {
-      return false;
+  static Type FigureType(Figure figure) {
+    switch (UncoloredFigure(figure)) {
+      case kKnight:
+        return kTypeKnight;
+      case kBishop:
+        return kTypeBishop;
+      case kRook:
+        return kTypeRook;
+      case kQueen:
+        return kTypeQueen;
+      case kPawn:
+        return ((FigureColor(figure) == kWhite) ?
+          kTypeWhitePawn : kTypeBlackPawn);
+      default:
+        return kTypes;
+    }
+  }
+
+ private:
+  typedef std::vector<int> Squares;
+
+  // Negative values become large by the conversion to unsigned
+  static bool OnBoard(int row, int column) {
+    return ((static_cast<unsigned int>(row) < Field::kRows) &&
+      (static_cast<unsigned int>(column) < Field::kColumns));
+  }
+
+  static void AddSquare(Squares *squares, int row, int column) {
+    if (OnBoard(row, column)) {
+      squares->push_back(row * kColumns + column);
+    }
+  }
+
+  static void AddLine(Squares *squares, int row, int column,
+      int row_delta, int column_delta) {
+    for (;;) {
+      row += row_delta;
+      column += column_delta;
+      if (!OnBoard(row, column)) {
+        return;
+      }
+      squares->push_back(row * kColumns + column);
+    }
+  }
+
+  // The squares attacked by type from square on an empty board
+  static void Attacks(Squares *squares, Type type, int square);
+
+  // The (type, square) reachable by type from square with one move.
+  // For pawns, this includes transformation into queen or knight
+  // (which are sufficient for attacks).
+  static void Moves(std::vector<std::pair<Type, int>> *moves, Type type,
+      int square);
+};
+
+const Pos CheckDistances::kSquares;
+const unsigned char CheckDistances::kUnreachable;
+const int CheckDistances::kColumns, CheckDistances::kRows;
+
+void CheckDistances::Attacks(Squares *squares, Type type, int square) {
+  int row(square / kColumns), column(square % kColumns);
+  switch (type) {
+    case kTypeKnight:
+      for (int i(-2); i <= 2; ++i) {
+        for (int j(-2); j <= 2; ++j) {
+          if ((i * i + j * j) == 5) {
+            AddSquare(squares, row + i, column + j);
+          }
+        }
+      }
+      return;
+    case kTypeWhitePawn:
+    case kTypeBlackPawn: {
+        int forward((type == kTypeWhitePawn) ? 1 : -1);
+        AddSquare(squares, row + forward, column - 1);
+        AddSquare(squares, row + forward, column + 1);
+      }
+      return;
+    default:
+      break;
+  }
+  if (type != kTypeBishop) {
+    AddLine(squares, row, column, 1, 0);
+    AddLine(squares, row, column, -1, 0);
+    AddLine(squares, row, column, 0, 1);
+    AddLine(squares, row, column, 0, -1);
+  }
+  if (type != kTypeRook) {
+    AddLine(squares, row, column, 1, 1);
+    AddLine(squares, row, column, 1, -1);
+    AddLine(squares, row, column, -1, 1);
+    AddLine(squares, row, column, -1, -1);
+  }
+}
+
+void CheckDistances::Moves(std::vector<std::pair<Type, int>> *moves,
+    Type type, int square) {
+  if ((type != kTypeWhitePawn) && (type != kTypeBlackPawn)) {
+    // On an empty board, all figures except pawns move as they attack
+    Squares squares;
+    Attacks(&squares, type, square);
+    for (auto to : squares) {
+      moves->emplace_back(type, to);
+    }
+    return;
+  }
+  int row(square / kColumns), column(square % kColumns);
+  int forward, start_row, last_row;
+  if (type == kTypeWhitePawn) {
+    forward = 1;
+    start_row = 1;
+    last_row = kRows - 1;
+  } else {
+    forward = -1;
+    start_row = kRows - 2;
+    last_row = 0;
+  }
+  Squares squares;
+  AddSquare(&squares, row + forward, column);
+  if (row == start_row) {
+    AddSquare(&squares, row + 2 * forward, column);
+  }
+  // Captures
+  AddSquare(&squares, row + forward, column - 1);
+  AddSquare(&squares, row + forward, column + 1);
+  for (auto to : squares) {
+    if (to / kColumns == last_row) {
+      moves->emplace_back(kTypeQueen, to);
+      moves->emplace_back(kTypeKnight, to);
+    } else {
+      moves->emplace_back(type, to);
+    }
+  }
+}
+
+CheckDistances::CheckDistances() {
+  std::vector<std::pair<Type, int>> moves;
+  Squares attacks;
+  for (int start_type(0); start_type != kTypes; ++start_type) {
+    for (int from(0); from != static_cast<int>(kSquares); ++from) {
+      unsigned char *distance(distance_[start_type][from]);
+      for (Pos to(0); to != kSquares; ++to) {
+        distance[to] = kUnreachable;
+      }
+      // Breadth first search over the states (type, square)
+      unsigned char reached[kTypes][kSquares];
+      for (auto& r : reached) {
+        for (auto& s : r) {
+          s = kUnreachable;
+        }
+      }
+      std::vector<std::pair<Type, int>> current, next;
+      current.emplace_back(static_cast<Type>(start_type), from);
+      reached[start_type][from] = 0;
+      for (unsigned char depth(0); !current.empty(); ++depth) {
+        next.clear();
+        for (const auto& state : current) {
+          attacks.clear();
+          Attacks(&attacks, state.first, state.second);
+          for (auto to : attacks) {
+            if (distance[to] > depth) {
+              distance[to] = depth;
+            }
+          }
+          moves.clear();
+          Moves(&moves, state.first, state.second);
+          for (const auto& move : moves) {
+            unsigned char& r = reached[move.first][move.second];
+            if (r == kUnreachable) {
+              r = depth + 1;
+              next.push_back(move);
+            }
+          }
+        }
+        current.swap(next);
+      }
+    }
+  }
+}
+
+const CheckDistances check_distances;
+
+// The geometry tables of the board
+class Directions {
+ public:
+  // The fields reachable from a field with a short move
+  class Neighbours {
+   public:
+    unsigned char size_;
+    std::array<unsigned char, 8> pos_;
+  };
+
+  // direction_[from][to] is the king delta leading from from to to on an
+  // empty board, or 0 if to is not on a line with from.
+  PosDelta direction_[Field::kFieldSize][Field::kFieldSize];
+
+  // Indexed by the field: The fields on the board in the order of
+  // Field::knight_deltas and Field::king_deltas, respectively
+  Neighbours knight_[Field::kFieldSize];
+  Neighbours king_[Field::kFieldSize];
+
+  Directions();
+
+  static bool OnBoard(int pos) {
+    constexpr const int kWidth(static_cast<int>(Field::kColumns) + 2);
+    int row(pos / kWidth), column(pos % kWidth);
+    return ((row >= 2) && (row < static_cast<int>(Field::kRows) + 2) &&
+      (column >= 1) && (column <= static_cast<int>(Field::kColumns)));
+  }
+
+  static bool IsDiagonal(PosDelta dir) {
+    return ((dir == Field::kUpLeft) || (dir == Field::kUpRight) ||
+      (dir == Field::kDownLeft) || (dir == Field::kDownRight));
+  }
+
+  // Can figure (of any color) move arbitrarily far in direction dir?
+  static bool IsLongRange(Figure figure, PosDelta dir) {
+    Figure type(UncoloredFigure(figure));
+    return ((type == kQueen) ||
+      (type == (IsDiagonal(dir) ? kBishop : kRook)));
+  }
+};
+
+Directions::Directions() {
+  for (int from(0); from != Field::kFieldSize; ++from) {
+    knight_[from].size_ = king_[from].size_ = 0;
+    for (int to(0); to != Field::kFieldSize; ++to) {
+      direction_[from][to] = 0;
+    }
+    if (!OnBoard(from)) {
+      continue;
+    }
+    for (auto dir : Field::king_deltas) {
+      for (int to(from + dir); OnBoard(to); to += dir) {
+        direction_[from][to] = dir;
+      }
+      if (OnBoard(from + dir)) {
+        king_[from].pos_[king_[from].size_++] =
+          static_cast<unsigned char>(from + dir);
+      }
+    }
+    for (auto delta : Field::knight_deltas) {
+      if (OnBoard(from + delta)) {
+        knight_[from].pos_[knight_[from].size_++] =
+          static_cast<unsigned char>(from + delta);
+      }
+    }
+  }
+}
+
+const Directions directions;
+
+#ifdef HAVE_PEXT
+// The PEXT lookups for the long range figures, see SliderThreatened()
+class SliderTables {
+ public:
+  // The fields reached first from a field in the two directions of a line:
+  // The first occupied field or the last field on the board (or 0)
+  typedef std::array<unsigned char, 2> Blockers;
+
+  // Whether the processor has fast PEXT instructions
+  bool use_pext_;
+
+  // Indexed by BitboardBit() and line (horizontal, vertical, diagonal,
+  // antidiagonal): The bits of the line which can block, i.e. without the
+  // field itself and the last fields on the board, and the offset of the
+  // PEXT index into blockers_
+  std::uint64_t mask_[64][4];
+  unsigned int offset_[64][4];
+  std::vector<Blockers> blockers_;
+
+  SliderTables();
+
+  static const PosDelta line_deltas[4];
+};
+
+const PosDelta SliderTables::line_deltas[4] = {
+  Field::kRight, Field::kUp, Field::kUpRight, Field::kUpLeft
+};
+
+SliderTables::SliderTables() {
+  // Zen and Zen 2 implement PEXT in microcode which is much slower than
+  // scanning the board
+  __builtin_cpu_init();
+  use_pext_ = (__builtin_cpu_supports("bmi2") &&
+    !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2"));
+  for (int pos(0); pos != Field::kFieldSize; ++pos) {
+    if (!Directions::OnBoard(pos)) {
+      continue;
+    }
+    for (int line(0); line != 4; ++line) {
+      // The fields of the line in both directions, starting next to pos
+      std::vector<Pos> rays[2];
+      for (int side(0); side != 2; ++side) {
+        int dir((side == 0) ? line_deltas[line] : -line_deltas[line]);
+        for (int curr(pos + dir); Directions::OnBoard(curr); curr += dir) {
+          rays[side].push_back(static_cast<Pos>(curr));
+        }
+      }
+      std::vector<int> bits;
+      std::uint64_t mask(0);
+      for (const auto& ray : rays) {
+        for (std::vector<Pos>::size_type i(0); i + 1 < ray.size(); ++i) {
+          mask |= (std::uint64_t(1) << BitboardBit(ray[i]));
+        }
+      }
+      // The order of bits in the PEXT index
+      for (int bit(0); bit != 64; ++bit) {
+        if ((mask & (std::uint64_t(1) << bit)) != 0) {
+          bits.push_back(bit);
+        }
+      }
+      unsigned int b(BitboardBit(static_cast<Pos>(pos)));
+      mask_[b][line] = mask;
+      offset_[b][line] = static_cast<unsigned int>(blockers_.size());
+      for (std::uint64_t index(0); index != (std::uint64_t(1) << bits.size());
+        ++index) {
+        std::uint64_t occupied(0);
+        for (std::vector<int>::size_type i(0); i != bits.size(); ++i) {
+          if ((index & (std::uint64_t(1) << i)) != 0) {
+            occupied |= (std::uint64_t(1) << bits[i]);
+          }
+        }
+        Blockers blockers;
+        for (std::size_t side(0); side != 2; ++side) {
+          blockers[side] = 0;
+          for (Pos curr : rays[side]) {
+            blockers[side] = static_cast<unsigned char>(curr);
+            if ((occupied & (std::uint64_t(1) << BitboardBit(curr))) != 0) {
+              break;
+            }
+          }
+        }
+        blockers_.push_back(blockers);
+      }
+    }
+  }
+}
+
+const SliderTables slider_tables;
+
+// Is pos (on the board) attacked by one of the given long range figures?
+// Only for processors with BMI2.
+__attribute__((target("bmi2"))) bool SliderThreatened(const Figure *field,
+    std::uint64_t occupied, Pos pos, Figure rook, Figure bishop,
+    Figure queen) {
+  unsigned int bit(BitboardBit(pos));
+  for (int line(0); line != 4; ++line) {
+    const SliderTables::Blockers& blockers = slider_tables.blockers_[
+      slider_tables.offset_[bit][line] +
+      _pext_u64(occupied, slider_tables.mask_[bit][line])];
+    Figure check_figure((line < 2) ? rook : bishop);
+    for (auto blocker : blockers) {
+      Figure figure(field[blocker]);
+      if ((figure == check_figure) || (figure == queen)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+#endif
+
+}  // namespace
+
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+namespace {
+
+inline void AddAttack(unsigned char *count, int delta) {
+  *count = static_cast<unsigned char>(*count + delta);
+}
+
+}  // namespace
+
+void Field::AddAttacks(AttackMaps *maps, Figure figure, Pos pos, int delta)
+    const {
+  std::array<unsigned char, kFieldSize>& attacks =
+    (*maps)[Color2Index(FigureColor(figure))];
+  const PosDelta *deltas;
+  int count;
+  switch (UncoloredFigure(figure)) {
+    case kPawn:
+      deltas = ((FigureColor(figure) == kWhite) ? white_pawn_hit_deltas :
+        black_pawn_hit_deltas);
+      AddAttack(&attacks[AddDelta(pos, deltas[0])], delta);
+      AddAttack(&attacks[AddDelta(pos, deltas[1])], delta);
+      return;
+    case kKnight:
+      for (auto curr_delta : knight_deltas) {
+        AddAttack(&attacks[AddDelta(pos, curr_delta)], delta);
+      }
+      return;
+    case kKing:
+      for (auto curr_delta : king_deltas) {
+        AddAttack(&attacks[AddDelta(pos, curr_delta)], delta);
+      }
+      return;
+    case kBishop:
+      deltas = bishop_deltas;
+      count = 4;
+      break;
+    case kRook:
+      deltas = rook_deltas;
+      count = 4;
+      break;
+    default:
+    // case kQueen:
+      deltas = king_deltas;
+      count = 8;
+      break;
+  }
+  for (int i(0); i != count; ++i) {
+    Pos curr(pos);
+    do {
+      curr = AddDelta(curr, deltas[i]);
+      AddAttack(&attacks[curr], delta);
+    } while (field_[curr] == kEmpty);
+  }
+}
+
+void Field::AddRays(Pos pos, int delta) {
+  for (auto dir : king_deltas) {
+    Figure figure(field_[LongAddDelta(pos, static_cast<PosDelta>(-dir))]);
+    if (!Directions::IsLongRange(figure, dir)) {
+      continue;
+    }
+    std::array<unsigned char, kFieldSize>& attacks =
+      attacks_[Color2Index(FigureColor(figure))];
+    Pos curr(pos);
+    do {
+      curr = AddDelta(curr, dir);
+      AddAttack(&attacks[curr], delta);
+    } while (field_[curr] == kEmpty);
+  }
+}
+#endif
+
+#ifdef CHESSPROBLEM_MOVE_TABLES
+void Field::CalcTargets(MoveTargets *targets, Pos pos) const {
+  targets->size_ = 0;
+  Figure figure(field_[pos]);
+  if ((figure == kEmpty) || (figure == kNoFigure)) {
+    return;
+  }
+  Figure color(FigureColor(figure));
+  const PosDelta *deltas;
+  int count;
+  bool long_range(true);
+  switch (UncoloredFigure(figure)) {
+    case kPawn:
+      return;
+    case kKnight:
+      deltas = knight_deltas;
+      count = 8;
+      long_range = false;
+      break;
+    case kKing:
+      deltas = king_deltas;
+      count = 8;
+      long_range = false;
+      break;
+    case kBishop:
+      deltas = bishop_deltas;
+      count = 4;
+      break;
+    case kRook:
+      deltas = rook_deltas;
+      count = 4;
+      break;
+    default:
+    // case kQueen:
+      deltas = king_deltas;
+      count = 8;
+      break;
+  }
+  for (int i(0); i != count; ++i) {
+    Pos to(pos);
+    do {
+      to = AddDelta(to, deltas[i]);
+      Figure curr(field_[to]);
+      if ((curr == kNoFigure) ||
+        ((curr != kEmpty) && (FigureColor(curr) == color))) {
+        break;
+      }
+      targets->to_[targets->size_++] = static_cast<unsigned char>(to);
+      if (curr != kEmpty) {
+        break;
+      }
+    } while (long_range);
+  }
+}
+
+void Field::UpdateTargets(Pos pos) {
+  for (auto dir : king_deltas) {
+    Pos from(AddDelta(pos, static_cast<PosDelta>(-dir)));
+    Figure figure(field_[from]);
+    if (figure == kEmpty) {
+      from = LongAddDelta(from, static_cast<PosDelta>(-dir));
+      figure = field_[from];
+    } else if (UncoloredFigure(figure) == kKing) {
+      CalcTargets(&targets_[from], from);
+      continue;
+    }
+    if (Directions::IsLongRange(figure, dir)) {
+      CalcTargets(&targets_[from], from);
+    }
+  }
+  for (auto delta : knight_deltas) {
+    Pos from(AddDelta(pos, delta));
+    if (UncoloredFigure(field_[from]) == kKnight) {
+      CalcTargets(&targets_[from], from);
+    }
+  }
+}
+#endif
+
+int Field::CheckDistance(Figure color, int radius) const {
+  Pos king(kings_[Color2Index(InvertColor(color))]);
+  int king_square(CheckDistances::Square(king));
+  constexpr const int kIntColumns = CheckDistances::kColumns;
+  constexpr const int kIntRows = CheckDistances::kRows;
+  int king_row(king_square / kIntColumns);
+  int king_column(king_square % kIntColumns);
+  int min_row(king_row - radius), max_row(king_row + radius);
+  int min_column(king_column - radius), max_column(king_column + radius);
+  if (min_row < 0) {
+    min_row = 0;
+  }
+  if (max_row >= kIntRows) {
+    max_row = kIntRows - 1;
+  }
+  if (min_column < 0) {
+    min_column = 0;
+  }
+  if (max_column >= kIntColumns) {
+    max_column = kIntColumns - 1;
+  }
+  int result(CheckDistances::kUnreachable);
+  for (auto pos : pos_lists_[Color2Index(color)]) {
+    CheckDistances::Type type(CheckDistances::FigureType(field_[pos]));
+    if (type == CheckDistances::kTypes) {  // The king cannot give check
+      continue;
+    }
+    const unsigned char (&distance)[CheckDistances::kSquares] =
+      check_distances.distance_[type][CheckDistances::Square(pos)];
+    for (int row(min_row); row <= max_row; ++row) {
+      for (int column(min_column); column <= max_column; ++column) {
+        int value(distance[row * kIntColumns + column]);
+        if (value < result) {
+          if (value == 0) {
+            return 0;
+          }
+          result = value;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+bool Field::HelpMateTooFar(Figure color, int half_moves) const {
+  bool mating_moves_next(color_ == color);
+  int mating_moves((half_moves + (mating_moves_next ? 1 : 0)) / 2);
+  int king_moves(half_moves / 2);
+  if (UNLIKELY(HaveCastling(castling_,
+    (color == kWhite) ? kBlackCastling : kWhiteCastling))) {
+    // Castling is a double step of the king
+    ++king_moves;
+  }
+  return (CheckDistance(color, king_moves) > mating_moves);
+}
+
+void Field::PushMove(const Move *my_move) {
+  assert(LegalValues());
+  if (UNLIKELY(copy_make_)) {
+    MoveStack::size_type ply(move_stack_.size());
+    if (ply >= positions_.size()) {
+      positions_.resize(ply + 1);
+    }
+    SavePosition(&positions_[ply]);
+  }
+  Castling castling(castling_);
+  Figure color(color_);
+  Pos from(my_move->from_), to(my_move->to_);
+  move_stack_.emplace_back(my_move, ep_, castling, field_[from], field_[to]);
+  ep_ = 0;
+  Move::MoveType move_type(my_move->move_type_);
+  switch (move_type) {
+    case Move::kEnPassant:
+      RemoveFigure(AddDelta(to,
+        ((color == kWhite) ? kBlackPawnMove : kWhitePawnMove)));
+      MoveFigure(from, to);
+      break;
+    case Move::kDouble:
+      MoveFigure(from, to);
+      ep_ = AddDelta(to,
+        (color == kWhite) ? kBlackPawnMove : kWhitePawnMove);
+      break;
+    case Move::kQueen:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kQueen, color));
+      break;
+    case Move::kKnight:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kKnight, color));
+      break;
+    case Move::kRook:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kRook, color));
+      break;
+    case Move::kBishop:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kBishop, color));
+      break;
+    case Move::kShortCastling:
+      MoveFigure(to, AddDelta(from, kRight));
+      MoveFigure(from, AddDelta(from, kRight + kRight));
+      castling_ = UnsetCastling(castling,
+        (color == kWhite) ? kNoWhiteCastling : kNoBlackCastling);
+      break;
+    case Move::kLongCastling:
+      MoveFigure(to, AddDelta(from, kLeft));
+      MoveFigure(from, AddDelta(from, kLeft + kLeft));
+      castling_ = UnsetCastling(castling,
+        (color == kWhite) ? kNoWhiteCastling : kNoBlackCastling);
+      break;
+    case Move::kNull:
+      break;
+    default:
+    // case Move::kNormal:
+      switch (from) {
+        case kPosWhiteShortRook:
+          if (color == kWhite) {
+            castling_ = UnsetCastling(castling, kNoWhiteShortCastling);
+          }
+          break;
+        case kPosWhiteLongRook:
+          if (color == kWhite) {
+            castling_ = UnsetCastling(castling, kNoWhiteLongCastling);
+          }
+          break;
+        case kPosWhiteKing:
+          if (color == kWhite) {
+            castling_ = UnsetCastling(castling, kNoWhiteCastling);
+          }
+          break;
+        case kPosBlackShortRook:
+          if (color != kWhite) {
+            castling_ = UnsetCastling(castling, kNoBlackShortCastling);
+          }
+          break;
+        case kPosBlackLongRook:
+          if (color != kWhite) {
+            castling_ = UnsetCastling(castling, kNoBlackLongCastling);
+          }
+          break;
+        case kPosBlackKing:
+          if (color != kWhite) {
+            castling_ = UnsetCastling(castling, kNoBlackCastling);
+          }
+          break;
+        default:
+          break;
+      }
+      MoveFigure(from, to);
+      break;
+  }
+  // A rook captured on its initial field cannot castle anymore
+  if (UNLIKELY(castling_ != kNoCastling)) {
+    switch (to) {
+      case kPosWhiteShortRook:
+        castling_ = UnsetCastling(castling_, kNoWhiteShortCastling);
+        break;
+      case kPosWhiteLongRook:
+        castling_ = UnsetCastling(castling_, kNoWhiteLongCastling);
+        break;
+      case kPosBlackShortRook:
+        castling_ = UnsetCastling(castling_, kNoBlackShortCastling);
+        break;
+      case kPosBlackLongRook:
+        castling_ = UnsetCastling(castling_, kNoBlackLongCastling);
+        break;
+      default:
+        break;
+    }
+  }
+  color_ = InvertColor(color);
+}
+
+const Move *Field::PopMove() {
+  const MoveStore& save_move = move_stack_.back();
+  const Move *my_move(save_move.move_);
+  if (UNLIKELY(copy_make_)) {
+    move_stack_.pop_back();
+    RestorePosition(positions_[move_stack_.size()]);
+    return my_move;
+  }
+  ep_ = save_move.ep_;
+  castling_ = save_move.castling_;
+  Figure to_figure(save_move.to_figure_);
+  Pos from(my_move->from_), to(my_move->to_);
+  Figure color(InvertColor(color_));
+  Move::MoveType move_type(my_move->move_type_);
+  switch (move_type) {
+    case Move::kEnPassant:
+      MoveFigure(to, from);
+      if (color == kWhite) {
+        PlaceFigure(kBlackPawn, AddDelta(to, kBlackPawnMove));
+      } else {
+        PlaceFigure(kWhitePawn, AddDelta(to, kWhitePawnMove));
+      }
+      break;
+    case Move::kShortCastling:
+      MoveFigure(AddDelta(from, kRight), to);
+      MoveFigure(AddDelta(from, kRight + kRight), from);
+      break;
+    case Move::kLongCastling:
+      MoveFigure(AddDelta(from, kLeft), to);
+      MoveFigure(AddDelta(from, kLeft + kLeft), from);
+      break;
+    case Move::kNull:
+      break;
+    case Move::kQueen:
+    case Move::kKnight:
+    case Move::kRook:
+    case Move::kBishop:
+      ChangeFigure(to, ColoredFigure(kPawn, color));
+      ATTRIBUTE_FALLTHROUGH
+    default:
+    // case Move::kNormal:
+    // case Move::kDouble:
+      MoveFigure(to, from);
+      if (to_figure != kEmpty) {
+        PlaceFigure(to_figure, to);
+      }
+      break;
+  }
+  color_ = color;
+  move_stack_.pop_back();
+  return my_move;
+}
+
+namespace {
+
+// The castling right which is lost if a figure moves from or to pos
+// because pos is the initial field of a rook, see Field::PushMove()
+Castling RookCastling(Pos pos) {
+  switch (pos) {
+    case Field::kPosWhiteShortRook:
+      return kWhiteShortCastling;
+    case Field::kPosWhiteLongRook:
+      return kWhiteLongCastling;
+    case Field::kPosBlackShortRook:
+      return kBlackShortCastling;
+    case Field::kPosBlackLongRook:
+      return kBlackLongCastling;
+    default:
+      return kNoCastling;
+  }
+}
+
+// The castling rights which are lost if a figure moves from from to to
+// (castling itself excluded)
+Castling LostCastling(Pos from, Pos to) {
+  Castling lost(SetCastling(RookCastling(from), RookCastling(to)));
+  if (from == Field::kPosWhiteKing) {
+    return SetCastling(lost, kWhiteCastling);
+  }
+  if (from == Field::kPosBlackKing) {
+    return SetCastling(lost, kBlackCastling);
+  }
+  return lost;
+}
+
+}  // namespace
+
+void Field::AddRetraction(RetroMoveList *moves, Move::MoveType move_type,
+    Pos from, Pos to, bool capture, Castling castling) const {
+  Figure color(InvertColor(color_));
+  // The rights which the previous position must have additionally
+  Castling required(kNoCastling);
+  Castling lost;
+  switch (move_type) {
+    case Move::kShortCastling:
+      required = ((color == kWhite) ? kWhiteShortCastling :
+        kBlackShortCastling);
+      lost = ((color == kWhite) ? kWhiteCastling : kBlackCastling);
+      break;
+    case Move::kLongCastling:
+      required = ((color == kWhite) ? kWhiteLongCastling :
+        kBlackLongCastling);
+      lost = ((color == kWhite) ? kWhiteCastling : kBlackCastling);
+      break;
+    default:
+      lost = LostCastling(from, to);
+      break;
+  }
+  if ((required != kNoCastling) && !HaveCastling(castling, required)) {
+    return;
+  }
+  // The rights which the previous position might have additionally
+  Castling extra(UnsetCastling(UnsetCastling(castling, lost),
+    NegateCastling(castling_)));
+  // The first and last row cannot contain pawns
+  Pos row((to - kFieldStart) / (kColumns + 2));
+  bool pawn((row != 0) && (row != kRows - 1));
+  Figure opponent(color_);
+  for (Castling add(extra); ; add = static_cast<Castling>((add - 1) & extra)) {
+    if ((required == kNoCastling) || HaveCastling(add, required)) {
+      Castling previous(SetCastling(castling_, add));
+      if (!capture) {
+        moves->emplace_back(move_type, from, to, kEmpty, previous);
+      } else {
+        if (pawn) {
+          moves->emplace_back(move_type, from, to,
+            ColoredFigure(kPawn, opponent), previous);
+        }
+        for (Figure figure(kKnight); figure != kKing;
+          figure = static_cast<Figure>(figure + kKnight - kPawn)) {
+          moves->emplace_back(move_type, from, to,
+            ColoredFigure(figure, opponent), previous);
+        }
+      }
+    }
+    if (add == kNoCastling) {
+      break;
+    }
+  }
+}
+
+void Field::RetroGenerator(RetroMoveList *moves, Castling castling) const {
+  Figure color(InvertColor(color_));
+  bool white(color == kWhite);
+  PosDelta pawn_move(white ? kWhitePawnMove : kBlackPawnMove);
+  const PosDelta *pawn_hit_deltas(white ? white_pawn_hit_deltas :
+    black_pawn_hit_deltas);
+  if (UNLIKELY(ep_ != kNoEnPassant) && IsEnPassantValid(ep_, true)) {
+    // Only the double move of the pawn which can be hit
+    AddRetraction(moves, Move::kDouble, AddDelta(ep_, -pawn_move),
+      AddDelta(ep_, pawn_move), false, castling);
+    return;
+  }
+  Pos king_pos(white ? kPosWhiteKing : kPosBlackKing);
+  for (Pos to : pos_lists_[Color2Index(color)]) {
+    Figure figure(UncoloredFigure(field_[to]));
+    // The row as seen from color
+    Pos row((to - kFieldStart) / (kColumns + 2));
+    if (!white) {
+      row = kRows - 1 - row;
+    }
+    if (figure == kPawn) {
+      if (row <= 1) {  // A pawn on its initial row has not moved
+        continue;
+      }
+      Pos from(AddDelta(to, -pawn_move));
+      if (field_[from] == kEmpty) {
+        AddRetraction(moves, Move::kNormal, from, to, false, castling);
+        // After a double move, ep is stored if a hit is possible
+        Pos double_from(AddDelta(from, -pawn_move));
+        if ((row == 3) && (field_[double_from] == kEmpty) &&
+          !IsEnPassantValid(from, true)) {
+          AddRetraction(moves, Move::kDouble, double_from, to, false,
+            castling);
+        }
+      }
+      for (int i(0); i != 2; ++i) {
+        from = AddDelta(to, -pawn_hit_deltas[i]);
+        if (field_[from] != kEmpty) {
+          continue;
+        }
+        AddRetraction(moves, Move::kNormal, from, to, true, castling);
+        // For a hit en passant, the hit pawn had passed to by a double move
+        Pos hit(AddDelta(to, -pawn_move));
+        if ((row == kRows - 3) && (field_[hit] == kEmpty) &&
+          (field_[AddDelta(to, pawn_move)] == kEmpty)) {
+          moves->emplace_back(Move::kEnPassant, from, to,
+            ColoredFigure(kPawn, color_), castling_);
+        }
+      }
+      continue;
+    }
+    const PosDelta *deltas;
+    int num_deltas;
+    bool long_move(true);
+    Move::MoveType transform(Move::kNull);
+    switch (figure) {
+      case kKnight:
+        deltas = knight_deltas;
+        num_deltas = 8;
+        long_move = false;
+        transform = Move::kKnight;
+        break;
+      case kBishop:
+        deltas = bishop_deltas;
+        num_deltas = 4;
+        transform = Move::kBishop;
+        break;
+      case kRook:
+        deltas = rook_deltas;
+        num_deltas = 4;
+        transform = Move::kRook;
+        break;
+      case kQueen:
+        deltas = king_deltas;
+        num_deltas = 8;
+        transform = Move::kQueen;
+        break;
+      default:
+      // case kKing:
+        deltas = king_deltas;
+        num_deltas = 8;
+        long_move = false;
+        if ((to == AddDelta(king_pos, 2 * kRight)) &&
+          (field_[AddDelta(to, kLeft)] == ColoredFigure(kRook, color)) &&
+          (field_[king_pos] == kEmpty) &&
+          (field_[AddDelta(to, kRight)] == kEmpty)) {
+          AddRetraction(moves, Move::kShortCastling, king_pos,
+            AddDelta(to, kRight), false, castling);
+        } else if ((to == AddDelta(king_pos, 2 * kLeft)) &&
+          (field_[AddDelta(to, kRight)] == ColoredFigure(kRook, color)) &&
+          (field_[king_pos] == kEmpty) &&
+          (field_[AddDelta(to, kLeft)] == kEmpty) &&
+          (field_[AddDelta(to, 2 * kLeft)] == kEmpty)) {
+          AddRetraction(moves, Move::kLongCastling, king_pos,
+            AddDelta(to, 2 * kLeft), false, castling);
+        }
+        break;
+    }
+    for (int i(0); i != num_deltas; ++i) {
+      PosDelta dir(deltas[i]);
+      for (Pos from(AddDelta(to, dir)); field_[from] == kEmpty;
+        from = AddDelta(from, dir)) {
+        AddRetraction(moves, Move::kNormal, from, to, false, castling);
+        AddRetraction(moves, Move::kNormal, from, to, true, castling);
+        if (!long_move) {
+          break;
+        }
+      }
+    }
+    if ((transform == Move::kNull) || (row != kRows - 1)) {
+      continue;
+    }
+    // The figure might be a transformed pawn
+    Pos from(AddDelta(to, -pawn_move));
+    if (field_[from] == kEmpty) {
+      AddRetraction(moves, transform, from, to, false, castling);
+    }
+    for (int i(0); i != 2; ++i) {
+      from = AddDelta(to, -pawn_hit_deltas[i]);
+      if (field_[from] == kEmpty) {
+        AddRetraction(moves, transform, from, to, true, castling);
+      }
+    }
+  }
+}
+
+bool Field::RetractMove(const RetroMove& retro_move) {
+  const Move& my_move = retro_move.move_;
+  Figure color(InvertColor(color_));
+  Pos from(my_move.from_), to(my_move.to_);
+  ep_ = kNoEnPassant;
+  PosDelta dir(kRight);
+  switch (my_move.move_type_) {
+    case Move::kLongCastling:
+      dir = kLeft;
+      ATTRIBUTE_FALLTHROUGH
+    case Move::kShortCastling:
+      MoveFigure(AddDelta(from, 2 * dir), from);
+      MoveFigure(AddDelta(from, dir), to);
+      break;
+    case Move::kEnPassant:
+      MoveFigure(to, from);
+      PlaceFigure(retro_move.captured_, AddDelta(to,
+        (color == kWhite) ? kBlackPawnMove : kWhitePawnMove));
+      ep_ = to;
+      break;
+    case Move::kQueen:
+    case Move::kKnight:
+    case Move::kRook:
+    case Move::kBishop:
+      ChangeFigure(to, ColoredFigure(kPawn, color));
+      ATTRIBUTE_FALLTHROUGH
+    default:
+    // case Move::kNormal:
+    // case Move::kDouble:
+      MoveFigure(to, from);
+      if (retro_move.captured_ != kEmpty) {
+        PlaceFigure(retro_move.captured_, to);
+      }
+      break;
+  }
+  color_ = color;
+  castling_ = retro_move.castling_;
+  if (IsInCheck(InvertColor(color)) || !IsCastlingValid(castling_)) {
+    return false;
+  }
+  switch (my_move.move_type_) {
+    case Move::kShortCastling:
+    case Move::kLongCastling:
+      return (!IsThreatened(from, color) &&
+        !IsThreatened(AddDelta(from, dir), color) &&
+        !IsThreatened(AddDelta(from, 2 * dir), color));
+    default:
+      return true;
+  }
+}
+
+void Field::UnretractMove(const RetroMove& retro_move, EnPassant ep,
+    Castling castling) {
+  const Move& my_move = retro_move.move_;
+  Figure color(color_);
+  Pos from(my_move.from_), to(my_move.to_);
+  PosDelta dir(kRight);
+  switch (my_move.move_type_) {
+    case Move::kLongCastling:
+      dir = kLeft;
+      ATTRIBUTE_FALLTHROUGH
+    case Move::kShortCastling:
+      MoveFigure(to, AddDelta(from, dir));
+      MoveFigure(from, AddDelta(from, 2 * dir));
+      break;
+    case Move::kEnPassant:
+      RemoveFigure(AddDelta(to,
+        (color == kWhite) ? kBlackPawnMove : kWhitePawnMove));
+      MoveFigure(from, to);
+      break;
+    case Move::kQueen:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kQueen, color));
+      break;
+    case Move::kKnight:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kKnight, color));
+      break;
+    case Move::kRook:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kRook, color));
+      break;
+    case Move::kBishop:
+      MoveFigure(from, to);
+      ChangeFigure(to, ColoredFigure(kBishop, color));
+      break;
+    default:
+    // case Move::kNormal:
+    // case Move::kDouble:
+      MoveFigure(from, to);
+      break;
+  }
+  color_ = InvertColor(color);
+  ep_ = ep;
+  castling_ = castling;
+}
+
+static_assert(std::is_trivially_copyable<Field::Position>::value,
+  "Field::Position must be trivially copyable");
+
+void Field::SavePosition(Position *position) const {
+  position->hash_ = hash_;
+  position->field_ = field_;
+  position->kings_[Color2Index(kWhite)] =
+    static_cast<unsigned char>(kings_[Color2Index(kWhite)]);
+  position->kings_[Color2Index(kBlack)] =
+    static_cast<unsigned char>(kings_[Color2Index(kBlack)]);
+  position->color_ = color_;
+  position->castling_ = castling_;
+  position->ep_ = static_cast<unsigned char>(ep_);
+}
+
+void Field::RestorePosition(const Position& position) {
+  // Only the differing fields are changed: A figure which stands on another
+  // differing field is moved back (so that its list entry is kept), and the
+  // remaining fields are set.
+  std::array<Pos, kFieldSize> differ;
+  std::array<Pos, kFieldSize>::size_type size(0);
+  // Compare word-wise: Usually, only a few words differ
+  constexpr Pos kWord = sizeof(std::uint64_t);
+  static_assert(kFieldSize % kWord == 0, "kFieldSize must be a word multiple");
+  for (Pos word(0); word != kFieldSize; word += kWord) {
+    std::uint64_t current, saved;
+    std::memcpy(&current, &field_[word], kWord);
+    std::memcpy(&saved, &position.field_[word], kWord);
+    if (LIKELY(current == saved)) {
+      continue;
+    }
+    for (Pos pos(word); pos != word + kWord; ++pos) {
+      if (field_[pos] != position.field_[pos]) {
+        differ[size++] = pos;
+      }
+    }
+  }
+  for (decltype(size) i(0); i != size; ++i) {
+    Pos to(differ[i]);
+    Figure figure(position.field_[to]);
+    if ((figure == kEmpty) || (field_[to] == figure)) {
+      continue;
+    }
+    for (decltype(size) j(0); j != size; ++j) {
+      Pos from(differ[j]);
+      if ((field_[from] == figure) && (position.field_[from] != figure)) {
+        MoveFigure(from, to);
+        break;
+      }
+    }
+  }
+  for (decltype(size) i(0); i != size; ++i) {
+    Pos pos(differ[i]);
+    Figure figure(position.field_[pos]);
+    if (field_[pos] == figure) {
+      continue;
     }
-    if (LIKELY(IsValidMove(from, to))) {
+    if (figure == kEmpty) {
+      RemoveFigure(pos);
+    } else {
+      PlaceFigure(figure, pos);
+    }
+  }
+  kings_[Color2Index(kWhite)] = position.kings_[Color2Index(kWhite)];
+  kings_[Color2Index(kBlack)] = position.kings_[Color2Index(kBlack)];
+  color_ = position.color_;
+  castling_ = position.castling_;
+  ep_ = position.ep_;
+  assert(hash_ == position.hash_);
+}
+
+bool Field::Pack(unsigned char *packed) const {
+  if (UNLIKELY(pos_lists_[Color2Index(kWhite)].size() +
+    pos_lists_[Color2Index(kBlack)].size() > kPackedFigures)) {
+    return false;
+  }
+  std::uint64_t occupied(0);
+  unsigned char *figures(packed + 8);
+  std::fill(figures, packed + kPackedSize, 0);
+  unsigned int count(0);
+  for (Pos row(0); row != kRows; ++row) {
+    Pos pos(kFieldStart + row * (kColumns + 2));
+    for (Pos column(0); column != kColumns; ++column, ++pos) {
+      Figure figure(field_[pos]);
+      if (figure == kEmpty) {
+        continue;
+      }
+      occupied |= (std::uint64_t(1) << BitboardBit(pos));
+      figures[count / 2] |= static_cast<unsigned char>(
+        ((count & 1) == 0) ? figure : (figure << 4));
+      ++count;
+    }
+  }
+  // Little endian, independent of the machine
+  for (unsigned int i(0); i != 8; ++i) {
+    packed[i] = static_cast<unsigned char>(occupied >> (8 * i));
+  }
+  packed[kPackedSize - 2] = static_cast<unsigned char>(color_ |
+    (castling_ << 1));
+  // Like get_hash(), ignore ep if no ep hit is possible
+  packed[kPackedSize - 1] = static_cast<unsigned char>(
+    ((ep_ != kNoEnPassant) && IsEnPassantValid(ep_, true)) ? ep_ :
+    kNoEnPassant);
+  return true;
+}
+
+void Field::Unpack(const unsigned char *packed) {
+  clear();
+  std::uint64_t occupied(0);
+  for (unsigned int i(0); i != 8; ++i) {
+    occupied |= (std::uint64_t(packed[i]) << (8 * i));
+  }
+  const unsigned char *figures(packed + 8);
+  unsigned int count(0);
+  for (Pos row(0); row != kRows; ++row) {
+    Pos pos(kFieldStart + row * (kColumns + 2));
+    for (Pos column(0); column != kColumns; ++column, ++pos) {
+      if ((occupied & (std::uint64_t(1) << BitboardBit(pos))) == 0) {
+        continue;
+      }
+      unsigned char nibbles(figures[count / 2]);
+      PlaceFigure(static_cast<Figure>(((count & 1) == 0) ?
+        (nibbles & 0x0F) : (nibbles >> 4)), pos);
+      ++count;
+    }
+  }
+  set_color(packed[kPackedSize - 2] & 1);
+  set_castling(static_cast<Castling>(packed[kPackedSize - 2] >> 1));
+  set_ep(packed[kPackedSize - 1]);
+}
+
+bool Field::ScanThreatened(Pos pos, Figure color) const {
+  return ((color == kWhite) ? ScanThreatened<kWhite>(pos) :
+    ScanThreatened<kBlack>(pos));
+}
+
+template<Figure kColor> bool Field::ScanThreatened(Pos pos) const {
+  constexpr Figure kInvertColor(InvertColor(kColor));
+  constexpr Figure kCheckQueen(ColoredFigure(kQueen, kInvertColor));
+  constexpr Figure kCheckKing(ColoredFigure(kKing, kInvertColor));
+  constexpr Figure kCheckBishop(ColoredFigure(kBishop, kInvertColor));
+  constexpr Figure kCheckRook(ColoredFigure(kRook, kInvertColor));
+  constexpr Figure kCheckKnight(ColoredFigure(kKnight, kInvertColor));
+  constexpr Figure kCheckPawn(ColoredFigure(kPawn, kInvertColor));
+#ifdef HAVE_PEXT
+  if (LIKELY(slider_tables.use_pext_)) {
+    if (SliderThreatened(field_.data(), occupied_, pos, kCheckRook,
+      kCheckBishop, kCheckQueen)) {
+      return true;
+    }
+    Pos king(kings_[Color2Index(kInvertColor)]);
+    PosDelta dir(directions.direction_[pos][king]);
+    if ((dir != 0) && (AddDelta(pos, dir) == king)) {
+      return true;
+    }
+  } else
+#endif
+  {
+    for (auto curr_delta : bishop_deltas) {
+      Pos destpos(LongAddDelta(pos, curr_delta));
+      Figure figure(field_[destpos]);
+      if ((figure == kCheckBishop) || (figure == kCheckQueen) ||
+        ((figure == kCheckKing) &&
+          (destpos == AddDelta(pos, curr_delta)))) {
+        return true;
+      }
+    }
+    for (auto curr_delta : rook_deltas) {
+      Pos destpos(LongAddDelta(pos, curr_delta));
+      Figure figure(field_[destpos]);
+      if ((figure == kCheckRook) || (figure == kCheckQueen) ||
+        ((figure == kCheckKing) &&
+          (destpos == AddDelta(pos, curr_delta)))) {
+        return true;
+      }
+    }
+  }
+  const Directions::Neighbours& knights = directions.knight_[pos];
+  for (unsigned char i(0); i != knights.size_; ++i) {
+    if (field_[knights.pos_[i]] == kCheckKnight) {
+      return true;
+    }
+  }
+  constexpr PosDelta kHit1((kColor == kWhite) ? kWhitePawnHit1 :
+    kBlackPawnHit1);
+  constexpr PosDelta kHit2((kColor == kWhite) ? kWhitePawnHit2 :
+    kBlackPawnHit2);
+  return ((field_[AddDelta(pos, kHit1)] == kCheckPawn) ||
+    (field_[AddDelta(pos, kHit2)] == kCheckPawn));
+}
+
+bool Field::GivesCheck(const Move& my_move) const {
+  Figure color(color_), invert_color(InvertColor(color));
+  Pos king(kings_[invert_color]);
+  Pos from(my_move.from_), to(my_move.to_);
+  Figure figure;
+  switch (my_move.move_type_) {
+    case Move::kNull:
+      return false;
+    case Move::kEnPassant:
+    case Move::kShortCastling:
+    case Move::kLongCastling: {
+      // Several figures are involved: Do the move temporarily on the board
+      Figure& field_from = field_[from];
+      Figure& field_to = field_[to];
+      Figure figure_from(field_from), figure_to(field_to);
+      field_from = kEmpty;
+      FlipOccupied(from);
+      FlipOccupied(to);
+      if (my_move.move_type_ == Move::kEnPassant) {
+        Pos captured(AddDelta(to,
+          (color == kWhite) ? kBlackPawnMove : kWhitePawnMove));
+        Figure& field_captured = field_[captured];
+        Figure figure_captured(field_captured);
+        field_captured = kEmpty;
+        field_to = figure_from;
+        FlipOccupied(captured);
+        bool result(ScanThreatened(king, invert_color));
+        FlipOccupied(captured);
+        FlipOccupied(to);
+        FlipOccupied(from);
+        field_captured = figure_captured;
+        field_to = figure_to;
+        field_from = figure_from;
+        return result;
+      }
+      PosDelta dir((my_move.move_type_ == Move::kShortCastling) ?
+        kRight : kLeft);
+      Pos rook(AddDelta(from, dir)), castled_king(AddDelta(from, dir + dir));
+      Figure& field_rook = field_[rook];
+      Figure& field_king = field_[castled_king];
+      field_to = kEmpty;
+      field_rook = figure_to;
+      field_king = figure_from;
+      FlipOccupied(rook);
+      FlipOccupied(castled_king);
+      bool result(ScanThreatened(king, invert_color));
+      FlipOccupied(castled_king);
+      FlipOccupied(rook);
+      FlipOccupied(to);
+      FlipOccupied(from);
+      field_king = kEmpty;
+      field_rook = kEmpty;
+      field_to = figure_to;
+      field_from = figure_from;
+      return result;
+    }
+    case Move::kQueen:
+      figure = kQueen;
+      break;
+    case Move::kKnight:
+      figure = kKnight;
+      break;
+    case Move::kRook:
+      figure = kRook;
+      break;
+    case Move::kBishop:
+      figure = kBishop;
+      break;
+    default:
+    // case Move::kNormal:
+    // case Move::kDouble:
+      figure = UncoloredFigure(field_[from]);
+      break;
+  }
+  // Direct check by the moved figure
+  switch (figure) {
+    case kPawn:
+      if (color == kWhite) {
+        if ((AddDelta(to, kWhitePawnHit1) == king) ||
+          (AddDelta(to, kWhitePawnHit2) == king)) {
+          return true;
+        }
+      } else if ((AddDelta(to, kBlackPawnHit1) == king) ||
+          (AddDelta(to, kBlackPawnHit2) == king)) {
+        return true;
+      }
+      break;
+    case kKnight: {
+      const Directions::Neighbours& knights = directions.knight_[to];
+      for (unsigned char i(0); i != knights.size_; ++i) {
+        if (knights.pos_[i] == king) {
+          return true;
+        }
+      }
+      break;
+    }
+    case kKing:
+      break;
+    default: {
+      PosDelta dir(directions.direction_[to][king]);
+      if ((dir != 0) && Directions::IsLongRange(figure, dir)) {
+        Pos pos(AddDelta(to, dir));
+        while ((pos != king) && ((field_[pos] == kEmpty) || (pos == from))) {
+          pos = AddDelta(pos, dir);
+        }
+        if (pos == king) {
+          return true;
+        }
+      }
+      break;
+    }
+  }
+  // Discovered check
+  return OpensLine(king, from, to, color);
+}
+
+inline bool Field::OpensLine(Pos king, Pos from, Pos to, Figure color) const {
+  // The from field must be on a free line with the king which is not
+  // blocked by the moved figure
+  PosDelta dir(directions.direction_[king][from]);
+  if ((dir == 0) || (directions.direction_[king][to] == dir) ||
+    (LongAddDelta(king, dir) != from)) {
+    return false;
+  }
+  Figure behind(field_[LongAddDelta(from, dir)]);
+  return (Directions::IsLongRange(behind, dir) &&
+    (FigureColor(behind) == color));
+}
+
+template<Figure kColor> bool Field::IsThreatened(Pos pos) const {
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  return (attacks_[Color2Index(InvertColor(kColor))][pos] != 0);
+#else
+  return ScanThreatened<kColor>(pos);
+#endif
+}
+
+template<Figure kColor> Pos Field::CastlingRook(int *in_check, Pos pos,
+    const PosDelta dir) const {
+  if (*in_check > 0) {
+    return kNpos;
+  }
+  // Rely on castling variable: assume that king and rook are correct.
+  // However, there must not be any figure in between:
+  Pos rook_pos(LongAddDelta(pos, dir));
+  if (field_[AddDelta(rook_pos, dir)] != kNoFigure) {
+    return kNpos;
+  }
+  // The king must not be threatened (in check) and neither the two next fields
+  if (*in_check == 0) {
+    if (IsThreatened<kColor>(pos)) {
+      *in_check = 1;
+      return kNpos;
+    }
+    *in_check = -1;  // no need to test for in_check for opposite dir value
+  }
+  pos = AddDelta(pos, dir);
+  if (IsThreatened<kColor>(pos)) {
+    return kNpos;
+  }
+  pos = AddDelta(pos, dir);
+  if (IsThreatened<kColor>(pos)) {
+    return kNpos;
+  }
+  return rook_pos;
+}
+
+template<Figure kColor> bool Field::IsValidMove(const Pos from, const Pos to)
+    const {
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  const std::array<unsigned char, kFieldSize>& attacks =
+    attacks_[Color2Index(InvertColor(kColor))];
+  Pos king(kings_[Color2Index(kColor)]);
+  if (from == king) {
+    if (attacks[to] != 0) {
+      return false;
+    }
+    if (attacks[from] == 0) {
+      return true;
+    }
+    // The king must not stay on the line of a long range figure giving check
+    PosDelta dir(directions.direction_[from][to]);
+    Figure figure(field_[LongAddDelta(from, static_cast<PosDelta>(-dir))]);
+    return !(Directions::IsLongRange(figure, dir) &&
+      (FigureColor(figure) != kColor));
+  }
+  if (attacks[king] != 0) {
+    return ScanValidMove<kColor>(from, to);
+  }
+#else
+  Pos king(kings_[Color2Index(kColor)]);
+  if ((from == king) || IsInCheck()) {
+    return ScanValidMove<kColor>(from, to);
+  }
+#endif
+  // Without check, the move is invalid only if the figure is pinned
+  return !OpensLine(king, from, to, InvertColor(kColor));
+}
+
+template<Figure kColor> bool Field::ScanValidMove(const Pos from,
+    const Pos to) const {
+  Figure& field_from = field_[from];
+  Figure figure_from(field_from);
+  Figure& field_to = field_[to];
+  Figure figure_to(field_to);
+  field_from = kEmpty;
+  field_to = figure_from;
+  FlipOccupied(from);
+  if (figure_to == kEmpty) {
+    FlipOccupied(to);
+  }
+  Pos king_field(kings_[Color2Index(kColor)]);
+  if (king_field == from) {
+    king_field = to;
+  }
+  bool result(!ScanThreatened<kColor>(king_field));
+  FlipOccupied(from);
+  if (figure_to == kEmpty) {
+    FlipOccupied(to);
+  }
+  field_from = figure_from;
+  field_to = figure_to;
+  return result;
+}
+
+template<Figure kColor> bool Field::GenerateLong(MoveList *moves, Pos from,
+    PosDelta dir, GenerateMask mask) const {
+  for (Pos to(AddDelta(from, dir)); ; to = AddDelta(to, dir)) {
+    Figure figure(field_[to]);
+    if ((figure == kNoFigure) ||
+      ((figure != kEmpty) && FigureColor(figure) == kColor)) {
+      return false;
+    }
+    if (((mask & ((figure == kEmpty) ? kGenerateQuiet : kGenerateCaptures))
+      != 0) && LIKELY(IsValidMove<kColor>(from, to))) {
       if (moves == nullptr) {
         return true;
       }
@@ -702,14 +2383,16 @@ bool Field::GenerateLong(MoveList *moves, Pos from, PosDelta dir) const {
   return false;
 }
 
-bool Field::GenerateShort(MoveList *moves, Pos from, PosDelta dir) const {
-  Pos to(AddDelta(from, dir));
+template<Figure kColor> bool Field::GenerateShort(MoveList *moves, Pos from,
+    Pos to, GenerateMask mask) const {
   Figure figure(field_[to]);
-    if ((figure == kNoFigure) ||
-      ((figure != kEmpty) && FigureColor(figure) == color_)) {
+  if ((figure != kEmpty) && (FigureColor(figure) == kColor)) {
+    return false;
+  }
+  if ((mask & ((figure == kEmpty) ? kGenerateQuiet : kGenerateCaptures)) == 0) {
     return false;
   }
-  if (LIKELY(IsValidMove(from, to))) {
+  if (LIKELY(IsValidMove<kColor>(from, to))) {
     if (moves == nullptr) {
       return true;
     }
@@ -725,33 +2408,57 @@ void Field::GenerateTransform(MoveList *moves, Pos from, Pos to) {
   moves->emplace_back(Move::kBishop, from, to);
 }
 
-bool Field::GenerateWhitePawn(MoveList *moves, Pos from) const {
-  Pos to(AddDelta(from, kWhitePawnMove));
-  if (field_[to] == kEmpty) {
-    if (LIKELY(IsValidMove(from, to))) {
+template<Figure kColor> bool Field::GeneratePawn(MoveList *moves, Pos from,
+    GenerateMask mask) const {
+  constexpr PosDelta kMove((kColor == kWhite) ? kWhitePawnMove :
+    kBlackPawnMove);
+  constexpr PosDelta kHit1((kColor == kWhite) ? kWhitePawnHit1 :
+    kBlackPawnHit1);
+  constexpr PosDelta kHit2((kColor == kWhite) ? kWhitePawnHit2 :
+    kBlackPawnHit2);
+  constexpr Figure kOpponentPawn(ColoredFigure(kPawn, InvertColor(kColor)));
+  bool promotion((kColor == kWhite) ? (from >= kStartRow7) :
+    (from <= kEndRow2));
+  Pos to(AddDelta(from, kMove));
+  // Promotions are generated together with the captures
+  if ((field_[to] == kEmpty) && ((mask & (LIKELY(!promotion) ?
+    kGenerateQuiet : kGenerateCaptures)) != 0)) {
+    if (LIKELY(IsValidMove<kColor>(from, to))) {
       if (moves == nullptr) {
         return true;
       }
-      if (LIKELY(from < kStartRow7)) {
+      if (LIKELY(!promotion)) {
         moves->emplace_back(Move::kNormal, from, to);
       } else {
         GenerateTransform(moves, from, to);
       }
-      if (UNLIKELY(from <= kEndRow2)) {
-        to = AddDelta(to, kWhitePawnMove);
-        if ((field_[to] == kEmpty) && LIKELY(IsValidMove(from, to))) {
-          moves->emplace_back(Move::kDouble, from, to);
+    }
+    // The double step can be valid even if the single step is not
+    // (if it interposes a check)
+    if (UNLIKELY((kColor == kWhite) ? (from <= kEndRow2) :
+      (from >= kStartRow7))) {
+      to = AddDelta(to, kMove);
+      if ((field_[to] == kEmpty) && LIKELY(IsValidMove<kColor>(from, to))) {
+        if (moves == nullptr) {
+          return true;
         }
+        moves->emplace_back(Move::kDouble, from, to);
       }
     }
   }
-  for (auto delta : white_pawn_hit_deltas) {
+  if ((mask & kGenerateCaptures) == 0) {
+    return false;
+  }
+  for (PosDelta delta : {kHit1, kHit2}) {
     to = AddDelta(from, delta);
     if (UNLIKELY(to == ep_)) {
-      Figure &pawn = field_[AddDelta(to, kBlackPawnMove)];
+      Pos captured(AddDelta(to, static_cast<PosDelta>(-kMove)));
+      Figure &pawn = field_[captured];
       pawn = kEmpty;
-      bool is_valid(IsValidMove(from, to));
-      pawn = kBlackPawn;
+      FlipOccupied(captured);
+      bool is_valid(ScanValidMove<kColor>(from, to));
+      FlipOccupied(captured);
+      pawn = kOpponentPawn;
       if (LIKELY(is_valid)) {
         if (moves == nullptr) {
           return true;
@@ -761,12 +2468,12 @@ bool Field::GenerateWhitePawn(MoveList *moves, Pos from) const {
     } else {
       Figure figure(field_[to]);
       if ((figure != kNoFigure)
-        && (figure != kEmpty) && (FigureColor(figure) != kWhite)
-        && LIKELY(IsValidMove(from, to))) {
+        && (figure != kEmpty) && (FigureColor(figure) != kColor)
+        && LIKELY(IsValidMove<kColor>(from, to))) {
         if (moves == nullptr) {
           return true;
         }
-        if (LIKELY(from < kStartRow7)) {
+        if (LIKELY(!promotion)) {
           moves->emplace_back(Move::kNormal, from, to);
         } else {
           GenerateTransform(moves, from, to);
@@ -777,136 +2484,113 @@ bool Field::GenerateWhitePawn(MoveList *moves, Pos from) const {
   return false;
 }
 
-bool Field::GenerateBlackPawn(MoveList *moves, Pos from) const {
-  Pos to(AddDelta(from, kBlackPawnMove));
-  if (field_[to] == kEmpty) {
-    if (LIKELY(IsValidMove(from, to))) {
+template<Figure kColor> bool Field::GenerateCastling(MoveList *moves) const {
+  if (LIKELY(castling_ == kNoCastling)) {
+    return false;
+  }
+  Castling castling((kColor == kWhite) ? castling_ :
+    BlackToWhiteCastling(castling_));
+  Pos king_pos(kings_[Color2Index(kColor)]);
+  int in_check(0);
+  if (HaveCastling(castling, kWhiteShortCastling)) {
+    Pos rook_pos(CastlingRook<kColor>(&in_check, king_pos, 1));
+    if (rook_pos != kNpos) {
       if (moves == nullptr) {
         return true;
       }
-      if (LIKELY(from > kEndRow2)) {
-        moves->emplace_back(Move::kNormal, from, to);
-      } else {
-        GenerateTransform(moves, from, to);
+      moves->emplace_back(Move::kShortCastling, king_pos, rook_pos);
+    }
+  }
+  if (HaveCastling(castling, kWhiteLongCastling)) {
+    Pos rook_pos(CastlingRook<kColor>(&in_check, king_pos, -1));
+    if (rook_pos != kNpos) {
+      if (moves == nullptr) {
+        return true;
       }
-      if (UNLIKELY(from >= kStartRow7)) {
-        to = AddDelta(to, kBlackPawnMove);
-        if ((field_[to] == kEmpty) && LIKELY(IsValidMove(from, to))) {
-          moves->emplace_back(Move::kDouble, from, to);
+      moves->emplace_back(Move::kLongCastling, king_pos, rook_pos);
+    }
+  }
+  return false;
+}
+
+template<Figure kColor> bool Field::GenerateFigure(MoveList *moves, Pos from,
+    GenerateMask mask) const {
+  Figure figure(field_[from]);
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  if (LIKELY(UncoloredFigure(figure) != kPawn)) {
+    const MoveTargets& targets = targets_[from];
+    for (unsigned char i(0); i != targets.size_; ++i) {
+      Pos to(targets.to_[i]);
+      if (((mask & ((field_[to] == kEmpty) ? kGenerateQuiet :
+        kGenerateCaptures)) != 0) && LIKELY(IsValidMove<kColor>(from, to))) {
+        if (moves == nullptr) {
+          return true;
         }
+        moves->emplace_back(Move::kNormal, from, to);
       }
     }
+    return false;
   }
-  for (auto delta : black_pawn_hit_deltas) {
-    to = AddDelta(from, delta);
-    if (UNLIKELY(to == ep_)) {
-      Figure &pawn = field_[AddDelta(to, kWhitePawnMove)];
-      pawn = kEmpty;
-      bool is_valid(IsValidMove(from, to));
-      pawn = kWhitePawn;
-      if (LIKELY(is_valid)) {
-        if (moves == nullptr) {
+#endif
+  switch (UncoloredFigure(figure)) {
+    case kBishop:
+      for (auto dir : bishop_deltas) {
+        if (GenerateLong<kColor>(moves, from, dir, mask)) {
           return true;
         }
-        moves->emplace_back(Move::kEnPassant, from, to);
       }
-    } else {
-      Figure figure(field_[to]);
-      if ((figure != kNoFigure)
-        && (figure != kEmpty) && (FigureColor(figure) == kWhite)
-        && LIKELY(IsValidMove(from, to))) {
-        if (moves == nullptr) {
+      break;
+    case kRook:
+      for (auto dir : rook_deltas) {
+        if (GenerateLong<kColor>(moves, from, dir, mask)) {
           return true;
         }
-        if (LIKELY(from > kEndRow2)) {
-          moves->emplace_back(Move::kNormal, from, to);
-        } else {
-          GenerateTransform(moves, from, to);
+      }
+      break;
+    case kQueen:
+      for (auto dir : king_deltas) {
+        if (GenerateLong<kColor>(moves, from, dir, mask)) {
+          return true;
         }
       }
-    }
-  }
-  return false;
-}
-
-bool Field::Generator(MoveList *moves) const {
-  assert(LegalValues());
-  Figure color(color_);
-  if (UNLIKELY(castling_ != kNoCastling)) {
-    Castling castling((color_ == kWhite) ? castling_ :
-      BlackToWhiteCastling(castling_));
-    Pos king_pos(kings_[Color2Index(color_)]);
-    int in_check(0);
-    if (HaveCastling(castling, kWhiteShortCastling)) {
-      Pos rook_pos(CastlingRook(&in_check, king_pos, 1));
-      if (rook_pos != kNpos) {
-        if (moves == nullptr) {
+      break;
+    case kKing: {
+      const Directions::Neighbours& neighbours = directions.king_[from];
+      for (unsigned char i(0); i != neighbours.size_; ++i) {
+        if (GenerateShort<kColor>(moves, from, neighbours.pos_[i], mask)) {
           return true;
         }
-        moves->emplace_back(Move::kShortCastling, king_pos, rook_pos);
       }
+      break;
     }
-    if (HaveCastling(castling, kWhiteLongCastling)) {
-      Pos rook_pos(CastlingRook(&in_check, king_pos, -1));
-      if (rook_pos != kNpos) {
-        if (moves == nullptr) {
-          moves->emplace_back(Move::kLongCastling, king_pos, rook_pos);
+    case kKnight: {
+      const Directions::Neighbours& neighbours = directions.knight_[from];
+      for (unsigned char i(0); i != neighbours.size_; ++i) {
+        if (GenerateShort<kColor>(moves, from, neighbours.pos_[i], mask)) {
+          return true;
         }
       }
+      break;
     }
+    case kPawn:
+      if (GeneratePawn<kColor>(moves, from, mask)) {
+        return true;
+      }
+      break;
+    default:
+      assert(false);
+      break;
   }
-  for (Pos from : pos_lists_[Color2Index(color)]) {
-    Figure figure(field_[from]);
-    switch (UncoloredFigure(figure)) {
-      case kBishop:
-        for (auto dir : bishop_deltas) {
-          if (GenerateLong(moves, from, dir)) {
-            return true;
-          }
-        }
-        break;
-      case kRook:
-        for (auto dir : rook_deltas) {
-          if (GenerateLong(moves, from, dir)) {
-            return true;
-          }
-        }
-        break;
-      case kQueen:
-        for (auto dir : king_deltas) {
-          if (GenerateLong(moves, from, dir)) {
-            return true;
-          }
-        }
-        break;
-      case kKing:
-        for (auto dir : king_deltas) {
-          if (GenerateShort(moves, from, dir)) {
-            return true;
-          }
-        }
-        break;
-      case kKnight:
-        for (auto dir : knight_deltas) {
-          if (GenerateShort(moves, from, dir)) {
-            return true;
-          }
-        }
-        break;
-      case kPawn:
-        if (color == kWhite) {
-          if (GenerateWhitePawn(moves, from)) {
-            return true;
-          }
-        } else {
-          if (GenerateBlackPawn(moves, from)) {
-            return true;
-          }
-        }
-        break;
-      default:
-        assert(false);
-        break;
+  return false;
+}
+
+template<Figure kColor> bool Field::Generate(MoveList *moves) const {
+  if (UNLIKELY(GenerateCastling<kColor>(moves))) {
+    return true;
+  }
+  for (Pos from : pos_lists_[Color2Index(kColor)]) {
+    if (GenerateFigure<kColor>(moves, from, kGenerateAll)) {
+      return true;
     }
   }
   if (moves == nullptr) {
@@ -915,4 +2599,53 @@ bool Field::Generator(MoveList *moves) const {
   return !moves->empty();
 }
 
+template<Figure kColor> bool Field::Generate(MoveList *moves, Stage stage)
+    const {
+  auto old_size(moves->size());
+  Pos king(kings_[Color2Index(kColor)]);
+  if (stage == kKingStage) {
+    GenerateCastling<kColor>(moves);
+    GenerateFigure<kColor>(moves, king, kGenerateAll);
+  } else {
+    GenerateMask mask((stage == kCaptureStage) ? kGenerateCaptures :
+      kGenerateQuiet);
+    for (Pos from : pos_lists_[Color2Index(kColor)]) {
+      if (from != king) {
+        GenerateFigure<kColor>(moves, from, mask);
+      }
+    }
+  }
+  return (moves->size() != old_size);
+}
+
+bool Field::Generator(MoveList *moves) const {
+  assert(LegalValues());
+  return ((color_ == kWhite) ? Generate<kWhite>(moves) :
+    Generate<kBlack>(moves));
+}
+
+bool Field::Generator(MoveList *moves, Stage stage) const {
+  assert(LegalValues());
+  return ((color_ == kWhite) ? Generate<kWhite>(moves, stage) :
+    Generate<kBlack>(moves, stage));
+}
+
+bool MovePicker::HaveNext(const Field *field) {
+  for (;;) {
+    if ((stage_ >= 0) && LIKELY(index_ != GetMoves(stage_).size())) {
+      return true;
+    }
+    if (stage_ == Field::kStages - 1) {
+      return false;
+    }
+    ++stage_;
+    index_ = 0;
+    if (stage_ == generated_) {
+      field->Generator(&GetMoves(stage_),
+        static_cast<Field::Stage>(stage_));
+      ++generated_;
+    }
+  }
+}
+
 }  // namespace chess
@@ -11,6 +11,8 @@
 #include <config.h>
 
 #include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
 
 #include <array>
 #include <deque>
@@ -30,6 +32,9 @@ class Field;
 typedef unsigned int Pos;
 typedef signed char PosDelta;  // Differ from Pos to get a compile time check
 
+// A Zobrist hash of a position
+typedef std::uint64_t Hash;
+
 typedef unsigned char Figure;
 constexpr static const Figure
   kEmpty = 0,
@@ -186,7 +191,8 @@ class Move {
     kQueen,  // Pawn transforms into Queen
     kKnight,  // Pawn transforms into Knight
     kRook,  // Pawn transforms into Rook
-    kBishop  // Pawn transforms into Bishop
+    kBishop,  // Pawn transforms into Bishop
+    kNull  // The moving party passes; from_ and to_ are meaningless
   };
   MoveType move_type_;
   Pos from_, to_;
@@ -194,6 +200,15 @@ class Move {
     : move_type_(move_type), from_(from), to_(to) {
   }
 
+  ATTRIBUTE_NODISCARD bool operator==(const Move& m) const {
+    return ((from_ == m.from_) && (to_ == m.to_) &&
+      (move_type_ == m.move_type_));
+  }
+
+  ATTRIBUTE_NODISCARD bool operator!=(const Move& m) const {
+    return !(*this == m);
+  }
+
   // Append a human readable form of the move
   void Append(std::string *res, const Field &chess_field) const;
 
@@ -296,16 +311,40 @@ inline static std::ostream& operator<<(std::ostream& os, const MoveList& l) {
   return os;
 }
 
+// A move seen backwards: A move of the party which is not on move which
+// leads from a previous position to the current one, see
+// Field::RetroGenerator(). The move is stored as Generator() would produce
+// it in the previous position.
+class RetroMove {
+ public:
+  Move move_;
+  Figure captured_;  // The captured figure or kEmpty
+  Castling castling_;  // The castling rights of the previous position
+  RetroMove(Move::MoveType move_type, Pos from, Pos to, Figure captured,
+      Castling castling)
+    : move_(move_type, from, to), captured_(captured), castling_(castling) {
+  }
+};
+
+typedef std::vector<RetroMove> RetroMoveList;
+
 class MoveStore {
  public:
+  enum Check : unsigned char { kCheckUnknown, kNoCheck, kCheck };
+
   const Move *move_;
   EnPassant ep_;
   Castling castling_;
   Figure from_figure_, to_figure_;
+
+  // Whether the move gives check. This is filled in by PushMove() if the
+  // caller knows it or by the first IsInCheck() call after the move.
+  mutable Check check_;
+
   MoveStore(const Move *m, EnPassant ep, Castling c,
       Figure from_figure, Figure to_figure)
     : move_(m), ep_(ep), castling_(c), from_figure_(from_figure),
-    to_figure_(to_figure) {
+    to_figure_(to_figure), check_(kCheckUnknown) {
   }
 
   // append a human readable form of the move
@@ -396,11 +435,20 @@ IsInCheck()  Check whether the moving party is in check
 PushMove()   execute a move, e.g. previously generated
 PopMove()    undo the last pushed move and return it.
 
+PushMove() also accepts a Move of type Move::kNull which only passes the
+right to move to the opponent (and forfeits en passant). This is meant for
+threat analysis and must not be used if the moving party is in check.
+
+For a backward search, RetroGenerator() generates the retractions of the
+last move, RetractMove() takes back one of them, and UnretractMove() undoes
+this again.
+
 You can expect the currrent board with
 
 GetFigure()  (or operator []);
 get_ep()
 get_castling()
+get_hash()
 
 and there are auxiliary functions
 
@@ -596,7 +644,36 @@ note that it is "on head" concerning the moves and mirrored concerning columns
   }
 
   // Return true if (at least) one black and white king are on the board
-  ATTRIBUTE_NODISCARD bool HaveKings() const;
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool HaveKings() const;
+
+  // Return false if color can never give mate due to insufficient material:
+  // A bare king, or (against a bare king) a single knight or only bishops
+  // on squares of the same color. This is cheap, since the material is
+  // counted incrementally.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool CanMate(Figure color) const;
+
+  // A lower bound for the number of moves which color needs until one of its
+  // figures attacks a square within king distance radius of the opponent's
+  // king. The bound is calculated as if the board were empty (but taking into
+  // account pawn transformation). A mate by color needs at least this number
+  // of moves if the opponent's king can make at most radius king steps.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE int CheckDistance(Figure color,
+      int radius) const;
+
+  // Return true if color cannot give mate within half_moves even if the
+  // opponent cooperates. This is based on the bound of CheckDistance().
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool HelpMateTooFar(Figure color,
+      int half_moves) const;
+
+  // The number of figures (with color) on the board
+  ATTRIBUTE_NODISCARD Pos CountFigures(Figure figure) const {
+    return count_[figure];
+  }
+
+  // Return true if pos is a light square like h1
+  ATTRIBUTE_CONST constexpr static bool IsLightSquare(Pos pos) {
+    return ((((pos % (kColumns + 2)) + (pos / (kColumns + 2))) & 1) == 0);
+  }
 
   // Return true if the castling value makes sense for the position
   ATTRIBUTE_NODISCARD bool IsCastlingValid(Castling c) const {
@@ -629,23 +706,122 @@ note that it is "on head" concerning the moves and mirrored concerning columns
   // The return value is true if there is at least one valid move.
   bool Generator(MoveList *moves) const;
 
+  // The stages of a staged generation: Captures and promotions of all
+  // figures except the king, all moves of the king (including castling),
+  // and the remaining moves. Each valid move belongs to exactly one stage.
+  enum Stage { kCaptureStage, kKingStage, kQuietStage, kStages };
+
+  // Add the valid moves of stage. moves must not be nullptr.
+  // The return value is true if a move was added.
+  ATTRIBUTE_NONNULL_ bool Generator(MoveList *moves, Stage stage) const;
+
   // Do the move. The pointer must be kept until corresponding PopMove()
   ATTRIBUTE_NONNULL_ void PushMove(const Move *my_move);
 
+  // As PushMove(), but store whether the move gives check (see GivesCheck())
+  ATTRIBUTE_NONNULL_ void PushMove(const Move *my_move, bool gives_check) {
+    PushMove(my_move);
+    assert(gives_check == IsThreatened(kings_[color_]));
+    move_stack_.back().check_ = (gives_check ? MoveStore::kCheck :
+      MoveStore::kNoCheck);
+  }
+
   // Undo the last pushed move.
   const Move *PopMove();
 
-  // Is moving party in check?
+  // Add all retractions, that is, the moves of the party which is not on
+  // move which lead to the current position (including its castling rights
+  // and ep) from a previous position. The castling rights of the previous
+  // positions are restricted to those in castling; for each possible set
+  // of rights, a separate retraction is added. Figures of any type (except
+  // the king) are uncaptured. If the current position has an ep value, the
+  // only retraction is the corresponding double move. Apart from this, the
+  // ep value of the previous position is not determined: The caller might
+  // set each value of CalcEnPassant() after RetractMove().
+  ATTRIBUTE_NONNULL_ void RetroGenerator(RetroMoveList *moves,
+      Castling castling) const;
+
+  // Take back a retraction of RetroGenerator(): The figures, the color,
+  // castling, and ep are set to the previous position; the move stack is
+  // unchanged. Return false if the previous position is not legal, that is,
+  // if the party not on move is in check, the castling rights are not valid,
+  // or the king castled out of or through check. In any case, the
+  // retraction must be undone with UnretractMove() where ep and castling
+  // are the values of the current position.
+  bool RetractMove(const RetroMove& retro_move);
+  void UnretractMove(const RetroMove& retro_move, EnPassant ep,
+      Castling castling);
+
+  // A compact copy of the state of the field without the move stack:
+  // The figures, the kings, color, castling, en passant, and the hash.
+  class Position {
+   public:
+    Hash hash_;
+    std::array<Figure, kFieldSize> field_;
+    std::array<unsigned char, kIndexMax + 1> kings_;
+    Figure color_;
+    Castling castling_;
+    unsigned char ep_;
+  };
+
+  ATTRIBUTE_NONNULL_ void SavePosition(Position *position) const;
+
+  // Restore a state stored by SavePosition(). The move stack is unchanged.
+  void RestorePosition(const Position& position);
+
+  // In copy-make mode, PushMove() stores the position into the slot of the
+  // current ply, and PopMove() restores it instead of undoing the move.
+  // The mode can only be changed while the move stack is empty.
+  void set_copy_make(bool copy_make) {
+    assert(move_stack_.empty());
+    copy_make_ = copy_make;
+  }
+
+  ATTRIBUTE_NODISCARD bool get_copy_make() const {
+    return copy_make_;
+  }
+
+  // The packed form of a position: The occupied fields as a bitboard
+  // (8 bytes), the figures of these fields in their order (4 bits each),
+  // the color with castling, and ep.
+  constexpr static const unsigned int kPackedFigures = 32;
+  constexpr static const std::size_t kPackedSize = 8 + kPackedFigures / 2 + 2;
+
+  // Store the packed form into packed[0...kPackedSize). Like for get_hash(),
+  // ep is only stored if an en passant hit is possible, so equal positions
+  // have equal forms. The form does not depend on the machine.
+  // Return false if there are more than kPackedFigures figures.
+  ATTRIBUTE_NONNULL_ bool Pack(unsigned char *packed) const;
+
+  // Set the position from a packed form. The move stack is cleared.
+  ATTRIBUTE_NONNULL_ void Unpack(const unsigned char *packed);
+
+  // Is moving party in check? After a move, the result is stored in the
+  // move stack so that further calls are cheap.
   bool IsInCheck() const {
-    return IsThreatened(kings_[color_]);
+    if (move_stack_.empty()) {
+      return IsThreatened(kings_[color_]);
+    }
+    const MoveStore& last = move_stack_.back();
+    if (last.check_ == MoveStore::kCheckUnknown) {
+      last.check_ = (IsThreatened(kings_[color_]) ? MoveStore::kCheck :
+        MoveStore::kNoCheck);
+    }
+    return (last.check_ == MoveStore::kCheck);
   }
 
+  // Would the (valid) move of the moving party give check? This is
+  // cheaper than PushMove() and IsInCheck(): Only the line from the
+  // opponent's king through the from field and the attack of the moved
+  // figure are tested.
+  ATTRIBUTE_NODISCARD bool GivesCheck(const Move& my_move) const;
+
   // Is moving party checkmate? This takes quite a while...
   ATTRIBUTE_NODISCARD bool IsCheckMate() const {
     return (IsInCheck() && !Generator(nullptr));
   }
 
-  ATTRIBUTE_NODISCARD Castling get_castling() const {
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE Castling get_castling() const {
     assert(castling_ < kUnknownCastling);
     return castling_;
   }
@@ -660,6 +836,24 @@ note that it is "on head" concerning the moves and mirrored concerning columns
     return color_;
   }
 
+  // A hash of the position: figures, color, castling, and ep (the latter
+  // only if an ep hit is actually possible). The figure part is maintained
+  // incrementally, so this is cheap.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE Hash get_hash() const;
+
+  // A hash which is equal for positions which are equal up to a symmetry
+  // of the board: Without castling rights, positions without pawns are
+  // equivalent under the 8 symmetries of the board, and positions with
+  // pawns are equivalent under left-right mirroring. This is meant for
+  // caches of results which do not change under these symmetries (such as
+  // whether mate can be reached) but not for storing moves.
+  // The value is the minimum of get_hash() of the equivalent positions.
+  // The figure parts of these are maintained incrementally, so this is cheap.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE Hash get_canonical_hash() const;
+
+  // The number of symmetries of the board (including the identity)
+  constexpr static const int kSymmetries = ((kColumns == kRows) ? 8 : 4);
+
   ATTRIBUTE_NODISCARD ATTRIBUTE_PURE Figure GetFigure(Pos pos) const {
     assert((pos >= kFieldStart) && (pos < kFieldEnd) &&
       (field_[pos] != kNoFigure));
@@ -670,14 +864,22 @@ note that it is "on head" concerning the moves and mirrored concerning columns
     return GetFigure(pos);
   }
 
-  ATTRIBUTE_NODISCARD const PosList& GetPosList(Figure color) const {
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE const PosList& GetPosList(Figure color)
+      const {
     assert(UncoloredFigure(color) == kEmpty);
     return pos_lists_[color];
   }
 
   // Would piece of color threatened at pos?
+  // With CHESSPROBLEM_ATTACK_MAPS this is a lookup in the attack maps.
   ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool IsThreatened(Pos pos, Figure color)
-      const;
+      const {
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+    return (attacks_[Color2Index(InvertColor(color))][pos] != 0);
+#else
+    return ScanThreatened(pos, color);
+#endif
+  }
 
   // Would piece of moving color be threatened at pos?
   ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool IsThreatened(Pos pos) const {
@@ -713,7 +915,7 @@ note that it is "on head" concerning the moves and mirrored concerning columns
 
   void assign(Field&& f) noexcept;
 
-  Field() {
+  Field() : copy_make_(false) {
     ClearField();
   }
 
@@ -742,6 +944,16 @@ note that it is "on head" concerning the moves and mirrored concerning columns
   typedef PosList::iterator Pointer;
   typedef std::array<PosList, kIndexMax + 1> PosLists;
   typedef std::array<Pos, kIndexMax + 1> KingsPos;
+  typedef std::array<std::array<unsigned char, kFieldSize>, kIndexMax + 1>
+    AttackMaps;
+
+  // The fields to which a figure other than a pawn can move, ignoring
+  // whether the own king is in check afterwards (in the generation order)
+  class MoveTargets {
+   public:
+    unsigned char size_;
+    std::array<unsigned char, 27> to_;
+  };
 
   // Needed only inline for the copy/move assignment operator
   void RecreateRefs() noexcept {
@@ -755,34 +967,119 @@ note that it is "on head" concerning the moves and mirrored concerning columns
   // Might leave invalid data
   void ClearField();
 
+  // The functions with a template parameter kColor are only for the moving
+  // party kColor (i.e. color_ == kColor): Generator() dispatches once, and
+  // the colored constants are resolved at compile time in the inner loops.
+
+  // As IsThreatened(pos, kColor)
+  template<Figure kColor> ATTRIBUTE_NODISCARD bool IsThreatened(Pos pos)
+      const;
+
   // in_check must be 1/-1/0 if king is in check/not in check/unknown
   // pos is position of the king, dir is +1/-1 for short/long castling.
   // Return is position of rook or kNpos if castling is not valid.
-  ATTRIBUTE_NONNULL_ Pos CastlingRook(int *in_check, Pos pos,
-      const PosDelta dir) const;
+  template<Figure kColor> ATTRIBUTE_NONNULL_ Pos CastlingRook(int *in_check,
+      Pos pos, const PosDelta dir) const;
 
   // Return true if move of single figure does not leave moving party in check
-  ATTRIBUTE_NODISCARD bool IsValidMove(Pos from, Pos to) const;
+  template<Figure kColor> ATTRIBUTE_NODISCARD bool IsValidMove(Pos from,
+      Pos to) const;
+
+  // As IsValidMove() or IsThreatened(), but scanning the board instead of
+  // using the attack maps. Only these may be used while field_ is modified
+  // temporarily.
+  template<Figure kColor> ATTRIBUTE_NODISCARD bool ScanValidMove(Pos from,
+      Pos to) const;
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool ScanThreatened(Pos pos,
+      Figure color) const;
+  template<Figure kColor> ATTRIBUTE_NODISCARD ATTRIBUTE_PURE
+      bool ScanThreatened(Pos pos) const;
+
+  // Does moving a figure from from to to open a line from king to a long
+  // range figure of color? The figure at to is ignored.
+  ATTRIBUTE_NODISCARD inline bool OpensLine(Pos king, Pos from, Pos to,
+      Figure color) const;
+
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  // Add delta (1 or -1) to the fields of *maps attacked by figure at pos
+  ATTRIBUTE_NONNULL_ void AddAttacks(AttackMaps *maps, Figure figure, Pos pos,
+      int delta) const;
+
+  // Add delta (1 or -1) to the fields behind the empty pos which are
+  // attacked by long range figures through pos
+  void AddRays(Pos pos, int delta);
+#endif
+
+  // Toggle the bit of pos in occupied_ (if HAVE_PEXT is defined).
+  // This must accompany each modification of field_ in an empty field.
+  inline void FlipOccupied(Pos pos) const;
+
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  // Calculate the targets of the figure at pos (empty for a pawn)
+  ATTRIBUTE_NONNULL_ void CalcTargets(MoveTargets *targets, Pos pos) const;
+
+  // Recalculate the targets of all figures except pawns which can move to
+  // (or cover) pos
+  void UpdateTargets(Pos pos);
+#endif
+
+  // Which moves of a figure are generated: Promotions count as captures
+  enum GenerateMask {
+    kGenerateCaptures = 1,
+    kGenerateQuiet = 2,
+    kGenerateAll = (kGenerateCaptures | kGenerateQuiet)
+  };
 
-  // Generate moves of long moving figure.
+  // The implementations of Generator()
+  template<Figure kColor> bool Generate(MoveList *moves) const;
+  template<Figure kColor> ATTRIBUTE_NONNULL_ bool Generate(MoveList *moves,
+      Stage stage) const;
+
+  // Generate castling moves.
+  // Return true if moves is nullptr and move could be generated
+  template<Figure kColor> bool GenerateCastling(MoveList *moves) const;
+
+  // Generate moves of the figure at from.
   // Return true if moves is nullptr and move could be generated
-  ATTRIBUTE_NODISCARD bool GenerateLong(MoveList *moves, Pos from,
-      PosDelta dir) const;
+  template<Figure kColor> bool GenerateFigure(MoveList *moves, Pos from,
+      GenerateMask mask) const;
 
-  // Generate moves of short moving figure.
+  // Generate moves of long moving figure.
   // Return true if moves is nullptr and move could be generated
-  bool GenerateShort(MoveList *moves, Pos from, PosDelta dir) const;
+  template<Figure kColor> ATTRIBUTE_NODISCARD bool GenerateLong(
+      MoveList *moves, Pos from, PosDelta dir, GenerateMask mask) const;
 
-  // Generate moves of white pawn.
+  // Generate the move of short moving figure to the field to on the board.
   // Return true if moves is nullptr and move could be generated
-  bool GenerateWhitePawn(MoveList *moves, Pos from) const;
+  template<Figure kColor> bool GenerateShort(MoveList *moves, Pos from,
+      Pos to, GenerateMask mask) const;
 
-  // Generate moves of black pawn.
+  // Generate moves of pawn.
   // Return true if moves is nullptr and move could be generated
-  bool GenerateBlackPawn(MoveList *moves, Pos from) const;
+  template<Figure kColor> bool GeneratePawn(MoveList *moves, Pos from,
+      GenerateMask mask) const;
 
   static void GenerateTransform(MoveList *moves, Pos from, Pos to);
 
+  // Add the retraction from from to to for RetroGenerator(): If capture is
+  // true, with every figure of the moving party which could have been
+  // captured at to, otherwise only without capture. It is added for every
+  // possible set of castling rights (within castling) of the previous
+  // position.
+  ATTRIBUTE_NONNULL_ void AddRetraction(RetroMoveList *moves,
+      Move::MoveType move_type, Pos from, Pos to, bool capture,
+      Castling castling) const;
+
+  // Replace the (real) figure at pos. Only for pawn transformation
+  inline void ChangeFigure(Pos pos, Figure figure);
+
+  // Update count_ and light_bishops_ for adding/removing figure at pos
+  inline void AddCount(Figure figure, Pos pos);
+  inline void SubCount(Figure figure, Pos pos);
+
+  // Update hash_ and symmetric_hashes_ for adding/removing figure at pos
+  inline void FlipHash(Figure figure, Pos pos);
+
   // mutable, because functions like generator() modify it temporarily:
   mutable std::array<Figure, kFieldSize> field_;
   std::array<Pointer, kFieldSize> refs_;  // pointers to pos_lists_
@@ -792,6 +1089,26 @@ note that it is "on head" concerning the moves and mirrored concerning columns
   PosLists pos_lists_;
   KingsPos kings_;
   MoveStack move_stack_;
+  Hash hash_;  // Only the figures; see get_hash()
+  // hash_ of the position mapped by symmetry i + 1; see get_canonical_hash()
+  std::array<Hash, kSymmetries - 1> symmetric_hashes_;
+  std::array<unsigned char, kMaxFigure + 1> count_;  // indexed by figure
+  std::array<unsigned char, kIndexMax + 1> light_bishops_;  // by color
+#ifdef CHESSPROBLEM_ATTACK_MAPS
+  // The number of figures of a color attacking a field
+  AttackMaps attacks_;
+#endif
+#ifdef CHESSPROBLEM_MOVE_TABLES
+  // Indexed by the position of the figure
+  std::array<MoveTargets, kFieldSize> targets_;
+#endif
+  bool copy_make_;
+  std::vector<Position> positions_;  // The slots of copy-make mode by ply
+#ifdef HAVE_PEXT
+  // The occupied fields as a bitboard for the PEXT lookups. It must follow
+  // the temporary modifications of field_ (see FlipOccupied()).
+  mutable std::uint64_t occupied_;
+#endif
 };
 
 inline static std::ostream& operator<<(std::ostream& os, const Field& f);
@@ -800,6 +1117,65 @@ inline static std::ostream& operator<<(std::ostream& os, const Field& f) {
   return os;
 }
 
+// MovePicker returns the valid moves of a position lazily: The moves of a
+// stage (see Field::Stage) are generated only when all moves of the
+// previous stages have been returned. Thus, if the caller stops early
+// (e.g. after a winning move), the later stages are never generated.
+// All functions must be called with a field in the same position.
+// The returned pointers remain valid as long as the MovePicker exists.
+
+class MovePicker {
+ public:
+  MovePicker() : stage_(-1), generated_(0), index_(0) {
+  }
+
+  // Generate all moves at once (in the order of Field::Generator()) and
+  // return them; they can be reordered before the first Next().
+  // This must be the first call.
+  ATTRIBUTE_NONNULL_ MoveList *Complete(const Field *field) {
+    assert(stage_ < 0);
+    stage_ = Field::kStages - 1;
+    generated_ = Field::kStages;
+    MoveList *moves = &GetMoves(stage_);
+    field->Generator(moves);
+    return moves;
+  }
+
+  // Generate all stages not generated yet. Afterwards, Next() does not
+  // access the field anymore.
+  ATTRIBUTE_NONNULL_ void GenerateAll(const Field *field) {
+    for (; generated_ != Field::kStages; ++generated_) {
+      field->Generator(&GetMoves(generated_),
+        static_cast<Field::Stage>(generated_));
+    }
+  }
+
+  // Return true if Next() will return a move
+  ATTRIBUTE_NONNULL_ bool HaveNext(const Field *field);
+
+  // Return the next move or nullptr if there is none
+  ATTRIBUTE_NONNULL_ const Move *Next(const Field *field) {
+    if (!HaveNext(field)) {
+      return nullptr;
+    }
+    return &GetMoves(stage_)[index_++];
+  }
+
+  MovePicker(const MovePicker& m) = delete;
+  MovePicker& operator=(const MovePicker& m) = delete;
+
+ private:
+  int stage_;  // The stage whose moves are returned; -1 initially
+  int generated_;  // The number of stages generated
+  MoveList::size_type index_;  // The next move of stage_
+  std::array<MoveList, Field::kStages> moves_;
+
+  // The moves of stage which must not be negative
+  ATTRIBUTE_NODISCARD MoveList& GetMoves(int stage) {
+    return moves_[static_cast<std::size_t>(stage)];
+  }
+};
+
 // A rather unexpensive convience wrapper to ensure PopMove() is not missed:
 //
 // When the object is initialized, the move is pushed.
@@ -822,6 +1198,12 @@ class push_guard {
     field->PushMove(my_move);
   }
 
+  ATTRIBUTE_NONNULL_ push_guard(Field *field, const Move *my_move,
+      bool gives_check)
+    : field_(field) {
+    field->PushMove(my_move, gives_check);
+  }
+
   ATTRIBUTE_NONNULL_ explicit push_guard(Field *field)
     : field_(field) {
   }
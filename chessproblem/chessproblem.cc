@@ -9,20 +9,32 @@
 #include <config.h>
 
 #include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <algorithm>  // find, remove_if
+#include <memory>
+#include <utility>  // swap
 
 #ifndef NO_CHESSPROBLEM_THREADS
 #include <atomic>
 #include <mutex>  // NOLINT(build/c++11)
 #include <thread>  // NOLINT(build/c++11)
-#include <vector>
 #ifdef PROPAGATE_SIGNAL
 #include <list>
 #endif
 #endif
+#include <vector>
 
+#include "chessproblem/breadthfirst.h"
+#include "chessproblem/flights.h"
 #include "chessproblem/m_attribute.h"
 #include "chessproblem/m_likely.h"
+#include "chessproblem/meetinthemiddle.h"
+#include "chessproblem/proofnumber.h"
+#include "chessproblem/tablebase.h"
 
+const std::size_t ChessProblem::kTableMegabytesDefault;
 
 #ifndef NO_CHESSPROBLEM_THREADS
 const int
@@ -33,12 +45,25 @@ void ChessProblem::set_max_parallel(int max_parallel) {
 #ifdef UNLIMITED
   max_parallel_ = max_parallel;
 #else
-  static auto max_concurrency = std::thread::hardware_concurrency();
+  static int max_concurrency(
+    static_cast<int>(std::thread::hardware_concurrency()));
   max_parallel_ = ((max_concurrency > 0) && (max_parallel > max_concurrency)) ?
     max_concurrency : max_parallel;
 #endif
 }
 
+// The nodes counted by the current thread which are not yet added to nodes_
+static thread_local std::uint64_t thread_nodes = 0;
+
+inline void ChessProblem::CountNode() {
+  ++thread_nodes;
+}
+
+void ChessProblem::FlushNodes() {
+  nodes_.fetch_add(thread_nodes, std::memory_order_relaxed);
+  thread_nodes = 0;
+}
+
 namespace chessproblem {
 
 // For each MoveList, one Communicate object is created.
@@ -60,10 +85,11 @@ namespace chessproblem {
 class Communicate {
  private:
   Communicate *parent_;
+  const chess::Move *threat_;
   bool equal_level_threads_;
   std::atomic_bool kill_signal_;
-  std::atomic<chess::MoveList::const_iterator> current_;
-  chess::MoveList::const_iterator end_;
+  chess::MovePicker *picker_;
+  std::atomic_bool have_next_;
   std::atomic_bool result_;
   std::mutex current_mutex_;
   typedef std::lock_guard<std::mutex> LockGuard;
@@ -102,14 +128,15 @@ class Communicate {
   Communicate(const Communicate&&) = delete;
 
   explicit Communicate(Communicate *parent) :
-    parent_(parent), equal_level_threads_(false), kill_signal_(false) {
+    parent_(parent), threat_(nullptr), equal_level_threads_(false),
+    kill_signal_(false) {
     RegisterChild();
   }
 
   ATTRIBUTE_NONNULL_ explicit Communicate(Communicate *parent,
-      const chess::MoveList *moves, bool result)
-    : parent_(parent), equal_level_threads_(false), kill_signal_(false),
-    current_(moves->begin()), end_(moves->end()), result_(result) {
+      chess::MovePicker *picker, bool result)
+    : parent_(parent), threat_(nullptr), equal_level_threads_(false),
+    kill_signal_(false), picker_(picker), have_next_(true), result_(result) {
     RegisterChild();
   }
 
@@ -128,50 +155,74 @@ class Communicate {
     return equal_level_threads_;
   }
 
+  // The threat found for the defender's MoveList or nullptr.
+  // This must be set before any move is checked and is never changed.
+  ATTRIBUTE_NODISCARD const chess::Move *get_threat() const {
+    return threat_;
+  }
+
+  void set_threat(const chess::Move *threat) {
+    threat_ = threat;
+  }
+
   // This must be called before starting any subthread of equal level:
   // There is no atomic signaling mechanism used.
   void set_equal_level_threads() {
     equal_level_threads_ = true;
   }
 
-  // Return true if GetIncreasing() would probably get a new move.
+  // Return true if GetIncreasing() would probably get a new move. If the
+  // current stage of the MovePicker is exhausted, the next stages are
+  // generated from field (which must be in the position of the MovePicker).
   // By its very nature, the data can already be outdated at the return.
-  bool HaveNextUnsafe() const {
-    return (current_.load(std::memory_order_consume) != end_);
+  ATTRIBUTE_NONNULL_ bool HaveNextUnsafe(const chess::Field *field) {
+    if (!have_next_.load(std::memory_order_consume)) {
+      return false;
+    }
+    LockGuard lock(current_mutex_);
+    if (LIKELY(picker_->HaveNext(field))) {
+      return true;
+    }
+    have_next_.store(false, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Generate all remaining moves of the MovePicker from field (which must
+  // be in the position of the MovePicker). This must be called before a
+  // thread of equal level is started: Afterwards, field is not needed.
+  ATTRIBUTE_NONNULL_ void GenerateAll(const chess::Field *field) {
+    LockGuard lock(current_mutex_);
+    picker_->GenerateAll(field);
   }
 
   // Get the next move. Return true if there is some. Not thread-safe
-  ATTRIBUTE_NONNULL_ bool GetIncreasingUnsafe(const chess::Move **my_move) {
-    auto current = current_.load(std::memory_order_relaxed);
-    if (UNLIKELY(current == end_)) {
+  ATTRIBUTE_NONNULL_ bool GetIncreasingUnsafe(const chess::Move **my_move,
+      const chess::Field *field) {
+    if (UNLIKELY((*my_move = picker_->Next(field)) == nullptr)) {
+      have_next_.store(false, std::memory_order_relaxed);
       return false;
     }
-    *my_move = &(*current);
-    ++current;
-    current_.store(current, std::memory_order_relaxed);
     return true;
   }
 
   // Get the next move. Return true if there is some. Thread-safe and slow
-  ATTRIBUTE_NONNULL_ bool GetIncreasing(const chess::Move **my_move) {
+  ATTRIBUTE_NONNULL_ bool GetIncreasing(const chess::Move **my_move,
+      const chess::Field *field) {
     LockGuard lock(current_mutex_);
-    auto current = current_.load(std::memory_order_consume);
-    if (UNLIKELY(current == end_)) {
+    if (UNLIKELY((*my_move = picker_->Next(field)) == nullptr)) {
+      have_next_.store(false, std::memory_order_release);
       return false;
     }
-    *my_move = &(*current);
-    ++current;
-    current_.store(current, std::memory_order_release);
     return true;
   }
 
   // Get the next move. Return true if there is some
   ATTRIBUTE_NONNULL_ bool GetIncreasing(const chess::Move **my_move,
-      bool threadsafe) {
+      const chess::Field *field, bool threadsafe) {
     if (threadsafe) {
-      return GetIncreasing(my_move);
+      return GetIncreasing(my_move, field);
     }
-    return GetIncreasingUnsafe(my_move);
+    return GetIncreasingUnsafe(my_move, field);
   }
 
   // Return the signaled result
@@ -220,6 +271,254 @@ class Communicate {
 }  // namespace chessproblem
 #endif  // NO_CHESSPROBLEM_THREADS
 
+namespace chessproblem {
+
+// A direct-mapped cache for the (expensive) test whether the moving party
+// which is in check is mate. The result depends only on the position, so
+// the entries never become invalid. Each entry is get_hash() with the
+// lowest bit replaced by the result.
+class MateCache {
+ public:
+  // With 8 bytes per entry, the cache should fit into the L2 cache
+  constexpr static const unsigned int kBits = 15;
+
+  MateCache() : entries_(static_cast<std::size_t>(1) << kBits, 0) {
+  }
+
+  ATTRIBUTE_NONNULL_ bool IsMate(const chess::Field *field) {
+    chess::Hash hash(field->get_hash());
+    chess::Hash& entry = entries_[static_cast<std::size_t>(hash >> 1) &
+      ((static_cast<std::size_t>(1) << kBits) - 1)];
+    if (((entry ^ hash) >> 1) == 0) {
+      return ((entry & 1) != 0);
+    }
+    bool mate(!field->Generator(nullptr));
+    entry = ((hash & ~static_cast<chess::Hash>(1)) | (mate ? 1 : 0));
+    return mate;
+  }
+
+ private:
+  std::vector<chess::Hash> entries_;
+};
+
+// As field->IsCheckMate(), but using the MateCache of the current thread
+ATTRIBUTE_NONNULL_ static bool IsCheckMate(const chess::Field *field) {
+  if (!field->IsInCheck()) {
+    return false;
+  }
+#ifndef NO_CHESSPROBLEM_THREADS
+  static thread_local MateCache cache;
+#else
+  static MateCache cache;
+#endif
+  return cache.IsMate(field);
+}
+
+// A direct-mapped cache for the results of FindThreat(). An entry stores
+// the shortest threat found or the number of half moves up to which no
+// threat exists; like for MateCache, the entries never become invalid.
+class ThreatCache {
+ public:
+  constexpr static const unsigned int kBits = 12;
+
+  struct Entry {
+    chess::Hash hash_;
+    chess::Move threat_;
+    int half_moves_;  // Of threat_ if positive, searched in vain if negative
+
+    Entry() : hash_(0), threat_(chess::Move::kNull, chess::Field::kNpos,
+      chess::Field::kNpos), half_moves_(0) {
+    }
+  };
+
+  ThreatCache() : entries_(static_cast<std::size_t>(1) << kBits) {
+  }
+
+  // The entry for hash; it has to be overwritten if its hash_ differs
+  ATTRIBUTE_NODISCARD Entry *Find(chess::Hash hash) {
+    return &entries_[static_cast<std::size_t>(hash) &
+      ((static_cast<std::size_t>(1) << kBits) - 1)];
+  }
+
+ private:
+  std::vector<Entry> entries_;
+};
+
+ATTRIBUTE_NONNULL_ static bool DefenderLoses(chess::Field *field,
+    int half_moves);
+
+// Return true if the moving party can force a mate within half_moves
+// (which must be odd). An early mate or stalemate counts as in kMate.
+// If winning is not nullptr, the first move of such a mate is stored there.
+ATTRIBUTE_NONNULL((1)) static bool ForcesMate(chess::Field *field,
+    int half_moves, chess::Move *winning) {
+  chess::MoveList moves;
+  field->Generator(&moves);
+  for (const auto& my_move : moves) {
+    if ((half_moves == 1) && !field->GivesCheck(my_move)) {
+      continue;
+    }
+    chess::push_guard guard(field, &my_move);
+    if ((half_moves == 1) ? chessproblem::IsCheckMate(field) :
+      DefenderLoses(field, half_moves - 1)) {
+      if (winning != nullptr) {
+        *winning = my_move;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return true if the moving party cannot avoid a mate within half_moves
+// (which must be even).
+static bool DefenderLoses(chess::Field *field, int half_moves) {
+  chess::MoveList moves;
+  if (!field->Generator(&moves)) {
+    return field->IsInCheck();
+  }
+  for (const auto& my_move : moves) {
+    chess::push_guard guard(field, &my_move);
+    if (!ForcesMate(field, half_moves - 1, nullptr)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Counts how often a move has won, weighted by the remaining depth.
+// The counts are only used to order moves. Therefore, in multithreaded mode
+// they are changed without any synchronization except for the atomicity
+// of the single entries.
+class History {
+ public:
+#ifndef NO_CHESSPROBLEM_THREADS
+  typedef std::atomic_uint Value;
+#else
+  typedef unsigned int Value;
+#endif
+
+  History() : value_(chess::Field::kFieldSize * chess::Field::kFieldSize) {
+  }
+
+  // my_move has won with remaining_half_moves (>= 0) after it
+  ATTRIBUTE_NONNULL_ void Reward(const chess::Move *my_move,
+      int remaining_half_moves) {
+    unsigned int weight(static_cast<unsigned int>(remaining_half_moves + 1));
+    value_[Index(my_move)] += weight * weight;
+  }
+
+  // Stable sort of moves by decreasing value
+  ATTRIBUTE_NONNULL_ void Sort(chess::MoveList *moves) const {
+    // Use a copy of the values, since other threads might change them
+    std::vector<unsigned int> values;
+    values.reserve(moves->size());
+    for (const auto& my_move : *moves) {
+      values.push_back(value_[Index(&my_move)]);
+    }
+    // The lists are short and mostly sorted: use insertion sort
+    for (chess::MoveList::size_type i(1); i < values.size(); ++i) {
+      unsigned int value(values[i]);
+      if (LIKELY(value <= values[i - 1])) {
+        continue;
+      }
+      chess::Move my_move((*moves)[i]);
+      chess::MoveList::size_type j(i);
+      do {
+        values[j] = values[j - 1];
+        (*moves)[j] = (*moves)[j - 1];
+      } while ((--j != 0) && (values[j - 1] < value));
+      values[j] = value;
+      (*moves)[j] = my_move;
+    }
+  }
+
+ private:
+  std::vector<Value> value_;
+
+  ATTRIBUTE_NONNULL_ static chess::Pos Index(const chess::Move *my_move) {
+    return my_move->from_ * chess::Field::kFieldSize + my_move->to_;
+  }
+};
+
+// Remove all moves which are contained in solved
+ATTRIBUTE_NONNULL_ static void RemoveSolved(chess::MoveList *moves,
+    const std::vector<chess::Move> *solved) {
+  moves->erase(std::remove_if(moves->begin(), moves->end(),
+    [solved](const chess::Move& my_move) {
+      return (std::find(solved->begin(), solved->end(), my_move)
+        != solved->end());
+    }), moves->end());
+}
+
+// If my_move is in moves, make it the first one
+ATTRIBUTE_NONNULL_ static void TryFirst(chess::MoveList *moves,
+    const chess::Move *my_move) {
+  for (auto& curr : *moves) {
+    if (curr == *my_move) {
+      std::swap(curr, moves->front());
+      return;
+    }
+  }
+}
+
+}  // namespace chessproblem
+
+bool ChessProblem::FindThreat(chess::Field *field, int remaining_half_moves,
+    chess::Move *threat) const {
+  if (field->IsInCheck()) {
+    return false;
+  }
+  // If the attacker mates with his next move, the threat would order only
+  // the last half move which is cheap anyway
+  if (remaining_half_moves > -4) {
+    return false;
+  }
+  // After passing, the attacker has one half move less than after a defense.
+  // A threat using all of them costs about as much as the node itself, so
+  // we search only for shorter threats.
+  int max_half_moves(-remaining_half_moves - 3);
+  if (max_half_moves >= 2 * threat_moves_) {
+    max_half_moves = 2 * threat_moves_ - 1;
+  }
+#ifndef NO_CHESSPROBLEM_THREADS
+  static thread_local chessproblem::ThreatCache cache;
+#else
+  static chessproblem::ThreatCache cache;
+#endif
+  chess::Hash hash(field->get_hash());
+  chessproblem::ThreatCache::Entry *entry(cache.Find(hash));
+  int half_moves(1);
+  if (entry->hash_ == hash) {
+    if (entry->half_moves_ > 0) {
+      if (entry->half_moves_ > max_half_moves) {
+        return false;
+      }
+      *threat = entry->threat_;
+      return true;
+    }
+    if (entry->half_moves_ < 0) {
+      if (-entry->half_moves_ >= max_half_moves) {
+        return false;
+      }
+      half_moves = -entry->half_moves_ + 2;
+    }
+  }
+  chess::Move null_move(chess::Move::kNull, chess::Field::kNpos,
+    chess::Field::kNpos);
+  chess::push_guard guard(field, &null_move);
+  entry->hash_ = hash;
+  for (; half_moves <= max_half_moves; half_moves += 2) {
+    if (chessproblem::ForcesMate(field, half_moves, threat)) {
+      entry->threat_ = *threat;
+      entry->half_moves_ = half_moves;
+      return true;
+    }
+  }
+  entry->half_moves_ = -max_half_moves;
+  return false;
+}
+
 int ChessProblem::Solve() {
   assert(mode_ != kUnknown);
   assert(half_moves_ > 0);
@@ -245,33 +544,100 @@ int ChessProblem::Solve() {
       // All players "win" always so that we do not cut
       mate_value_ = nomate_value_ = default_return_value_ = true;
   }
+  mating_color_ = ((mode_ == kMate) ? get_color() :
+    chess::InvertColor(get_color()));
 #ifndef NO_CHESSPROBLEM_THREADS
   num_solutions_found_.store(0, std::memory_order_release);
+  nodes_.store(0, std::memory_order_relaxed);
+  flight_errors_.store(0, std::memory_order_relaxed);
+  threads_started_ = 0;
+#else
+  num_solutions_found_ = 0;
+  nodes_ = 0;
+  flight_errors_ = 0;
+#endif
+  solved_.clear();
+  std::unique_ptr<chessproblem::ProofNumberSearch> proof_number;
+  if ((strategy_ == kProofNumber) && (mode_ != kHelpMate)) {
+    proof_number.reset(new chessproblem::ProofNumberSearch(table_megabytes_));
+  }
+  proof_number_ = proof_number.get();
+  std::unique_ptr<chessproblem::Tablebases> tablebases;
+  if (!tablebase_directory_.empty() && (mode_ == kMate)) {
+    tablebases.reset(new chessproblem::Tablebases(tablebase_directory_,
+      get_max_parallel()));
+    tablebases->Prepare(this, mating_color_);
+  }
+  tablebases_ = tablebases.get();
+  meet_in_the_middle_ = ((strategy_ == kMeetInTheMiddle) &&
+    (mode_ == kHelpMate));
+  breadth_first_ = ((strategy_ == kBreadthFirst) && (mode_ == kHelpMate));
+  if (!iterative_deepening_) {
+    history_ = nullptr;
+    search_half_moves_ = half_moves_;
+    SearchDepth();
+    return get_num_solutions_found();
+  }
+  chessproblem::History history;
+  history_ = &history;
+  // A helpmate can be solved with 0 moves if the position is already mate
+  for (search_half_moves_ = ((mode_ == kMate) ? 1 :
+    ((mode_ == kHelpMate) ? 0 : 2));
+    search_half_moves_ <= half_moves_; search_half_moves_ += 2) {
+    if (UNLIKELY(SearchDepth())) {
+      break;
+    }
+  }
+  history_ = nullptr;
+  search_half_moves_ = half_moves_;
+  return get_num_solutions_found();
+}
+
+#ifndef NO_CHESSPROBLEM_THREADS
+bool ChessProblem::SearchDepth() {
   thread_count_ = 0;
-  if (half_moves_ < min_half_moves_depth_) {
+  if ((proof_number_ != nullptr) || meet_in_the_middle_ || breadth_first_ ||
+    (search_half_moves_ < min_half_moves_depth_)) {
     max_threads_ = 0;
   } else {
     max_threads_ = max_parallel_ - 1;
-    new_thread_depth_ = half_moves_ - min_half_moves_depth_;
+    new_thread_depth_ = search_half_moves_ - min_half_moves_depth_;
   }
   chessproblem::Communicate kill_childs(nullptr);
-  RecursiveSolver((cancel_ = &kill_childs), this);
-#else
-  num_solutions_found_ = 0;
+  cancel_ = &kill_childs;
+  if (proof_number_ != nullptr) {
+    ProofNumberSolve(this);
+  } else if (meet_in_the_middle_) {
+    MeetInTheMiddleSolve(this);
+  } else if (!breadth_first_ || UNLIKELY(!BreadthFirstSolve(this))) {
+    RecursiveSolver(cancel_, this);
+  }
+  FlushNodes();
+  return kill_childs.TopSignal();
+}
+#else  // defined(NO_CHESSPROBLEM_THREADS)
+bool ChessProblem::SearchDepth() {
   cancel_ = false;
-  RecursiveSolver();
-#endif
-  return get_num_solutions_found();
+  if (proof_number_ != nullptr) {
+    ProofNumberSolve(this);
+  } else if (meet_in_the_middle_) {
+    MeetInTheMiddleSolve(this);
+  } else if (!breadth_first_ || UNLIKELY(!BreadthFirstSolve(this))) {
+    RecursiveSolver(nullptr);
+  }
+  return cancel_;
 }
+#endif  // NO_CHESSPROBLEM_THREADS
 
 #ifndef NO_CHESSPROBLEM_THREADS
 
 // In the non-threading code, we use the same macros which ignore "a".
 // Without these macros, we would need too many ifdef's or duplicate code...
+#define FIELD(a) a
 #define OUTPUT_CANCEL(a) OutputCancel(a)
-#define GENERATOR(a, b) a->Generator(b)
+#define PROGRESS_CANCEL(a, b) ProgressCancel(b, a)
 #define IS_IN_CHECK(a) a->IsInCheck()
-#define IS_CHECK_MATE(a) a->IsCheckMate()
+#define IS_CHECK_MATE(a) chessproblem::IsCheckMate(a)
 
 bool ChessProblem::OutputCancel(chess::Field *field) {
   if (HaveRunningThreads()) {
@@ -283,6 +649,7 @@ bool ChessProblem::OutputCancel(chess::Field *field) {
     }
     // We have a lock and increase only here: atomicity is not required
     increase_num_solutions_found_nonatomic();
+    RecordSolved(field);
     if (LIKELY(Output(field))) {
       return false;
     }
@@ -297,6 +664,7 @@ bool ChessProblem::OutputCancel(chess::Field *field) {
   }
   // Without threads, atomicity is not required:
   increase_num_solutions_found_nonatomic();
+  RecordSolved(field);
   if (LIKELY(Output(field))) {
     return false;
   }
@@ -364,13 +732,15 @@ bool ChessProblem::ProgressCancel(const chess::Move *my_move,
 
 // In the threading code, we use the same macros which deal with "a".
 // Without these macros, we would need too many ifdef's or duplicate code...
+#define FIELD(a) this
 #define OUTPUT_CANCEL(a) OutputCancel()
-#define GENERATOR(a, b) Generator(b)
+#define PROGRESS_CANCEL(a, b) ProgressCancel(b)
 #define IS_IN_CHECK(a) IsInCheck()
-#define IS_CHECK_MATE(a) IsCheckMate()
+#define IS_CHECK_MATE(a) chessproblem::IsCheckMate(this)
 
 inline bool ChessProblem::OutputCancel() {
   ++num_solutions_found_;
+  RecordSolved(this);
   if (LIKELY(Output(this))) {
     return false;
   }
@@ -400,12 +770,30 @@ inline bool ChessProblem::ProgressCancel(const chess::Move *my_move) {
 bool ChessProblem::RecursiveSolver(chessproblem::Communicate *parent,
     chess::Field *field) {
   int remaining_half_moves(static_cast<int>(field->get_move_stack().size())
-    - half_moves_);
+    - search_half_moves_);
 #else
-bool ChessProblem::RecursiveSolver() {
+bool ChessProblem::RecursiveSolver(const chess::Move *threat) {
   int remaining_half_moves(static_cast<int>(get_move_stack().size())
-    - half_moves_);
+    - search_half_moves_);
 #endif  // NO_CHESSPROBLEM_THREADS
+  CountNode();
+  if (UNLIKELY(!FIELD(field)->CanMate(mating_color_))) {
+    return NoMateValue(FIELD(field)->get_color());
+  }
+  if ((mode_ == kHelpMate) && (remaining_half_moves != 0) &&
+    UNLIKELY(FIELD(field)->HelpMateTooFar(mating_color_,
+    -remaining_half_moves))) {
+    return true;
+  }
+  int table_half_moves;
+  if ((tablebases_ != nullptr) && (remaining_half_moves != 0) &&
+    !FIELD(field)->get_move_stack().empty() &&
+    tablebases_->Probe(FIELD(field), &table_half_moves)) {
+    // The table tells whether mating_color_ can force mate in time
+    bool mate((table_half_moves >= 0) &&
+      (table_half_moves <= -remaining_half_moves));
+    return ((FIELD(field)->get_color() == mating_color_) == mate);
+  }
   if (remaining_half_moves == 0) {
     if (UNLIKELY(IS_CHECK_MATE(field))) {
       if (mode_ == kHelpMate) {
@@ -416,8 +804,23 @@ bool ChessProblem::RecursiveSolver() {
     }
     return nomate_value_;
   }
-  chess::MoveList moves;
-  if (UNLIKELY(!GENERATOR(field, &moves))) {
+#ifndef NO_CHESSPROBLEM_THREADS
+  const chess::Move *threat(parent->get_threat());
+#endif
+  // A complete list is needed for sorting and for the progress of the first
+  // levels. Otherwise, the moves are generated lazily: Often, the first
+  // moves already decide.
+  chess::MovePicker picker;
+  chess::MoveList *moves(nullptr);
+  bool have_moves;
+  if (LIKELY(staged_generation_) && (history_ == nullptr) &&
+    (threat == nullptr) && (FIELD(field)->get_move_stack().size() > 1)) {
+    have_moves = picker.HaveNext(FIELD(field));
+  } else {
+    moves = picker.Complete(FIELD(field));
+    have_moves = !moves->empty();
+  }
+  if (UNLIKELY(!have_moves)) {
     // Early mate or stalemate. This is hairy...
     if ((remaining_half_moves & 1) != 0) {
       // If we are not the party which needs to be mate in the last move,
@@ -437,28 +840,69 @@ bool ChessProblem::RecursiveSolver() {
       return mate_value_;
     }
     // We get here only in case of ill-posed HelpMate problems
-    // with a cook having less moves than the desired solution
-    OUTPUT_CANCEL(field);
+    // with a cook having less moves than the desired solution.
+    // With iterative deepening, it was output in an earlier iteration.
+    if (!iterative_deepening_) {
+      OUTPUT_CANCEL(field);
+    }
     return true;
   }
+  if (history_ != nullptr) {
+    if (FIELD(field)->get_move_stack().empty()) {
+      // Do not search again first moves which are already solved
+      chessproblem::RemoveSolved(moves, &solved_);
+    } else {
+      history_->Sort(moves);
+    }
+  }
+  if (threat != nullptr) {
+    // The threat against the defender's previous move is our first try
+    chessproblem::TryFirst(moves, threat);
+  }
+  // For kMate, a threat is searched at the defender's nodes only
+  chess::Move my_threat(chess::Move::kNull, chess::Field::kNpos,
+    chess::Field::kNpos);
+  bool have_threat(UNLIKELY(threat_moves_ > 0) && (mode_ == kMate) &&
+    ((remaining_half_moves & 1) == 0) &&
+    FindThreat(FIELD(field), remaining_half_moves, &my_threat));
 #ifndef NO_CHESSPROBLEM_THREADS
-  if (UNLIKELY(ProgressCancel(&moves, field))) {
+  if ((moves != nullptr) && UNLIKELY(ProgressCancel(moves, field))) {
     return true;
   }
-  chessproblem::Communicate communicate(parent, &moves, default_return_value_);
+  if (remaining_half_moves == -1) {
+    if (mode_ == kSelfMate) {
+      return SelfMateLastPly(field, &picker);
+    }
+    if (!field->get_move_stack().empty()) {
+      return MatingLastPly(field, &picker);
+    }
+  }
+  chessproblem::Communicate communicate(parent, &picker,
+    default_return_value_);
+  if (have_threat) {
+    communicate.set_threat(&my_threat);
+  }
   SolverThread(&communicate, field);
   return communicate.get_result();
 #else  // defined(NO_CHESSPROBLEM_THREADS)
-  if (UNLIKELY(ProgressCancel(&moves))) {
+  if ((moves != nullptr) && UNLIKELY(ProgressCancel(moves))) {
     return true;
   }
-  for (auto it = moves.begin(); it != moves.end(); ++it) {
-    const chess::Move *current_move(&(*it));
+  if (remaining_half_moves == -1) {
+    if (mode_ == kSelfMate) {
+      return SelfMateLastPly(this, &picker);
+    }
+    if (!get_move_stack().empty()) {
+      return MatingLastPly(this, &picker);
+    }
+  }
+  const chess::Move *current_move;
+  while ((current_move = picker.Next(this)) != nullptr) {
     if (UNLIKELY(ProgressCancel(current_move))) {
       return true;
     }
     PushMove(current_move);
-    int opponent(RecursiveSolver());
+    int opponent(RecursiveSolver(have_threat ? &my_threat : nullptr));
     chess::push_guard guard(this);  // Postpone PopMove() to after Output
     if (UNLIKELY(cancel_)) {
       return true;
@@ -467,6 +911,10 @@ bool ChessProblem::RecursiveSolver() {
       // If opponent has reached his goal or if we are in helpmate do not prune
       continue;
     }
+    if (history_ != nullptr) {
+      history_->Reward(current_move, search_half_moves_ -
+        static_cast<int>(get_move_stack().size()));
+    }
     // This is the second inconsistency with the multithreaded code:
     // We do not set the return value to "true" here, see below.
 
@@ -490,21 +938,229 @@ bool ChessProblem::RecursiveSolver() {
 #endif  // NO_CHESSPROBLEM_THREADS
 }
 
+void ChessProblem::ProofNumberSolve(chess::Field *field) {
+  chess::MoveList moves;
+  field->Generator(&moves);
+  if (history_ != nullptr) {
+    chessproblem::RemoveSolved(&moves, &solved_);
+  }
+  if (UNLIKELY(PROGRESS_CANCEL(field, &moves))) {
+    return;
+  }
+  for (const auto& my_move : moves) {
+    if (UNLIKELY(PROGRESS_CANCEL(field, &my_move))) {
+      return;
+    }
+    chess::push_guard guard(field, &my_move);
+    std::uint64_t start(proof_number_->get_nodes());
+    bool proved(proof_number_->Prove(field, search_half_moves_ - 1, false,
+      mating_color_));
+    add_nodes(proof_number_->get_nodes() - start);
+    if (proved && UNLIKELY(OUTPUT_CANCEL(field))) {
+      return;
+    }
+  }
+}
+
+void ChessProblem::MeetInTheMiddleSolve(chess::Field *field) {
+  std::vector<chess::MoveList> solutions;
+  chessproblem::MeetInTheMiddle search;
+  search.Solve(field, search_half_moves_, mating_color_, &solutions);
+  add_nodes(search.get_nodes());
+  OutputSolutions(field, &solutions);
+}
+
+bool ChessProblem::BreadthFirstSolve(chess::Field *field) {
+  if (search_half_moves_ == 0) {
+    // Nothing to expand; the recursive solver tests the position itself
+    return false;
+  }
+  std::vector<chess::MoveList> solutions;
+#ifndef NO_CHESSPROBLEM_THREADS
+  chessproblem::BreadthFirst search(table_megabytes_, max_parallel_);
+#else
+  chessproblem::BreadthFirst search(table_megabytes_, 1);
+#endif
+  if (UNLIKELY(!search.Solve(field, search_half_moves_, mating_color_,
+    &solutions))) {
+    return false;
+  }
+  add_nodes(search.get_nodes());
+  OutputSolutions(field, &solutions);
+  return true;
+}
+
+void ChessProblem::OutputSolutions(chess::Field *field,
+    const std::vector<chess::MoveList> *solutions) {
+  for (const auto& solution : *solutions) {
+    // With iterative deepening, shorter solutions were output earlier
+    if (iterative_deepening_ &&
+      (static_cast<int>(solution.size()) < search_half_moves_)) {
+      continue;
+    }
+    for (const auto& my_move : solution) {
+      field->PushMove(&my_move);
+    }
+    bool cancel(OUTPUT_CANCEL(field));
+    for (std::size_t i(solution.size()); i != 0; --i) {
+      field->PopMove();
+    }
+    if (UNLIKELY(cancel)) {
+      return;
+    }
+  }
+}
+
+// In kSelfMate the last half move is the defender's, and the defender has
+// reached the goal as soon as there is a single move which does not mate.
+// A move which does not give check can never mate, so we first look for
+// such a move which needs no mate test (and not even a push) at all.
+// Only if all moves give check we have to do the (expensive) test whether
+// some of them does not mate; a move after which the king has a flight
+// field does not mate either (see chessproblem::FlightBatch).
+bool ChessProblem::SelfMateLastPly(chess::Field *field,
+    chess::MovePicker *picker) {
+  std::vector<const chess::Move *> checks;
+  const chess::Move *my_move;
+  while ((my_move = picker->Next(field)) != nullptr) {
+    if (UNLIKELY(PROGRESS_CANCEL(field, my_move))) {
+      return true;
+    }
+    if (!field->GivesCheck(*my_move)) {
+      return true;
+    }
+    checks.push_back(my_move);
+  }
+  chessproblem::FlightBatch batch;
+  batch.SetPosition(field);
+  for (std::size_t i(0); i != checks.size(); ++i) {
+    batch.Add(checks[i]);
+    if (!batch.full() && (i + 1 != checks.size())) {
+      continue;
+    }
+    batch.Test(flight_kernel_);
+    for (std::size_t j(0); j != batch.size(); ++j) {
+      if (!batch.MayBeMate(j)) {
+        return true;
+      }
+    }
+    batch.clear();
+  }
+  for (auto check_move : checks) {
+    chess::push_guard guard(field, check_move, true);
+    if (!chessproblem::IsCheckMate(field)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// In kMate and kHelpMate the last half move is the mating party's. Since
+// each leaf needs only the mate test, the moves are tested in a loop without
+// the overhead of the recursion (and of the thread communication).
+// Moves not giving check are skipped without being pushed. The others are
+// collected in batches for the test of the flight fields, and only those
+// after which the king has no flight field are pushed for the mate test.
+// Except for kHelpMate, the first move (the threat or the best one of the
+// history) mates most likely, so the first check is tested alone before
+// the later moves are generated.
+bool ChessProblem::MatingLastPly(chess::Field *field,
+    chess::MovePicker *picker) {
+  chessproblem::FlightBatch batch;
+  bool have_position(false);
+  std::size_t batch_size((mode_ == kHelpMate) ?
+    chessproblem::FlightBatch::kSize : 1);
+  const chess::Move *my_move;
+  while ((my_move = picker->Next(field)) != nullptr) {
+    if (UNLIKELY(PROGRESS_CANCEL(field, my_move))) {
+      return true;
+    }
+    if (LIKELY(!verify_flights_) && LIKELY(!field->GivesCheck(*my_move))) {
+      continue;
+    }
+    if (!have_position) {
+      have_position = true;
+      batch.SetPosition(field);
+    }
+    batch.Add(my_move);
+    if (batch.size() == batch_size) {
+      if (MatingBatch(field, &batch)) {
+        return true;
+      }
+      batch_size = chessproblem::FlightBatch::kSize;
+    }
+  }
+  if (!batch.empty() && MatingBatch(field, &batch)) {
+    return true;
+  }
+  return default_return_value_;
+}
+
+bool ChessProblem::MatingBatch(chess::Field *field,
+    chessproblem::FlightBatch *batch) {
+  batch->Test(flight_kernel_);
+  bool verify(UNLIKELY(verify_flights_));
+  if (verify && !batch->Verify()) {
+    CountFlightError();
+  }
+  for (std::size_t i(0); i != batch->size(); ++i) {
+    const chess::Move *my_move(batch->get_move(i));
+    if (LIKELY(!verify) && LIKELY(!batch->MayBeMate(i))) {
+      continue;
+    }
+    bool check(verify ? field->GivesCheck(*my_move) : true);
+    chess::push_guard guard(field, my_move, check);
+    bool mate(chessproblem::IsCheckMate(field));
+    if (verify && ((batch->IsCheck(i) != check) ||
+      (batch->HasFlight(i) && mate) ||
+      (batch->MayBeMate(i) != (check && !batch->HasFlight(i))))) {
+      CountFlightError();
+    }
+    if (LIKELY(!mate)) {
+      continue;
+    }
+    if (mode_ != kHelpMate) {
+      if (history_ != nullptr) {
+        history_->Reward(my_move, 0);
+      }
+      batch->clear();
+      return true;
+    }
+    if (UNLIKELY(OUTPUT_CANCEL(field))) {
+      batch->clear();
+      return true;
+    }
+  }
+  batch->clear();
+  return false;
+}
+
+void ChessProblem::CountFlightError() {
+#ifndef NO_CHESSPROBLEM_THREADS
+  flight_errors_.fetch_add(1, std::memory_order_relaxed);
+#else
+  ++flight_errors_;
+#endif
+}
+
 #ifndef NO_CHESSPROBLEM_THREADS
 void ChessProblem::SolverThread(chessproblem::Communicate *communicate,
     chess::Field *field) {
   bool subthread(communicate->get_equal_level_threads());
   std::vector<std::thread> threads;
   const chess::Move *current_move;
-  while (communicate->GetIncreasing(&current_move, HaveRunningThreads())) {
+  while (communicate->GetIncreasing(&current_move, field,
+    HaveRunningThreads())) {
     // Possibly start a new thread
     if (MultiThreadedMode()) {  // (quick test to do a shortcut)
       if (communicate->GotSignal()) {
         break;
       }
-      if (field->get_move_stack().size() <= new_thread_depth_) {
-        if (communicate->HaveNextUnsafe()) {
+      if (field->get_move_stack().size() <=
+        static_cast<std::size_t>(new_thread_depth_)) {
+        if (communicate->HaveNextUnsafe(field)) {
           if (IncreaseThreads()) {
+            communicate->GenerateAll(field);
             communicate->set_equal_level_threads();
             threads.emplace_back(&ChessProblem::SolverThread, this,
               communicate, new chess::Field(*field));
@@ -526,6 +1182,10 @@ void ChessProblem::SolverThread(chessproblem::Communicate *communicate,
       continue;
     }
     communicate->Win();
+    if (history_ != nullptr) {
+      history_->Reward(current_move, search_half_moves_ -
+        static_cast<int>(field->get_move_stack().size()));
+    }
     // This is the only pruning we can do: We need not check after winning
     // (except when in the top level so that we find cooks).
     if (LIKELY(field->get_move_stack().size() != 1)) {
@@ -542,6 +1202,7 @@ void ChessProblem::SolverThread(chessproblem::Communicate *communicate,
   }
   if (subthread) {  // We are at the end of a subthread
     delete field;
+    FlushNodes();
     DecreaseThreads();  // We might be not ready, but we will only wait
   }
   // Even in case of communicate->GotSignal() we must wait for exiting threads:
@@ -11,20 +11,28 @@
 #include <config.h>
 
 #include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
 
 #ifndef NO_CHESSPROBLEM_THREADS
 #include <atomic>
 #include <mutex>  // NOLINT(build/c++11)
 #endif
+#include <string>
+#include <vector>
 
 #include "chessproblem/chess.h"
+#include "chessproblem/flights.h"
 #include "chessproblem/m_attribute.h"
 
-#ifndef NO_CHESSPROBLEM_THREADS
 namespace chessproblem {
+#ifndef NO_CHESSPROBLEM_THREADS
 class Communicate;
-}  // namespace chessproblem
 #endif  // NO_CHESSPROBLEM_THREADS
+class History;
+class ProofNumberSearch;
+class Tablebases;
+}  // namespace chessproblem
 
 /*
 This is a recursive solver for chess problems, based on the chess library.
@@ -75,6 +83,8 @@ class ChessProblem : public chess::Field {
 
   // If the progress value is true, this function is called
   // before we attack the specified list of moves.
+  // With staged generation (see set_staged_generation()) this happens only
+  // on the first two levels, since deeper lists are not generated at once.
   // The size of field->get_move_stack() determines the current depth level.
   // Also this function can cancel the whole process by returning false.
   // The default implementation only returns true.
@@ -97,6 +107,19 @@ class ChessProblem : public chess::Field {
  public:
   enum Mode { kUnknown, kMate, kSelfMate, kHelpMate };
 
+  // kMinMax is the recursive (and possibly multithreaded) solver.
+  // kProofNumber is a single-threaded depth-first proof-number search with
+  // a transposition table; it is used only for kMate and kSelfMate.
+  // kMeetInTheMiddle is a single-threaded solver which searches the first
+  // half of the solutions forward and the second half backward from the
+  // possible mates and joins them in the middle; it is used only for
+  // kHelpMate.
+  // kBreadthFirst is a level-synchronous solver which keeps the levels in
+  // temporary files; it is used only for kHelpMate.
+  enum Strategy { kMinMax, kProofNumber, kMeetInTheMiddle, kBreadthFirst };
+
+  constexpr static const std::size_t kTableMegabytesDefault = 64;
+
 #ifndef NO_CHESSPROBLEM_THREADS
   constexpr static const int
     kMaxParallelDefault =
@@ -114,19 +137,29 @@ class ChessProblem : public chess::Field {
 #endif  // NO_CHESSPROBLEM_THREADS
 
   ChessProblem()
-    : chess::Field(), mode_(kUnknown), half_moves_(0), default_color_(true) {
+    : chess::Field(), mode_(kUnknown), half_moves_(0), default_color_(true),
+    threat_moves_(0), iterative_deepening_(false), staged_generation_(true),
+    flight_kernel_(chessproblem::FlightBatch::kAuto), verify_flights_(false),
+    strategy_(kMinMax), table_megabytes_(kTableMegabytesDefault),
+    nodes_(0), flight_errors_(0) {
 #ifndef NO_CHESSPROBLEM_THREADS
     set_max_parallel(kMaxParallelDefault);
     set_min_half_moves_depth(kMinHalfMovesDepthDefault);
+    threads_started_ = 0;
 #endif
   }
 
   ChessProblem(Mode mode, int moves)
-    : chess::Field(), default_color_(true) {
+    : chess::Field(), default_color_(true), threat_moves_(0),
+    iterative_deepening_(false), staged_generation_(true),
+    flight_kernel_(chessproblem::FlightBatch::kAuto), verify_flights_(false),
+    strategy_(kMinMax), table_megabytes_(kTableMegabytesDefault), nodes_(0),
+    flight_errors_(0) {
     set_mode(mode, moves);
 #ifndef NO_CHESSPROBLEM_THREADS
     set_max_parallel(kMaxParallelDefault);
     set_min_half_moves_depth(kMinHalfMovesDepthDefault);
+    threads_started_ = 0;
 #endif
   }
 
@@ -173,6 +206,97 @@ class ChessProblem : public chess::Field {
     default_color_ = false;
   }
 
+  // For kMate: Before the defender's moves are checked, let the defender
+  // pass and search for the shortest threat of at most threat_moves moves.
+  // The first move of the threat is then tried first against each defense.
+  // The value 0 (default) disables threat analysis.
+  void set_threat_moves(int threat_moves) {
+    assert(threat_moves >= 0);
+    threat_moves_ = threat_moves;
+  }
+
+  ATTRIBUTE_NODISCARD int get_threat_moves() const {
+    return threat_moves_;
+  }
+
+  // For kMate and kSelfMate: Solve for 1, 2, ... moves and report each
+  // solution in the first iteration in which it works, so that the length
+  // of its shortest solution is known. A solved first move is not searched
+  // again. For kHelpMate, only solutions of exactly the iteration's length
+  // are reported in each iteration.
+  // Moves which won in earlier iterations are tried first.
+  void set_iterative_deepening(bool iterative_deepening) {
+    iterative_deepening_ = iterative_deepening;
+  }
+
+  ATTRIBUTE_NODISCARD bool get_iterative_deepening() const {
+    return iterative_deepening_;
+  }
+
+  // Generate the moves lazily in stages (default) where possible. If this
+  // is switched off, Progress() gets the list of moves also on deeper levels.
+  void set_staged_generation(bool staged_generation) {
+    staged_generation_ = staged_generation;
+  }
+
+  ATTRIBUTE_NODISCARD bool get_staged_generation() const {
+    return staged_generation_;
+  }
+
+  // The kernel for the flight fields of the mated king at the last half
+  // move (see chessproblem::FlightBatch); it must be supported.
+  void set_flight_kernel(chessproblem::FlightBatch::Kernel kernel) {
+    assert(chessproblem::FlightBatch::Supported(kernel));
+    flight_kernel_ = kernel;
+  }
+
+  ATTRIBUTE_NODISCARD chessproblem::FlightBatch::Kernel get_flight_kernel()
+      const {
+    return flight_kernel_;
+  }
+
+  // For testing: At the last half move of kMate and kHelpMate, compare for
+  // each move the results of all supported kernels of the flight test with
+  // each other and with chess::Field::IsCheckMate(); see
+  // get_flight_errors(). The solutions do not depend on the kernels then.
+  void set_verify_flights(bool verify_flights) {
+    verify_flights_ = verify_flights;
+  }
+
+  ATTRIBUTE_NODISCARD bool get_verify_flights() const {
+    return verify_flights_;
+  }
+
+  void set_strategy(Strategy strategy) {
+    strategy_ = strategy;
+  }
+
+  ATTRIBUTE_NODISCARD Strategy get_strategy() const {
+    return strategy_;
+  }
+
+  // The approximate size of the transposition table of kProofNumber or
+  // of the memory which kBreadthFirst uses before spilling to disk
+  void set_table_megabytes(std::size_t table_megabytes) {
+    assert(table_megabytes > 0);
+    table_megabytes_ = table_megabytes;
+  }
+
+  ATTRIBUTE_NODISCARD std::size_t get_table_megabytes() const {
+    return table_megabytes_;
+  }
+
+  // For kMate: Use depth-to-mate tables (KQK, KRK, KBNK, KPK) from
+  // directory, generating and writing them there if necessary.
+  // The empty string (default) disables the tables.
+  void set_tablebase_directory(const std::string& directory) {
+    tablebase_directory_ = directory;
+  }
+
+  ATTRIBUTE_NODISCARD const std::string& get_tablebase_directory() const {
+    return tablebase_directory_;
+  }
+
 #ifndef NO_CHESSPROBLEM_THREADS
 
   // max_parallel is set, possibly reduced to value supported by hardware
@@ -217,6 +341,38 @@ class ChessProblem : public chess::Field {
   // The return value is the number of solutions found.
   int Solve();
 
+  // The number of positions searched by the last Solve(). For kMinMax,
+  // these are the calls of the recursive solver; the last half move of
+  // kMate and kSelfMate is not counted.
+#ifndef NO_CHESSPROBLEM_THREADS
+  ATTRIBUTE_NODISCARD std::uint64_t get_nodes() const {
+    return nodes_.load(std::memory_order_relaxed);
+  }
+
+  // The number of threads started by the last Solve()
+  ATTRIBUTE_NODISCARD int get_threads_started() const {
+    return threads_started_;
+  }
+
+  // The number of moves for which set_verify_flights() found a difference
+  // in the last Solve()
+  ATTRIBUTE_NODISCARD std::uint64_t get_flight_errors() const {
+    return flight_errors_.load(std::memory_order_relaxed);
+  }
+#else
+  ATTRIBUTE_NODISCARD std::uint64_t get_nodes() const {
+    return nodes_;
+  }
+
+  ATTRIBUTE_NODISCARD int get_threads_started() const {
+    return 0;
+  }
+
+  ATTRIBUTE_NODISCARD std::uint64_t get_flight_errors() const {
+    return flight_errors_;
+  }
+#endif
+
  protected:
   // When Output() is called, it can access the already updated number
 #ifndef NO_CHESSPROBLEM_THREADS
@@ -224,21 +380,62 @@ class ChessProblem : public chess::Field {
     return num_solutions_found_.load(std::memory_order_consume);
   }
 #else
-  bool get_num_solutions_found() const {
+  int get_num_solutions_found() const {
     return num_solutions_found_;
   }
 #endif
 
+  // When Output() is called, it can access the number of half moves of the
+  // found solution. This is less than get_half_moves() only for a solution
+  // found with iterative deepening in an earlier iteration.
+  int get_solution_half_moves() const {
+    return search_half_moves_;
+  }
+
  private:
   Mode mode_;
   int half_moves_;
   bool default_color_;
+  int threat_moves_;
+  bool iterative_deepening_;
+  bool staged_generation_;
+  chessproblem::FlightBatch::Kernel flight_kernel_;
+  bool verify_flights_;
+
+  // The depth of the current iteration; half_moves_ if not iterating
+  int search_half_moves_;
+
+  // Statistics of winning moves, only used with iterative deepening
+  chessproblem::History *history_;
+
+  // The first moves of all solutions found with iterative deepening
+  std::vector<chess::Move> solved_;
+
+  Strategy strategy_;
+  std::size_t table_megabytes_;
+
+  // Only used with strategy kProofNumber
+  chessproblem::ProofNumberSearch *proof_number_;
+
+  std::string tablebase_directory_;
+
+  // Only used for kMate with nonempty tablebase_directory_
+  const chessproblem::Tablebases *tablebases_;
+
+  // Whether strategy kMeetInTheMiddle or kBreadthFirst is used
+  bool meet_in_the_middle_, breadth_first_;
+
+  // The party which has to give mate in the last move
+  chess::Figure mating_color_;
+
 #ifndef NO_CHESSPROBLEM_THREADS
   chessproblem::Communicate *cancel_;
   std::atomic_int num_solutions_found_;
+  std::atomic<std::uint64_t> nodes_, flight_errors_;
 #else
   bool cancel_;
   int num_solutions_found_;
+  std::uint64_t nodes_, flight_errors_;
 #endif
 
   // These values are initialized to avoid recalculation during recursion:
@@ -248,6 +445,7 @@ class ChessProblem : public chess::Field {
   int max_parallel_, min_half_moves_depth_;
   int max_threads_, new_thread_depth_;
   std::atomic_int thread_count_;
+  int threads_started_;  // Only changed with locked thread_count_mutex_
   std::mutex io_mutex_, thread_count_mutex_;
   typedef std::lock_guard<std::mutex> LockGuard;
 #endif  // NO_CHESSPROBLEM_THREADS
@@ -259,7 +457,37 @@ class ChessProblem : public chess::Field {
     }
   }
 
+  // The return value of RecursiveSolver() if the moving party is color
+  // and mating_color_ has insufficient material to give mate
+  ATTRIBUTE_NODISCARD bool NoMateValue(chess::Figure color) const {
+    return ((mode_ == kHelpMate) || ((mode_ == kMate) !=
+      (color == mating_color_)));
+  }
+
+  // Solve for search_half_moves_. Return true if canceled
+  bool SearchDepth();
+
+  // With iterative deepening, remember the first move of a solution
+  ATTRIBUTE_NONNULL_ void RecordSolved(const chess::Field *field) {
+    if (iterative_deepening_ && (mode_ != kHelpMate)) {
+      solved_.push_back(*(field->get_move_stack().front().move_));
+    }
+  }
+
 #ifndef NO_CHESSPROBLEM_THREADS
+  // Only statistics: the order of the additions does not matter
+  void add_nodes(std::uint64_t nodes) {
+    nodes_.fetch_add(nodes, std::memory_order_relaxed);
+  }
+
+  // Count a node of the recursive solver. To avoid an atomic operation for
+  // each node, the count is kept per thread until FlushNodes().
+  inline static void CountNode();
+
+  // Add the nodes counted by the current thread to nodes_. This must be
+  // called at the end of each thread.
+  void FlushNodes();
+
   // Possibly non-locked faster version of ++num_solutions_found_
   void increase_num_solutions_found_nonatomic() {
     num_solutions_found_.store(num_solutions_found_.load(
@@ -300,6 +528,7 @@ class ChessProblem : public chess::Field {
       return false;
     }
     thread_count_.store(curr_count + 1, std::memory_order_release);
+    ++threads_started_;
     return true;
   }
 
@@ -335,6 +564,14 @@ class ChessProblem : public chess::Field {
 
 #else  // defined(NO_CHESSPROBLEM_THREADS)
 
+  void add_nodes(std::uint64_t nodes) {
+    nodes_ += nodes;
+  }
+
+  void CountNode() {
+    ++nodes_;
+  }
+
   // Increase num_solutions_found, call Output().
   // Possibly set cancel_ and return true if cancel_
   inline bool OutputCancel();
@@ -345,10 +582,51 @@ class ChessProblem : public chess::Field {
   // Call Progress(). Possibly set cancel_ and return true if cancel_
   ATTRIBUTE_NONNULL_ bool ProgressCancel(const chess::Move *my_move);
 
-  // The actually recursively called solver function
-  bool RecursiveSolver();
+  // The actually recursively called solver function.
+  // threat is the threat found by the calling defender node or nullptr.
+  bool RecursiveSolver(const chess::Move *threat);
 
 #endif  // NO_CHESSPROBLEM_THREADS
+
+  // For kMate: let the defender pass and store the first move of the
+  // shortest threat into *threat. Return false if there is no threat.
+  // Only threats shorter than the remaining half moves are searched, and
+  // the results are cached per thread.
+  ATTRIBUTE_NONNULL_ bool FindThreat(chess::Field *field,
+      int remaining_half_moves, chess::Move *threat) const;
+
+  // The first half move for kProofNumber: Prove each move separately
+  ATTRIBUTE_NONNULL_ void ProofNumberSolve(chess::Field *field);
+
+  // Solve with chessproblem::MeetInTheMiddle and output the solutions
+  ATTRIBUTE_NONNULL_ void MeetInTheMiddleSolve(chess::Field *field);
+
+  // Solve with chessproblem::BreadthFirst and output the solutions.
+  // Return false if temporary files could not be used or if there is no
+  // half move to search.
+  ATTRIBUTE_NONNULL_ bool BreadthFirstSolve(chess::Field *field);
+
+  // Output the solutions (lists of moves from field) for kHelpMate
+  ATTRIBUTE_NONNULL_ void OutputSolutions(chess::Field *field,
+      const std::vector<chess::MoveList> *solutions);
+
+  // The mating party's last half move in kMate and kHelpMate (not at the
+  // top level). Return the value of RecursiveSolver().
+  ATTRIBUTE_NONNULL_ bool MatingLastPly(chess::Field *field,
+      chess::MovePicker *picker);
+
+  // Test the moves of *batch for MatingLastPly() and clear it.
+  // Return true if MatingLastPly() has to return true immediately.
+  ATTRIBUTE_NONNULL_ bool MatingBatch(chess::Field *field,
+      chessproblem::FlightBatch *batch);
+
+  // Count a difference found by set_verify_flights()
+  void CountFlightError();
+
+  // The defender's last half move in kSelfMate.
+  // Return true if there is a move after which the attacker is not mate.
+  ATTRIBUTE_NONNULL_ bool SelfMateLastPly(chess::Field *field,
+      chess::MovePicker *picker);
 };
 
 #endif  // CHESSPROBLEM_CHESSPROBLEM_H_
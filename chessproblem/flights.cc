@@ -0,0 +1,417 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/flights.h"
+#include <config.h>
+
+#include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <cstring>  // memcpy
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+using chess::Field;
+using chess::Figure;
+using chess::Pos;
+
+namespace chessproblem {
+
+namespace {
+
+// The helpers of the kernel are templates for std::uint64_t and for the
+// vector types. They must be inlined into the functions with the target
+// attributes: Otherwise the vector instructions could not be used, and
+// the ABI for passing the vectors would differ (therefore vectors are
+// passed by reference, and the results are stored in *result).
+#ifdef HAVE_SIMD
+#define FLIGHTS_INLINE __attribute__((always_inline)) inline
+#else
+#define FLIGHTS_INLINE inline
+#endif
+
+static_assert(Field::kColumns == 8 && Field::kRows == 8,
+  "the kernel assumes a board of 8 x 8 fields");
+
+// The shift of the bitboards for a step by one row
+constexpr const int kRowShift = static_cast<int>(Field::kColumns);
+
+constexpr const std::uint64_t
+  kColumn0 = 0x0101010101010101U,
+  kColumn7 = 0x8080808080808080U;
+
+// The fields which can be reached by a step of columns columns (without
+// wrapping around to another row)
+constexpr std::uint64_t ColumnMask(int columns) {
+  return ((columns == 2) ? ~(kColumn0 | (kColumn0 << 1)) :
+    ((columns == 1) ? ~kColumn0 :
+    ((columns == -1) ? ~kColumn7 :
+    ((columns == -2) ? ~(kColumn7 | (kColumn7 >> 1)) :
+    ~std::uint64_t(0)))));
+}
+
+// The bit of a field (on the board) as in chess::Field::Pack()
+constexpr std::uint64_t Bit(Pos pos) {
+  return (std::uint64_t(1) <<
+    ((pos - Field::kFieldStart) / (Field::kColumns + 2) * Field::kColumns +
+    (pos - Field::kFieldStart) % (Field::kColumns + 2)));
+}
+
+template<class V> FLIGHTS_INLINE void Load(V *result,
+    const std::uint64_t *lane) {
+  std::memcpy(result, lane, sizeof(V));
+}
+
+template<class V> FLIGHTS_INLINE void Store(std::uint64_t *lane,
+    const V& value) {
+  std::memcpy(lane, &value, sizeof(V));
+}
+
+// Shift the bits by kShift (a negative value shifts to the right)
+template<int kShift, class V> FLIGHTS_INLINE void Shift(V *result,
+    const V& bits) {
+  if (kShift >= 0) {
+    *result = (bits << ((kShift >= 0) ? kShift : 0));
+  } else {
+    *result = (bits >> ((kShift < 0) ? -kShift : 0));
+  }
+}
+
+// Add the fields reached from figures by a step of kRows rows and kColumns
+// columns
+template<int kRows, int kColumns, class V> FLIGHTS_INLINE void AddStep(
+    V *result, const V& figures) {
+  V shifted;
+  Shift<kRows * kRowShift + kColumns>(&shifted, figures);
+  *result |= (shifted & ColumnMask(kColumns));
+}
+
+// Add the fields reached from the long range figures in the direction of
+// kRows rows and kColumns columns through the empty fields (Kogge-Stone)
+template<int kRows, int kColumns, class V> FLIGHTS_INLINE void AddRay(
+    V *result, const V& figures, const V& empty) {
+  constexpr const int kShift(kRows * kRowShift + kColumns);
+  V reached(figures), passable(empty & ColumnMask(kColumns)), shifted;
+  Shift<kShift>(&shifted, reached);
+  reached |= (passable & shifted);
+  Shift<kShift>(&shifted, passable);
+  passable &= shifted;
+  Shift<2 * kShift>(&shifted, reached);
+  reached |= (passable & shifted);
+  Shift<2 * kShift>(&shifted, passable);
+  passable &= shifted;
+  Shift<4 * kShift>(&shifted, reached);
+  reached |= (passable & shifted);
+  AddStep<kRows, kColumns>(result, reached);
+}
+
+// Add the neighbour fields of kings
+template<class V> FLIGHTS_INLINE void AddNeighbours(V *result,
+    const V& kings) {
+  AddStep<1, -1>(result, kings);
+  AddStep<1, 0>(result, kings);
+  AddStep<1, 1>(result, kings);
+  AddStep<0, -1>(result, kings);
+  AddStep<0, 1>(result, kings);
+  AddStep<-1, -1>(result, kings);
+  AddStep<-1, 0>(result, kings);
+  AddStep<-1, 1>(result, kings);
+}
+
+// The kernel for the boards from 0 to size (rounded up to the width of V)
+template<class V> FLIGHTS_INLINE void Kernel(FlightBatch::Lanes *lanes,
+    std::size_t size, bool white) {
+  constexpr const std::size_t kWidth(sizeof(V) / sizeof(std::uint64_t));
+  for (std::size_t i(0); i < size; i += kWidth) {
+    V occupied, orthogonal, diagonal, knights, pawns, king, mated_king,
+      mated_figures;
+    Load(&occupied, &lanes->occupied_[i]);
+    Load(&orthogonal, &lanes->orthogonal_[i]);
+    Load(&diagonal, &lanes->diagonal_[i]);
+    Load(&knights, &lanes->knights_[i]);
+    Load(&pawns, &lanes->pawns_[i]);
+    Load(&king, &lanes->king_[i]);
+    Load(&mated_king, &lanes->mated_king_[i]);
+    Load(&mated_figures, &lanes->mated_figures_[i]);
+    V empty(~occupied), attacked(occupied & 0), flights(attacked);
+    if (white) {
+      AddStep<1, -1>(&attacked, pawns);
+      AddStep<1, 1>(&attacked, pawns);
+    } else {
+      AddStep<-1, -1>(&attacked, pawns);
+      AddStep<-1, 1>(&attacked, pawns);
+    }
+    AddStep<2, -1>(&attacked, knights);
+    AddStep<2, 1>(&attacked, knights);
+    AddStep<1, -2>(&attacked, knights);
+    AddStep<1, 2>(&attacked, knights);
+    AddStep<-1, -2>(&attacked, knights);
+    AddStep<-1, 2>(&attacked, knights);
+    AddStep<-2, -1>(&attacked, knights);
+    AddStep<-2, 1>(&attacked, knights);
+    AddNeighbours(&attacked, king);
+    AddRay<1, 0>(&attacked, orthogonal, empty);
+    AddRay<-1, 0>(&attacked, orthogonal, empty);
+    AddRay<0, 1>(&attacked, orthogonal, empty);
+    AddRay<0, -1>(&attacked, orthogonal, empty);
+    AddRay<1, 1>(&attacked, diagonal, empty);
+    AddRay<1, -1>(&attacked, diagonal, empty);
+    AddRay<-1, 1>(&attacked, diagonal, empty);
+    AddRay<-1, -1>(&attacked, diagonal, empty);
+    AddNeighbours(&flights, mated_king);
+    flights &= ~(mated_figures | attacked);
+    V check(attacked & mated_king);
+    // With vectors, the comparisons are lane masks (pcmpeqq of SSE4.1)
+    V may_be_mate(static_cast<V>((check != 0) & (flights == 0)));
+    Store(&lanes->check_[i], check);
+    Store(&lanes->flights_[i], flights);
+    Store(&lanes->may_be_mate_[i], may_be_mate);
+  }
+}
+
+typedef void (*KernelFunction)(FlightBatch::Lanes *lanes, std::size_t size,
+    bool white);
+
+void ScalarKernel(FlightBatch::Lanes *lanes, std::size_t size, bool white) {
+  Kernel<std::uint64_t>(lanes, size, white);
+}
+
+#ifdef HAVE_SIMD
+typedef std::uint64_t Vector2 __attribute__((vector_size(16)));
+typedef std::uint64_t Vector4 __attribute__((vector_size(32)));
+
+__attribute__((target("sse4.1"))) void Sse4Kernel(FlightBatch::Lanes *lanes,
+    std::size_t size, bool white) {
+  Kernel<Vector2>(lanes, size, white);
+}
+
+__attribute__((target("avx2"))) void Avx2Kernel(FlightBatch::Lanes *lanes,
+    std::size_t size, bool white) {
+  Kernel<Vector4>(lanes, size, white);
+}
+#endif
+
+// The kernels supported by the processor
+class Kernels {
+ public:
+  bool sse4_, avx2_;
+
+  Kernels() {
+#ifdef HAVE_SIMD
+    __builtin_cpu_init();
+    sse4_ = (__builtin_cpu_supports("sse4.1") != 0);
+    avx2_ = (__builtin_cpu_supports("avx2") != 0);
+#else
+    sse4_ = avx2_ = false;
+#endif
+  }
+
+  ATTRIBUTE_NODISCARD KernelFunction Function(FlightBatch::Kernel kernel)
+      const {
+    switch (kernel) {
+#ifdef HAVE_SIMD
+      case FlightBatch::kSse4:
+        return &Sse4Kernel;
+      case FlightBatch::kAvx2:
+        return &Avx2Kernel;
+#endif
+      default:
+        return &ScalarKernel;
+    }
+  }
+};
+
+const Kernels kernels;
+
+}  // namespace
+
+bool FlightBatch::Supported(Kernel kernel) {
+  switch (kernel) {
+    case kSse4:
+      return kernels.sse4_;
+    case kAvx2:
+      return kernels.avx2_;
+    default:
+      return true;
+  }
+}
+
+FlightBatch::Kernel FlightBatch::Best() {
+  return (kernels.avx2_ ? kAvx2 : (kernels.sse4_ ? kSse4 : kScalar));
+}
+
+FlightBatch::Masks::Masks() {
+  constexpr const std::uint64_t kAll = ~std::uint64_t(0);
+  for (bool white : {false, true}) {
+    std::array<Board, chess::kMaxFigure + 1>& masks(masks_[white ? 1 : 0]);
+    Figure color(white ? chess::kWhite : chess::kBlack);
+    for (std::size_t i(0); i != masks.size(); ++i) {
+      Board& mask(masks[i]);
+      mask = Board();
+      Figure figure(static_cast<Figure>(i));
+      Figure uncolored(chess::UncoloredFigure(figure));
+      if (uncolored == chess::kEmpty) {
+        continue;
+      }
+      if (chess::FigureColor(figure) != color) {
+        if (uncolored == chess::kKing) {
+          mask.mated_king_ = kAll;
+        } else {
+          mask.mated_figures_ = mask.occupied_ = kAll;
+        }
+        continue;
+      }
+      mask.occupied_ = kAll;
+      switch (uncolored) {
+        case chess::kPawn:
+          mask.pawns_ = kAll;
+          break;
+        case chess::kKnight:
+          mask.knights_ = kAll;
+          break;
+        case chess::kBishop:
+          mask.diagonal_ = kAll;
+          break;
+        case chess::kRook:
+          mask.orthogonal_ = kAll;
+          break;
+        case chess::kQueen:
+          mask.diagonal_ = mask.orthogonal_ = kAll;
+          break;
+        default:
+        // case chess::kKing:
+          mask.king_ = kAll;
+          break;
+      }
+    }
+  }
+}
+
+const FlightBatch::Masks FlightBatch::masks_;
+
+inline void FlightBatch::FlipFigure(Board *board, const Board& mask,
+    std::uint64_t bits) {
+  board->occupied_ ^= (mask.occupied_ & bits);
+  board->orthogonal_ ^= (mask.orthogonal_ & bits);
+  board->diagonal_ ^= (mask.diagonal_ & bits);
+  board->knights_ ^= (mask.knights_ & bits);
+  board->pawns_ ^= (mask.pawns_ & bits);
+  board->king_ ^= (mask.king_ & bits);
+  board->mated_king_ ^= (mask.mated_king_ & bits);
+  board->mated_figures_ ^= (mask.mated_figures_ & bits);
+}
+
+void FlightBatch::SetPosition(const Field *field) {
+  field_ = field;
+  white_ = (field->get_color() == chess::kWhite);
+  mask_ = &masks_.masks_[white_ ? 1 : 0];
+  board_ = Board();
+  for (Figure color : {chess::kWhite, chess::kBlack}) {
+    for (Pos pos : field->GetPosList(color)) {
+      FlipFigure(&board_, GetMask(field->GetFigure(pos)), Bit(pos));
+    }
+  }
+  assert(board_.mated_king_ != 0);
+  size_ = 0;
+}
+
+void FlightBatch::Add(const chess::Move *my_move) {
+  assert((field_ != nullptr) && !full());
+  Board board(board_);
+  Pos from(my_move->from_), to(my_move->to_);
+  Figure figure(field_->GetFigure(from)), color(chess::FigureColor(figure));
+  switch (my_move->move_type_) {
+    case chess::Move::kShortCastling:
+    case chess::Move::kLongCastling: {
+        // The king moves two fields towards the rook at to
+        chess::PosDelta dir(
+          (my_move->move_type_ == chess::Move::kShortCastling) ?
+          Field::kRight : Field::kLeft);
+        Pos rook(chess::AddDelta(from, dir));
+        FlipFigure(&board, GetMask(figure),
+          Bit(from) | Bit(chess::AddDelta(rook, dir)));
+        FlipFigure(&board, GetMask(chess::ColoredFigure(chess::kRook, color)),
+          Bit(to) | Bit(rook));
+      }
+      break;
+    case chess::Move::kEnPassant:
+      FlipFigure(&board, GetMask(chess::InvertColor(figure)),
+        Bit(chess::AddDelta(to, white_ ? Field::kDown : Field::kUp)));
+      FlipFigure(&board, GetMask(figure), Bit(from) | Bit(to));
+      break;
+    default: {
+        // A capture flips the figure at to, and a promotion the pawn
+        std::uint64_t to_bit(Bit(to));
+        FlipFigure(&board, GetMask(field_->GetFigure(to)), to_bit);
+        FlipFigure(&board, GetMask(figure), Bit(from));
+        switch (my_move->move_type_) {
+          case chess::Move::kQueen:
+            figure = chess::ColoredFigure(chess::kQueen, color);
+            break;
+          case chess::Move::kKnight:
+            figure = chess::ColoredFigure(chess::kKnight, color);
+            break;
+          case chess::Move::kRook:
+            figure = chess::ColoredFigure(chess::kRook, color);
+            break;
+          case chess::Move::kBishop:
+            figure = chess::ColoredFigure(chess::kBishop, color);
+            break;
+          default:
+            break;
+        }
+        FlipFigure(&board, GetMask(figure), to_bit);
+      }
+      break;
+  }
+  std::size_t i(size_);
+  lanes_.occupied_[i] = board.occupied_;
+  lanes_.orthogonal_[i] = board.orthogonal_;
+  lanes_.diagonal_[i] = board.diagonal_;
+  lanes_.knights_[i] = board.knights_;
+  lanes_.pawns_[i] = board.pawns_;
+  lanes_.king_[i] = board.king_;
+  lanes_.mated_king_[i] = board.mated_king_;
+  lanes_.mated_figures_[i] = board.mated_figures_;
+  moves_[i] = my_move;
+  ++size_;
+}
+
+void FlightBatch::Test(Kernel kernel) {
+  assert(Supported(kernel));
+  // The vector kernels process also the lanes after size_
+  for (std::size_t i(size_); i != kSize; ++i) {
+    lanes_.occupied_[i] = lanes_.orthogonal_[i] = lanes_.diagonal_[i] =
+      lanes_.knights_[i] = lanes_.pawns_[i] = lanes_.king_[i] =
+      lanes_.mated_king_[i] = lanes_.mated_figures_[i] = 0;
+  }
+  (*kernels.Function((kernel == kAuto) ? Best() : kernel))(&lanes_, size_,
+    white_);
+}
+
+bool FlightBatch::Verify() {
+  Lanes::Lane check(lanes_.check_), flights(lanes_.flights_),
+    may_be_mate(lanes_.may_be_mate_);
+  bool same(true);
+  for (Kernel kernel : {kScalar, kSse4, kAvx2}) {
+    if (!Supported(kernel)) {
+      continue;
+    }
+    Test(kernel);
+    for (std::size_t i(0); i != size_; ++i) {
+      if ((lanes_.check_[i] != check[i]) ||
+        (lanes_.flights_[i] != flights[i]) ||
+        ((lanes_.may_be_mate_[i] != 0) != (may_be_mate[i] != 0))) {
+        same = false;
+      }
+    }
+  }
+  return same;
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,174 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_FLIGHTS_H_
+#define CHESSPROBLEM_FLIGHTS_H_ 1
+
+#include <config.h>
+
+#include <array>
+#include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+A batched test of the flight fields of the mated king at the last half move.
+
+The positions after several moves of the party on move are stored as
+bitboards, and for all of them at once the fields attacked by that party
+are calculated (the long range figures by occluded fills, with the mated
+king removed from the board). From these, the kernel derives whether the
+mated king is in check and whether it has a flight field, i.e. a neighbour
+field which is neither occupied by a figure of its own nor attacked.
+
+A king with a flight field can move, so the position is not mate. Thus, of
+the positions in check, only those without a flight field need the full
+test chess::Field::IsCheckMate(); for the others the result is the same
+without pushing the move at all.
+
+The kernel uses AVX2 (4 positions at once) or SSE4.1 (2 positions at once)
+if HAVE_SIMD is defined and the processor supports it; otherwise it falls
+back to scalar code with the same results.
+
+This class is not thread-safe.
+*/
+
+class FlightBatch {
+ public:
+  // The implementations of the kernel; kAuto is the fastest supported one
+  enum Kernel { kAuto, kScalar, kSse4, kAvx2 };
+
+  // The number of positions which are tested at once
+  constexpr static const std::size_t kSize = 4;
+
+  FlightBatch() : field_(nullptr), white_(true), mask_(nullptr), size_(0) {
+  }
+
+  // Whether the processor supports kernel
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE static bool Supported(Kernel kernel);
+
+  // The kernel which kAuto selects
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE static Kernel Best();
+
+  // Start a new batch for the moves of the party on move in field.
+  // field must remain unchanged until the batch is tested.
+  void SetPosition(const chess::Field *field);
+
+  ATTRIBUTE_NODISCARD std::size_t size() const {
+    return size_;
+  }
+
+  ATTRIBUTE_NODISCARD bool empty() const {
+    return (size_ == 0);
+  }
+
+  ATTRIBUTE_NODISCARD bool full() const {
+    return (size_ == kSize);
+  }
+
+  // Remove the moves, keeping the position
+  void clear() {
+    size_ = 0;
+  }
+
+  // Add the (valid) move my_move which must remain valid until clear()
+  ATTRIBUTE_NONNULL_ void Add(const chess::Move *my_move);
+
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE const chess::Move *get_move(
+      std::size_t i) const {
+    assert(i < size_);
+    return moves_[i];
+  }
+
+  // Test the positions after the moves with kernel which must be supported
+  void Test(Kernel kernel);
+
+  // Whether all supported kernels give the same results as the last Test()
+  ATTRIBUTE_NODISCARD bool Verify();
+
+  // The results of Test() for the position after get_move(i)
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool IsCheck(std::size_t i) const {
+    assert(i < size_);
+    return (lanes_.check_[i] != 0);
+  }
+
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool HasFlight(std::size_t i) const {
+    assert(i < size_);
+    return (lanes_.flights_[i] != 0);
+  }
+
+  // Whether the position after get_move(i) might be mate, i.e. it is check
+  // and the king has no flight field
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool MayBeMate(std::size_t i) const {
+    assert(i < size_);
+    return (lanes_.may_be_mate_[i] != 0);
+  }
+
+  // The boards of the batch (one per lane) and the results of the kernel.
+  // The same bitboard of consecutive boards can be loaded at once. See
+  // Board for the meaning of the bitboards.
+  class Lanes {
+   public:
+    typedef std::array<std::uint64_t, kSize> Lane;
+
+    Lane occupied_, orthogonal_, diagonal_, knights_, pawns_, king_,
+      mated_king_, mated_figures_;
+    Lane check_, flights_, may_be_mate_;
+  };
+
+ private:
+  // The bitboards of a position: The figures of the party on move
+  // (orthogonal_ and diagonal_ are the long range figures moving in these
+  // directions), the fields occupied by all figures except for the mated
+  // king, and the mated king and its figures
+  class Board {
+   public:
+    std::uint64_t occupied_, orthogonal_, diagonal_, knights_, pawns_,
+      king_, mated_king_, mated_figures_;
+  };
+
+  // For the party on move (indexed by white) and each colored figure: The
+  // bitboards of Board which contain the figure have all bits set, the
+  // others are 0. Thus, the figure is flipped at some fields by FlipFigure().
+  class Masks {
+   public:
+    std::array<std::array<Board, chess::kMaxFigure + 1>, 2> masks_;
+
+    Masks();
+  };
+
+  static const Masks masks_;
+
+  const chess::Field *field_;
+
+  // The board before the moves, whether white is on move, and the row of
+  // masks_ for the party on move
+  Board board_;
+  bool white_;
+  const std::array<Board, chess::kMaxFigure + 1> *mask_;
+
+  std::size_t size_;
+  std::array<const chess::Move *, kSize> moves_;
+  Lanes lanes_;
+
+  // Add or remove a figure with the given mask at the fields of bits
+  ATTRIBUTE_NONNULL_ static void FlipFigure(Board *board, const Board& mask,
+      std::uint64_t bits);
+
+  ATTRIBUTE_NODISCARD const Board& GetMask(chess::Figure figure) const {
+    return (*mask_)[figure];
+  }
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_FLIGHTS_H_
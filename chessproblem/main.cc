@@ -9,7 +9,9 @@
 
 #include <unistd.h>  // getopt
 
-#include <cstdlib>  // atoi, exit
+#include <cstddef>  // size_t
+#include <cstdlib>  // exit
+#include <cstdint>
 #include <cstdio>  // stderr, stdout
 
 #include <iostream>  // cin, getline
@@ -20,12 +22,20 @@
 
 #include "chessproblem/chess.h"
 #include "chessproblem/chessproblem.h"
+#include "chessproblem/flights.h"
 #include "chessproblem/m_attribute.h"
 #include "chessproblem/m_likely.h"
+#include "chessproblem/parse.h"
+#include "chessproblem/perft.h"
+#include "chessproblem/timer.h"
 
 using std::string;
 using std::vector;
 
+using chessproblem::CheckNum;
+using chessproblem::PlaceFigures;
+using chessproblem::SplitString;
+
 class ChessProblemDemo : public ChessProblem {
   ATTRIBUTE_NONNULL_ bool Output(chess::Field *field) const override;
   ATTRIBUTE_NONNULL_ bool Progress(const chess::MoveList *moves,
@@ -45,12 +55,8 @@ class ChessProblemDemo : public ChessProblem {
 };
 
 static void Help();
-ATTRIBUTE_NONNULL_ static void PlaceFigures(ChessProblem *chessproblem,
-    chess::Figure color, const string &str);
-ATTRIBUTE_NONNULL_ static int CheckNum(const char *num,
-    int min_value, char c);
-ATTRIBUTE_NONNULL_ static void SplitString(vector<string> *res,
-    const string& str);
+ATTRIBUTE_NONNULL_ static int RunPerft(chess::Field *field, int half_moves,
+    bool divide, int max_parallel);
 
 static void Help() {
   osformat::Say("Usage: chessproblem [options] white-pieces black-pieces\n"
@@ -73,6 +79,29 @@ static void Help() {
 "-M X Mate in X moves (2X - 1 half moves)\n"
 "-S X Selfmate in X moves (2X half moves)\n"
 "-H X Helpmate in X moves (2X half moves)\n"
+"-N X Instead of solving, count the leaves of all lines of X half moves\n"
+"     (perft) and output the nodes per second. With -j, the first moves\n"
+"     are distributed among the threads.\n"
+"-D   With -N: Output also the count for each first move (divide)\n"
+"-t X For mate: Try first the shortest threat of at most X moves against\n"
+"     each defense. Default value is 0 (no threat analysis).\n"
+"-d   Iterative deepening: Search with increasing number of moves and print\n"
+"     the number of moves of each solution. For mate and selfmate, each first\n"
+"     move is printed only with its shortest solution.\n"
+"-a X Use algorithm X: \"minmax\" (default), \"pn\" (proof-number search\n"
+"     for mate and selfmate; single-threaded), \"mitm\" (meet in the\n"
+"     middle for helpmate; single-threaded), or \"bfs\" (breadth-first\n"
+"     search with temporary files for helpmate)\n"
+"-T X Use X MB for the transposition table of -apn or for the memory of\n"
+"     -abfs before using temporary files. Default value is %s.\n"
+"-B X For mate: Use depth-to-mate tables for KQK, KRK, KBNK, and KPK in the\n"
+"     directory X. Missing tables are generated and written there.\n"
+"-C   Copy-make: Restore the position from a copy of each ply instead of\n"
+"     undoing the moves (only for benchmarking)\n"
+"-L X Test the flight fields of the mated king at the last half move with\n"
+"     X: \"auto\" (default: the fastest kernel the processor supports),\n"
+"     \"scalar\", \"sse4\", \"avx2\", or \"verify\" (compare all kernels\n"
+"     with the full mate test; only for testing)\n"
 "-n X Print at most X solutions. Default value is 2. X=0 means to print all.\n"
 "-c X Exclude certain castling. X is the field (or list of fields,\n"
 "     separated by commas) of relevant figures which had been moved.\n"
@@ -92,24 +121,28 @@ static void Help() {
 #ifndef NO_CHESSPROBLEM_THREADS
 (osformat::Format(" (default is %s)") % ChessProblemDemo::kMaxParallelDefault)
 % (osformat::Format(" (default is %s)") %
-  ChessProblemDemo::kMinHalfMovesDepthDefault);
+  ChessProblemDemo::kMinHalfMovesDepthDefault)
 #else
 " (ignored:\n"
 "     program is compiled without threading support)" %
 " (ignored:\n"
-"     program is compiled without threading support)";
+"     program is compiled without threading support)"
 #endif
+% ChessProblemDemo::kTableMegabytesDefault;
 }
 
 int main(int argc, char **argv) {
   char eparg('\0');
   chess::Castling castling(chess::kAllCastling);
   ChessProblemDemo chessproblem(2);
-  bool get_stdin(false), quiet(false);
+  bool get_stdin(false), quiet(false), divide(false);
+  int perft(-1);
   int max_parallel(0);
   enum { kStdout, kStderr, kNone } output_initial = kStdout;
   int opt;
-  while ((opt = getopt(argc, argv, "pPij:J:m:M:s:S:H:n:c:e:bwqQvVh")) != -1) {
+  while ((opt = getopt(argc, argv,
+    "pPij:J:m:M:s:S:H:N:Dt:da:T:B:CL:"
+    "n:c:e:bwqQvVh")) != -1) {
     switch (opt) {
       case 'p':
         chessproblem.progress_io_ = stdout;
@@ -140,6 +173,66 @@ int main(int argc, char **argv) {
         chessproblem.set_mode(ChessProblem::kHelpMate,
           CheckNum(optarg, 1, 'h'));
         break;
+      case 'N':
+        perft = CheckNum(optarg, 0, 'N');
+        break;
+      case 'D':
+        divide = true;
+        break;
+      case 't':
+        chessproblem.set_threat_moves(CheckNum(optarg, 0, 't'));
+        break;
+      case 'd':
+        chessproblem.set_iterative_deepening(true);
+        break;
+      case 'a':
+        if (string(optarg) == "minmax") {
+          chessproblem.set_strategy(ChessProblem::kMinMax);
+        } else if (string(optarg) == "pn") {
+          chessproblem.set_strategy(ChessProblem::kProofNumber);
+        } else if (string(optarg) == "mitm") {
+          chessproblem.set_strategy(ChessProblem::kMeetInTheMiddle);
+        } else if (string(optarg) == "bfs") {
+          chessproblem.set_strategy(ChessProblem::kBreadthFirst);
+        } else {
+          osformat::SayError("Argument %s of -a is not understood") % optarg;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+      case 'T':
+        chessproblem.set_table_megabytes(static_cast<std::size_t>(
+          CheckNum(optarg, 1, 'T')));
+        break;
+      case 'B':
+        chessproblem.set_tablebase_directory(optarg);
+        break;
+      case 'C':
+        chessproblem.set_copy_make(true);
+        break;
+      case 'L': {
+          string kernel(optarg);
+          chessproblem::FlightBatch::Kernel flight_kernel;
+          if ((kernel == "auto") || (kernel == "verify")) {
+            flight_kernel = chessproblem::FlightBatch::kAuto;
+          } else if (kernel == "scalar") {
+            flight_kernel = chessproblem::FlightBatch::kScalar;
+          } else if (kernel == "sse4") {
+            flight_kernel = chessproblem::FlightBatch::kSse4;
+          } else if (kernel == "avx2") {
+            flight_kernel = chessproblem::FlightBatch::kAvx2;
+          } else {
+            osformat::SayError("Argument %s of -L is not understood") %
+              optarg;
+            std::exit(EXIT_FAILURE);
+          }
+          if (!chessproblem::FlightBatch::Supported(flight_kernel)) {
+            osformat::SayError("Kernel %s of -L is not supported") % optarg;
+            std::exit(EXIT_FAILURE);
+          }
+          chessproblem.set_flight_kernel(flight_kernel);
+          chessproblem.set_verify_flights(kernel == "verify");
+        }
+        break;
       case 'n':
         chessproblem.max_solutions_ = CheckNum(optarg, 0, 'n');
         break;
@@ -193,7 +286,9 @@ int main(int argc, char **argv) {
         output_initial = kStderr;
         break;
       case 'v':
+        // The lists of moves on all levels are needed for the output
         chessproblem.verbose = true;
+        chessproblem.set_staged_generation(false);
         break;
       case 'V':
         osformat::Say("%s %s") % PACKAGE_NAME % PACKAGE_VERSION;
@@ -208,9 +303,9 @@ int main(int argc, char **argv) {
         break;
     }
   }
-  if (chessproblem.get_mode() == ChessProblem::kUnknown) {
-    osformat::SayError("One of the options -M, -S, or -H has to be specified\n"
-      "Use option -h for help");
+  if ((perft < 0) && (chessproblem.get_mode() == ChessProblem::kUnknown)) {
+    osformat::SayError("One of the options -M, -S, -H, or -N has to be "
+      "specified\nUse option -h for help");
     std::exit(EXIT_FAILURE);
   }
   if (max_parallel > 0) {
@@ -222,7 +317,11 @@ int main(int argc, char **argv) {
       }
     }
   }
-  chessproblem.set_color();
+  if (chessproblem.get_mode() != ChessProblem::kUnknown) {
+    chessproblem.set_color();
+  } else if (!chessproblem.have_color()) {
+    chessproblem.set_color(chess::kWhite);
+  }
   chess::EnPassant ep(chess::kNoEnPassant);
   if (eparg != '\0') {
     ep = chess::Field::CalcPos(eparg,
@@ -239,8 +338,10 @@ int main(int argc, char **argv) {
       osformat::SayError("With option -i no arguments must be specified");
       std::exit(EXIT_FAILURE);
     }
-    PlaceFigures(&chessproblem, chess::kWhite, argv[optind]);
-    PlaceFigures(&chessproblem, chess::kBlack, argv[optind + 1]);
+    if (!PlaceFigures(&chessproblem, chess::kWhite, argv[optind]) ||
+      !PlaceFigures(&chessproblem, chess::kBlack, argv[optind + 1])) {
+      std::exit(EXIT_FAILURE);
+    }
   } else {
     if (!get_stdin) {
       osformat::Say("Enter the white position in chess notation:");
@@ -250,7 +351,9 @@ int main(int argc, char **argv) {
     }
     string line;
     std::getline(std::cin, line);
-    PlaceFigures(&chessproblem, chess::kWhite, line);
+    if (!PlaceFigures(&chessproblem, chess::kWhite, line)) {
+      std::exit(EXIT_FAILURE);
+    }
     if (!get_stdin) {
       osformat::Say("Enter the black position in chess notation:");
     }
@@ -258,7 +361,9 @@ int main(int argc, char **argv) {
       std::exit(EXIT_FAILURE);
     }
     std::getline(std::cin, line);
-    PlaceFigures(&chessproblem, chess::kBlack, line);
+    if (!PlaceFigures(&chessproblem, chess::kBlack, line)) {
+      std::exit(EXIT_FAILURE);
+    }
   }
   if (!chessproblem.HaveKings()) {
     osformat::SayError("There are not white and black kings on the board");
@@ -291,75 +396,59 @@ int main(int argc, char **argv) {
     osformat::Format((output_initial == kStderr) ? stderr : stdout,
       osformat::Special::Newline()) % chessproblem;
   }
+  if (perft >= 0) {
+    return RunPerft(&chessproblem, perft, divide,
+      chessproblem.get_max_parallel());
+  }
   int num(chessproblem.Solve());
   if (num == 0) {
     osformat::Say("No solution exists");
   }
-  return (num == 1) ? EXIT_SUCCESS : EXIT_FAILURE;
-}
-
-static void PlaceFigures(ChessProblem *chessproblem, chess::Figure color,
-    const string &str) {
-  vector<string> figures;
-  SplitString(&figures, str);
-  if (figures.empty()) {
-    osformat::SayError("No figures of color %s specified")
-      % chess::color_name[color];
-    std::exit(EXIT_FAILURE);
-  }
-  for (auto s : figures) {
-    chess::Figure figure(chess::kNoFigure);
-    chess::Pos pos(chess::Field::kFieldEnd);
-    if (s.length() == 2) {
-      figure = chess::kPawn;
-      pos = chess::Field::CalcPos(s);
-    } else if (s.length() == 3) {
-      figure = chess::FigureValue(s[0]);
-      pos = chess::Field::CalcPos(s.substr(1));
-    }
-    if ((figure == chess::kNoFigure) || (pos == chess::Field::kFieldEnd)) {
-      osformat::SayError("Figure or placement not understood: %s") % s;
-      std::exit(EXIT_FAILURE);
-    }
-    if (chessproblem->GetFigure(pos) != chess::kEmpty) {
-      osformat::SayError("Figure was already on this field: %s") % s;
-      std::exit(EXIT_FAILURE);
-    }
-    chessproblem->PlaceFigure(chess::ColoredFigure(figure, color), pos);
-  }
-}
-
-static int CheckNum(const char *num, int min_value, char c) {
-  int ret(std::atoi(num));
-  if (ret < min_value) {
-    osformat::SayError("Argument %s of -%s should be at least %d")
-      % num
-      % c
-      % min_value;
-    std::exit(EXIT_FAILURE);
+  if (chessproblem.get_flight_errors() != 0) {
+    // On stdout, so that contrib/test.pl reports an unexpected result
+    osformat::Say("Flight test differs: %s") %
+      chessproblem.get_flight_errors();
+    return EXIT_FAILURE;
   }
-  return ret;
+  return (num == 1) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-static void SplitString(vector<string> *res, const string& str) {
-  string::size_type last_pos(0);
-  for (string::size_type pos(0);
-      (pos = str.find_first_of("\t\r\n ,.:;!?_-", pos)) != string::npos;
-      last_pos = ++pos) {
-    if (pos > last_pos) {
-      res->emplace_back(str, last_pos, pos - last_pos);
-    }
+static int RunPerft(chess::Field *field, int half_moves, bool divide,
+    int max_parallel) {
+  chessproblem::Perft perft(max_parallel);
+  vector<chessproblem::Perft::Divide> first_moves;
+  std::uint64_t start(chessproblem::Nanoseconds());
+  std::uint64_t leaves(perft.Count(field, half_moves,
+    divide ? &first_moves : nullptr));
+  std::uint64_t microseconds((chessproblem::Nanoseconds() - start) / 1000);
+  for (const auto& entry : first_moves) {
+    osformat::Say("%s: %s") % field->str(entry.move_) % entry.leaves_;
   }
-  if (str.size() > last_pos) {
-    res->emplace_back(str, last_pos);
+  if (microseconds == 0) {
+    microseconds = 1;
   }
+  osformat::Say("Nodes: %s\nTime: %s ms\nNodes/s: %s")
+    % leaves
+    % (microseconds / 1000)
+    % static_cast<std::uint64_t>(static_cast<double>(leaves) * 1000000 /
+      static_cast<double>(microseconds));
+  return EXIT_SUCCESS;
 }
 
 bool ChessProblemDemo::Output(chess::Field *field) const {
   auto num = get_num_solutions_found();
-  osformat::Say("Solution %s: %s")
-    % num
-    % field->get_move_stack();
+  if (get_iterative_deepening()) {
+    int half_moves(get_solution_half_moves());
+    osformat::Say("Solution %s (in %s moves%s): %s")
+      % num
+      % ((get_mode() == kMate) ? ((half_moves + 1) / 2) : (half_moves / 2))
+      % ((half_moves < get_half_moves()) ? ", short" : "")
+      % field->get_move_stack();
+  } else {
+    osformat::Say("Solution %s: %s")
+      % num
+      % field->get_move_stack();
+  }
   return ((max_solutions_ == 0) || (num < max_solutions_));
 }
 
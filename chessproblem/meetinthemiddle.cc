@@ -0,0 +1,800 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/meetinthemiddle.h"
+#include <config.h>
+
+#include <algorithm>  // min, stable_sort
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <unordered_map>
+#include <utility>  // move
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+#include "chessproblem/m_likely.h"
+
+namespace chessproblem {
+
+using chess::Field;
+using chess::Figure;
+using chess::Pos;
+using chess::PosDelta;
+
+namespace {
+
+// The bounds for the nodes which the enumeration of the mates and the
+// backward expansion may use before the second half is searched forward
+constexpr const std::uint64_t
+  kMinWork = std::uint64_t(1) << 16,
+  kMaxWork = std::uint64_t(1) << 22;
+
+// The branching factor assumed if no position of the first half is expanded
+constexpr const std::uint64_t kBranching = 32;
+
+constexpr const int kUnreachable = 255;
+
+bool OnBoard(Pos pos) {
+  return ((pos >= Field::kFieldStart) && (pos < Field::kFieldEnd) &&
+    ((pos - Field::kFieldStart) % (Field::kColumns + 2) < Field::kColumns));
+}
+
+int Column(Pos pos) {
+  return static_cast<int>((pos - Field::kFieldStart) % (Field::kColumns + 2));
+}
+
+// The row as seen from color
+int Row(Pos pos, Figure color) {
+  int row(static_cast<int>((pos - Field::kFieldStart) /
+    (Field::kColumns + 2)));
+  return ((color == chess::kWhite) ? row :
+    (static_cast<int>(Field::kRows) - 1 - row));
+}
+
+// The number of moves which a pawn of color needs on an empty board from
+// from to to (without transformation), and in *hits the number of hits
+int PawnMoves(Pos from, Pos to, Figure color, int *hits) {
+  int row(Row(from, color));
+  int rows(Row(to, color) - row);
+  int columns(Column(to) - Column(from));
+  if (columns < 0) {
+    columns = -columns;
+  }
+  if (rows < columns) {
+    return kUnreachable;
+  }
+  *hits = columns;
+  // The double move cannot hit
+  return (((row == 1) && (rows - columns >= 2)) ? (rows - 1) : rows);
+}
+
+class MoveDistances {
+ public:
+  constexpr static const Pos
+    kSquares = Field::kColumns * Field::kRows;
+  enum Type {
+    kTypeKing, kTypeKnight, kTypeBishop, kTypeRook, kTypeQueen, kTypes
+  };
+
+  MoveDistances();
+
+  // The number of moves which figure (not a pawn) needs on an empty board
+  // from from to to
+  int Distance(Figure figure, Pos from, Pos to) const {
+    return distance_[FigureType(figure)][Square(from)][Square(to)];
+  }
+
+ private:
+  // distance_[type][from][to]
+  unsigned char distance_[kTypes][kSquares][kSquares];
+
+  static Pos Square(Pos pos) {
+    return static_cast<Pos>(Row(pos, chess::kWhite)) * Field::kColumns +
+      static_cast<Pos>(Column(pos));
+  }
+
+  static Type FigureType(Figure figure) {
+    switch (chess::UncoloredFigure(figure)) {
+      case chess::kKnight:
+        return kTypeKnight;
+      case chess::kBishop:
+        return kTypeBishop;
+      case chess::kRook:
+        return kTypeRook;
+      case chess::kQueen:
+        return kTypeQueen;
+      default:
+        return kTypeKing;
+    }
+  }
+};
+
+const Pos MoveDistances::kSquares;
+
+MoveDistances::MoveDistances() {
+  std::vector<Pos> queue;
+  for (int type(0); type != kTypes; ++type) {
+    const PosDelta *deltas(Field::king_deltas);
+    int num_deltas(8);
+    bool long_move(false);
+    switch (type) {
+      case kTypeKnight:
+        deltas = Field::knight_deltas;
+        break;
+      case kTypeBishop:
+        deltas = Field::bishop_deltas;
+        num_deltas = 4;
+        long_move = true;
+        break;
+      case kTypeRook:
+        deltas = Field::rook_deltas;
+        num_deltas = 4;
+        long_move = true;
+        break;
+      case kTypeQueen:
+        long_move = true;
+        break;
+      default:
+        break;
+    }
+    for (Pos start(Field::kFieldStart); start != Field::kFieldEnd; ++start) {
+      if (!OnBoard(start)) {
+        continue;
+      }
+      unsigned char (&distance)[kSquares] = distance_[type][Square(start)];
+      std::fill(distance, distance + kSquares,
+        static_cast<unsigned char>(kUnreachable));
+      distance[Square(start)] = 0;
+      queue.assign(1, start);
+      for (std::vector<Pos>::size_type i(0); i != queue.size(); ++i) {
+        Pos pos(queue[i]);
+        unsigned char next(static_cast<unsigned char>(
+          distance[Square(pos)] + 1));
+        for (int j(0); j != num_deltas; ++j) {
+          for (Pos to(chess::AddDelta(pos, deltas[j])); OnBoard(to);
+            to = chess::AddDelta(to, deltas[j])) {
+            if (distance[Square(to)] == kUnreachable) {
+              distance[Square(to)] = next;
+              queue.push_back(to);
+            }
+            if (!long_move) {
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+const MoveDistances move_distances;
+
+// The castling rights with the initial fields of king and rook and the
+// fields of king and rook after castling
+class CastlingFields {
+ public:
+  chess::Castling castling_;
+  Pos king_, rook_, castled_king_, castled_rook_;
+};
+
+const CastlingFields castling_fields[4] = {
+  { chess::kWhiteShortCastling, Field::kPosWhiteKing,
+    Field::kPosWhiteShortRook, Field::kPosWhiteKing + 2,
+    Field::kPosWhiteKing + 1 },
+  { chess::kWhiteLongCastling, Field::kPosWhiteKing,
+    Field::kPosWhiteLongRook, Field::kPosWhiteKing - 2,
+    Field::kPosWhiteKing - 1 },
+  { chess::kBlackShortCastling, Field::kPosBlackKing,
+    Field::kPosBlackShortRook, Field::kPosBlackKing + 2,
+    Field::kPosBlackKing + 1 },
+  { chess::kBlackLongCastling, Field::kPosBlackKing,
+    Field::kPosBlackLongRook, Field::kPosBlackKing - 2,
+    Field::kPosBlackKing - 1 }
+};
+
+}  // namespace
+
+std::size_t MeetInTheMiddle::KeyHash::operator()(const Key& key) const {
+  // FNV-1a
+  std::uint64_t hash(0xCBF29CE484222325U);
+  for (unsigned char c : key) {
+    hash = (hash ^ c) * 0x100000001B3U;
+  }
+  return static_cast<std::size_t>(hash);
+}
+
+void MeetInTheMiddle::Solve(chess::Field *field, int half_moves,
+    chess::Figure mating_color, std::vector<chess::MoveList> *solutions) {
+  field_ = field;
+  half_moves_ = half_moves;
+  middle_ = half_moves / 2;
+  mating_color_ = mating_color;
+  visited_.assign(static_cast<std::size_t>(middle_ + 1),
+    std::unordered_map<chess::Hash, Node>());
+  expanded_ = generated_ = 0;
+  forward_ = (field->GetPosList(chess::kWhite).size() +
+    field->GetPosList(chess::kBlack).size() > Field::kPackedFigures);
+  Forward(0, nullptr);
+  if (!forward_ && !Backward()) {
+    // Too many mates: Search the second half forward
+    layers_.clear();
+    middle_positions_.clear();
+    meetings_.clear();
+    visited_.assign(static_cast<std::size_t>(middle_ + 1),
+      std::unordered_map<chess::Hash, Node>());
+    forward_ = true;
+    Forward(0, nullptr);
+  }
+  layers_.clear();
+  middle_positions_.clear();
+  dead_.clear();
+  for (const auto& meeting : meetings_) {
+    Join(meeting.depth_, meeting.hash_, meeting, solutions);
+  }
+  meetings_.clear();
+  visited_.clear();
+}
+
+bool MeetInTheMiddle::Forward(int depth, const Link *link) {
+  ++nodes_;
+  chess::Hash hash(field_->get_hash());
+  auto inserted(visited_[static_cast<std::size_t>(depth)].emplace(hash,
+    Node()));
+  Node *node(&(inserted.first->second));
+  if (link != nullptr) {
+    node->links_.push_back(*link);
+  }
+  if (!inserted.second) {
+    // A transposition: The position was already expanded
+    return node->found_;
+  }
+  int remaining_half_moves(half_moves_ - depth);
+  bool found(false);
+  if (depth == middle_) {
+    if (forward_) {
+      Meeting meeting;
+      chess::MoveList line;
+      if (Continue(remaining_half_moves, &line, &meeting.mates_)) {
+        found = true;
+        meeting.depth_ = depth;
+        meeting.hash_ = hash;
+        meetings_.push_back(std::move(meeting));
+      }
+    } else if (LIKELY(field_->CanMate(mating_color_)) &&
+      LIKELY(!field_->HelpMateTooFar(mating_color_, remaining_half_moves))) {
+      // Whether a mate can be reached is decided by Backward()
+      Key key;
+      field_->Pack(key.data());
+      middle_positions_.emplace(key, hash);
+      found = true;
+    }
+  } else if (LIKELY(field_->CanMate(mating_color_)) &&
+    LIKELY(!field_->HelpMateTooFar(mating_color_, remaining_half_moves))) {
+    chess::MoveList moves;
+    if (LIKELY(field_->Generator(&moves))) {
+      ++expanded_;
+      generated_ += moves.size();
+      for (const auto& my_move : moves) {
+        Link next(hash, my_move);
+        chess::push_guard guard(field_, &my_move);
+        if (Forward(depth + 1, &next)) {
+          found = true;
+        }
+      }
+    } else if (((remaining_half_moves & 1) == 0) && field_->IsInCheck()) {
+      // An early mate, that is, a cook having less moves
+      found = true;
+      Meeting meeting;
+      meeting.depth_ = depth;
+      meeting.hash_ = hash;
+      meeting.mates_.emplace_back();
+      meetings_.push_back(std::move(meeting));
+    }
+  }
+  node->found_ = found;
+  return found;
+}
+
+bool MeetInTheMiddle::Continue(int remaining_half_moves,
+    chess::MoveList *line, std::vector<chess::MoveList> *mates) {
+  ++nodes_;
+  if (UNLIKELY(!field_->CanMate(mating_color_))) {
+    return false;
+  }
+  if (remaining_half_moves == 0) {
+    if (UNLIKELY(field_->IsCheckMate())) {
+      mates->push_back(*line);
+      return true;
+    }
+    return false;
+  }
+  if (UNLIKELY(field_->HelpMateTooFar(mating_color_, remaining_half_moves))) {
+    return false;
+  }
+  // Symmetric positions share the entries of dead_
+  chess::Hash key(field_->get_canonical_hash() ^
+    (static_cast<chess::Hash>(remaining_half_moves) * 0xD6E8FEB86659FD93U));
+  if (dead_.count(key) != 0) {
+    return false;
+  }
+  chess::MoveList moves;
+  bool found(false);
+  if (UNLIKELY(!field_->Generator(&moves))) {
+    // Early mate or stalemate
+    if (((remaining_half_moves & 1) == 0) && field_->IsInCheck()) {
+      mates->push_back(*line);
+      found = true;
+    }
+  } else {
+    for (const auto& my_move : moves) {
+      if ((remaining_half_moves == 1) && LIKELY(!field_->GivesCheck(my_move))) {
+        continue;
+      }
+      line->push_back(my_move);
+      {
+        chess::push_guard guard(field_, &my_move);
+        if (Continue(remaining_half_moves - 1, line, mates)) {
+          found = true;
+        }
+      }
+      line->pop_back();
+    }
+  }
+  if (!found) {
+    dead_.insert(key);
+  }
+  return found;
+}
+
+bool MeetInTheMiddle::Backward() {
+  if (middle_positions_.empty()) {
+    return true;
+  }
+  last_ = half_moves_ - middle_;
+  // The forward search of the second half needs about |middle| * b^(n - 1)
+  // nodes for the remaining n half moves (the last one only tests checks)
+  // where b is the average number of moves in the first half.
+  std::uint64_t branching(kBranching);
+  if (expanded_ != 0) {
+    branching = std::max<std::uint64_t>(2, generated_ / expanded_);
+  }
+  work_limit_ = middle_positions_.size();
+  for (int i(1); (i < last_) && (work_limit_ < kMaxWork); ++i) {
+    work_limit_ *= branching;
+  }
+  work_limit_ = std::min(std::max(work_limit_, kMinWork), kMaxWork);
+  work_ = 0;
+
+  first_ = field_->get_color();
+  castling_ = field_->get_castling();
+  Figure mated(chess::InvertColor(mating_color_));
+  for (Figure color : {chess::kWhite, chess::kBlack}) {
+    auto index(chess::Color2Index(color));
+    moves_[index] = Moves(color, half_moves_);
+    for (Figure figure(chess::kPawn); figure <= chess::kKing;
+      figure = static_cast<Figure>(figure + chess::kKnight - chess::kPawn)) {
+      figures_[index][figure] =
+        field_->CountFigures(chess::ColoredFigure(figure, color));
+    }
+  }
+  // The order of placement: The mated king, the king and the other figures
+  // of mating_color_, and the other figures of the mated party. Within the
+  // groups, the figures with less targets come first.
+  candidates_.assign(2, Candidate());
+  std::vector<Candidate> mating, blocking;
+  for (Figure color : {mating_color_, mated}) {
+    for (Pos pos : field_->GetPosList(color)) {
+      Candidate candidate;
+      CalcTargets(&candidate, pos);
+      if (candidate.king_) {
+        candidates_[(color == mated) ? 0 : 1] = std::move(candidate);
+      } else {
+        ((color == mated) ? blocking : mating).push_back(std::move(candidate));
+      }
+    }
+  }
+  for (auto& row : reach_) {
+    row.fill(static_cast<unsigned char>(kUnreachable));
+  }
+  for (const auto *group : {&candidates_, &mating, &blocking}) {
+    for (const auto& candidate : *group) {
+      for (const auto& target : candidate.targets_) {
+        if (target.figure_ != chess::kEmpty) {
+          unsigned char& reach = reach_[target.figure_][target.pos_];
+          reach = std::min(reach, static_cast<unsigned char>(target.moves_));
+        }
+      }
+    }
+  }
+  auto less_targets([](const Candidate& a, const Candidate& b) {
+    return (a.targets_.size() < b.targets_.size());
+  });
+  std::stable_sort(mating.begin(), mating.end(), less_targets);
+  std::stable_sort(blocking.begin(), blocking.end(), less_targets);
+  for (auto& candidate : mating) {
+    candidates_.push_back(std::move(candidate));
+  }
+  blockers_ = candidates_.size();
+  for (auto& candidate : blocking) {
+    candidates_.push_back(std::move(candidate));
+  }
+  moves_left_ = moves_;
+  captured_.fill(0);
+  hits_.fill(0);
+  board_.clear();
+  board_.set_color(mated);
+  board_.set_ep(chess::kNoEnPassant);
+  board_.set_castling(chess::kNoCastling);
+  layers_.assign(static_cast<std::size_t>(last_ + 1), Layer());
+  bool success(Place(0));
+  candidates_.clear();
+  if (!success) {
+    return false;
+  }
+
+  // Join the positions of the backward expansion with those in the middle.
+  // Only a distance of the same parity can have the same party on move.
+  for (int distance(last_); distance >= 0; distance -= 2) {
+    for (const auto& entry : layers_[static_cast<std::size_t>(distance)]) {
+      auto found(middle_positions_.find(entry.first));
+      if (found == middle_positions_.end()) {
+        continue;
+      }
+      Meeting meeting;
+      meeting.depth_ = middle_;
+      meeting.hash_ = found->second;
+      chess::MoveList line;
+      Mates(distance, entry.first, &line, &meeting.mates_);
+      meetings_.push_back(std::move(meeting));
+    }
+  }
+  return true;
+}
+
+void MeetInTheMiddle::CalcTargets(Candidate *candidate, Pos pos) const {
+  Figure figure(field_->GetFigure(pos));
+  Figure color(chess::FigureColor(figure));
+  Figure uncolored(chess::UncoloredFigure(figure));
+  int budget(moves_[chess::Color2Index(color)]);
+  candidate->color_ = color;
+  candidate->king_ = (uncolored == chess::kKing);
+  std::vector<Target>& targets = candidate->targets_;
+  if (!candidate->king_) {
+    targets.emplace_back(chess::kEmpty, Field::kNpos, 0, 0);
+  }
+  for (Pos to(Field::kFieldStart); to != Field::kFieldEnd; ++to) {
+    if (!OnBoard(to)) {
+      continue;
+    }
+    int hits(0);
+    int moves;
+    if (uncolored == chess::kPawn) {
+      int row(Row(to, color));
+      if (row == static_cast<int>(Field::kRows) - 1) {
+        continue;
+      }
+      moves = PawnMoves(pos, to, color, &hits);
+    } else {
+      moves = move_distances.Distance(figure, pos, to);
+      // A king or rook might have castled
+      for (const auto& fields : castling_fields) {
+        if (!chess::HaveCastling(castling_, fields.castling_)) {
+          continue;
+        }
+        if (pos == fields.king_) {
+          moves = std::min(moves, 1 +
+            move_distances.Distance(figure, fields.castled_king_, to));
+        } else if (pos == fields.rook_) {
+          // The castling move is counted for the king
+          moves = std::min(moves,
+            move_distances.Distance(figure, fields.castled_rook_, to));
+        }
+      }
+    }
+    if (moves <= budget) {
+      targets.emplace_back(figure, to, moves, hits);
+    }
+  }
+  if (uncolored == chess::kPawn) {
+    // The transformations: The pawn reaches a field of the last row first
+    for (Figure transformed(chess::kKnight); transformed != chess::kKing;
+      transformed = static_cast<Figure>(transformed + chess::kKnight -
+        chess::kPawn)) {
+      Figure colored(chess::ColoredFigure(transformed, color));
+      for (Pos to(Field::kFieldStart); to != Field::kFieldEnd; ++to) {
+        if (!OnBoard(to)) {
+          continue;
+        }
+        int moves(kUnreachable), hits(kUnreachable);
+        for (Pos last(Field::kFieldStart); last != Field::kFieldEnd; ++last) {
+          if (!OnBoard(last) ||
+            (Row(last, color) != static_cast<int>(Field::kRows) - 1)) {
+            continue;
+          }
+          int last_hits;
+          int last_moves(PawnMoves(pos, last, color, &last_hits));
+          if (last_moves == kUnreachable) {
+            continue;
+          }
+          moves = std::min(moves, last_moves +
+            move_distances.Distance(colored, last, to));
+          hits = std::min(hits, last_hits);
+        }
+        if (moves <= budget) {
+          targets.emplace_back(colored, to, moves, hits);
+        }
+      }
+    }
+  }
+  std::stable_sort(targets.begin(), targets.end(),
+    [](const Target& a, const Target& b) {
+      return (a.moves_ < b.moves_);
+    });
+}
+
+bool MeetInTheMiddle::Place(std::vector<Candidate>::size_type index) {
+  if (UNLIKELY(++work_ > work_limit_)) {
+    return false;
+  }
+  if (index >= blockers_) {
+    if ((index == blockers_) && !MateLikely()) {
+      return true;
+    }
+    // The flight fields which are not blocked yet
+    std::vector<Candidate>::size_type open(0);
+    for (Pos pos : flights_) {
+      if (board_.GetFigure(pos) == chess::kEmpty) {
+        ++open;
+      }
+    }
+    if (open > candidates_.size() - index) {
+      return true;
+    }
+  }
+  if (index == candidates_.size()) {
+    return TestMate();
+  }
+  const Candidate& candidate = candidates_[index];
+  auto color(chess::Color2Index(candidate.color_));
+  auto opponent(chess::Color2Index(chess::InvertColor(candidate.color_)));
+  for (const Target& target : candidate.targets_) {
+    if (target.moves_ > moves_left_[color]) {
+      break;  // The targets are sorted by moves_
+    }
+    if (target.figure_ == chess::kEmpty) {
+      // The figure is captured
+      if (captured_[color] >= moves_[opponent]) {
+        continue;
+      }
+      ++captured_[color];
+      bool success(Place(index + 1));
+      --captured_[color];
+      if (!success) {
+        return false;
+      }
+      continue;
+    }
+    if (board_.GetFigure(target.pos_) != chess::kEmpty) {
+      continue;
+    }
+    board_.PlaceFigure(target.figure_, target.pos_);
+    moves_left_[color] -= target.moves_;
+    hits_[color] += target.hits_;
+    bool success(true);
+    // The kings are placed first; they cannot stand side by side
+    if ((index != 1) || !board_.IsInCheck(mating_color_)) {
+      success = Place(index + 1);
+    }
+    hits_[color] -= target.hits_;
+    moves_left_[color] += target.moves_;
+    board_.RemoveFigure(target.pos_);
+    if (!success) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MeetInTheMiddle::MateLikely() {
+  // Only the king of the mated party is placed yet
+  Figure mated(chess::InvertColor(mating_color_));
+  Pos king(board_.GetPosList(mated).front());
+  if (!board_.IsThreatened(king, mated)) {
+    return false;
+  }
+  // The figures of the mated party can only block the flight fields, but
+  // they cannot cover them or protect the figures of mating_color_.
+  flights_.clear();
+  board_.RemoveFigure(king);
+  bool result(true);
+  for (PosDelta delta : Field::king_deltas) {
+    Pos pos(chess::AddDelta(king, delta));
+    if (!OnBoard(pos) || board_.IsThreatened(pos, mated)) {
+      continue;
+    }
+    if (board_.GetFigure(pos) != chess::kEmpty) {
+      result = false;
+      break;
+    }
+    flights_.push_back(pos);
+  }
+  board_.PlaceFigure(chess::ColoredFigure(chess::kKing, mated), king);
+  return result;
+}
+
+bool MeetInTheMiddle::TestMate() {
+  ++nodes_;
+  for (Figure color : {chess::kWhite, chess::kBlack}) {
+    if (hits_[chess::Color2Index(color)] >
+      captured_[chess::Color2Index(chess::InvertColor(color))]) {
+      return true;
+    }
+  }
+  if (board_.IsInCheck(mating_color_) || !board_.IsCheckMate()) {
+    return true;
+  }
+  // The variants of ep and castling of the mate
+  chess::Castling castling(board_.CalcCastling(castling_));
+  chess::EnPassantList ep_values;
+  ep_values.push_back(chess::kNoEnPassant);
+  board_.CalcEnPassant(&ep_values);
+  bool success(true);
+  for (chess::EnPassant ep : ep_values) {
+    board_.set_ep(ep);
+    if ((ep != chess::kNoEnPassant) && !board_.IsCheckMate()) {
+      continue;
+    }
+    for (chess::Castling rights(castling); ;
+      rights = static_cast<chess::Castling>((rights - 1) & castling)) {
+      board_.set_castling(rights);
+      Key key;
+      board_.Pack(key.data());
+      if (!Retract(0, key, nullptr)) {
+        success = false;
+        break;
+      }
+      if (rights == chess::kNoCastling) {
+        break;
+      }
+    }
+    if (!success) {
+      break;
+    }
+  }
+  board_.set_ep(chess::kNoEnPassant);
+  board_.set_castling(chess::kNoCastling);
+  return success;
+}
+
+bool MeetInTheMiddle::Reachable(int distance) const {
+  int half_moves(half_moves_ - distance);
+  for (Figure color : {chess::kWhite, chess::kBlack}) {
+    auto index(chess::Color2Index(color));
+    int total(0), initial(0), excess(0);
+    for (Figure figure(chess::kPawn); figure <= chess::kKing;
+      figure = static_cast<Figure>(figure + chess::kKnight - chess::kPawn)) {
+      int count(static_cast<int>(
+        board_.CountFigures(chess::ColoredFigure(figure, color))));
+      int initial_count(static_cast<int>(figures_[index][figure]));
+      total += count;
+      initial += initial_count;
+      if ((figure != chess::kPawn) && (count > initial_count)) {
+        excess += count - initial_count;
+      }
+    }
+    int pawns(static_cast<int>(board_.CountFigures(
+      chess::ColoredFigure(chess::kPawn, color))));
+    int initial_pawns(static_cast<int>(figures_[index][chess::kPawn]));
+    // Each missing figure was captured by a move of the opponent, and
+    // additional figures must be transformed pawns
+    if ((total > initial) ||
+      (initial - total > Moves(chess::InvertColor(color), half_moves)) ||
+      (pawns > initial_pawns) || (excess > initial_pawns - pawns)) {
+      return false;
+    }
+    int moves(0);
+    for (Pos pos : board_.GetPosList(color)) {
+      moves += reach_[board_.GetFigure(pos)][pos];
+    }
+    if (moves > Moves(color, half_moves)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MeetInTheMiddle::Retract(int distance, const Key& key,
+    const RetroLink *link) {
+  auto inserted(layers_[static_cast<std::size_t>(distance)].emplace(key,
+    std::vector<RetroLink>()));
+  if (link != nullptr) {
+    inserted.first->second.push_back(*link);
+  }
+  if (!inserted.second) {
+    // The position was already expanded
+    return true;
+  }
+  ++nodes_;
+  if (distance == last_) {
+    return true;
+  }
+  if (UNLIKELY(++work_ > work_limit_)) {
+    return false;
+  }
+  chess::RetroMoveList retractions;
+  board_.RetroGenerator(&retractions, castling_);
+  chess::EnPassant ep(board_.get_ep_());
+  chess::Castling castling(board_.get_castling());
+  chess::EnPassantList ep_values;
+  for (const auto& retraction : retractions) {
+    bool success(true);
+    if (board_.RetractMove(retraction) && Reachable(distance + 1)) {
+      ep_values.clear();
+      if (retraction.move_.move_type_ == chess::Move::kEnPassant) {
+        ep_values.push_back(board_.get_ep_());
+      } else {
+        ep_values.push_back(chess::kNoEnPassant);
+        board_.CalcEnPassant(&ep_values);
+      }
+      RetroLink next(key, retraction.move_);
+      for (chess::EnPassant previous : ep_values) {
+        board_.set_ep(previous);
+        Key parent;
+        board_.Pack(parent.data());
+        if ((distance + 1 == last_) && (middle_positions_.count(parent) == 0)) {
+          continue;
+        }
+        if (!Retract(distance + 1, parent, &next)) {
+          success = false;
+          break;
+        }
+      }
+    }
+    board_.UnretractMove(retraction, ep, castling);
+    if (!success) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MeetInTheMiddle::Mates(int distance, const Key& key,
+    chess::MoveList *line, std::vector<chess::MoveList> *mates) const {
+  if (distance == 0) {
+    mates->push_back(*line);
+    return;
+  }
+  for (const auto& link :
+    layers_[static_cast<std::size_t>(distance)].find(key)->second) {
+    line->push_back(link.move_);
+    Mates(distance - 1, link.child_, line, mates);
+    line->pop_back();
+  }
+}
+
+void MeetInTheMiddle::Join(int depth, chess::Hash hash,
+    const Meeting& meeting, std::vector<chess::MoveList> *solutions) {
+  if (depth == 0) {
+    for (const auto& mate : meeting.mates_) {
+      solutions->emplace_back();
+      chess::MoveList& solution = solutions->back();
+      solution.assign(line_.rbegin(), line_.rend());
+      solution.insert(solution.end(), mate.begin(), mate.end());
+    }
+    return;
+  }
+  for (const auto& link :
+    visited_[static_cast<std::size_t>(depth)].find(hash)->second.links_) {
+    line_.push_back(link.move_);
+    Join(depth - 1, link.parent_, meeting, solutions);
+    line_.pop_back();
+  }
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,278 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_MEETINTHEMIDDLE_H_
+#define CHESSPROBLEM_MEETINTHEMIDDLE_H_ 1
+
+#include <config.h>
+
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+A meet-in-the-middle solver for kHelpMate.
+
+Since both parties cooperate, a solution is a line from the initial
+position to a position in the middle, followed by a line from that
+position to a mate. The two halves are searched from both ends and joined
+on the full positions in the middle (in the form of chess::Field::Pack()):
+
+The first half is expanded forward where each position (at the same depth)
+is expanded only once: For a transposition, only the move leading to it is
+recorded as a further predecessor link.
+
+For the second half, the mate positions which might be reachable are
+enumerated: Each figure of the initial position is captured or placed on a
+field which it can reach on an empty board with the moves of its party
+(pawns possibly transformed), and the mated king must be in check by the
+other party with each flight field covered or blocked. From these mates,
+the retractions of chess::Field::RetroGenerator() are expanded backward
+(again, each position at the same distance is expanded only once) as long
+as the figures of the initial position can reach their fields in the
+remaining half moves, and the positions at the distance of the middle are
+looked up among the positions of the first half.
+
+Thus, if b is the branching factor, about 2 * b^(n/2) instead of b^n
+positions are visited for n half moves, provided that the mate positions
+are few. With many figures, the mate positions can be too many: If the
+enumeration and the backward expansion need more nodes than a forward
+search of the second half is estimated to need, they are given up, and the
+second half is searched forward from the positions in the middle,
+remembering the positions from which no mate can be reached (symmetric
+positions share this information).
+
+The solutions are produced by following the predecessor links from the
+positions in the middle back to the initial position and the successor
+links forward to the mates.
+All solutions are found (including cooks having less moves).
+
+This class is not thread-safe.
+*/
+
+class MeetInTheMiddle {
+ public:
+  MeetInTheMiddle() : nodes_(0) {
+  }
+
+  // Append all helpmates of mating_color within half_moves to *solutions:
+  // Each solution is the list of moves starting from field.
+  ATTRIBUTE_NONNULL_ void Solve(chess::Field *field, int half_moves,
+      chess::Figure mating_color, std::vector<chess::MoveList> *solutions);
+
+  // The number of nodes visited by all Solve() calls
+  ATTRIBUTE_NODISCARD std::uint64_t get_nodes() const {
+    return nodes_;
+  }
+
+ private:
+  typedef std::unordered_set<chess::Hash> HashSet;
+
+  // A packed position, see chess::Field::Pack()
+  typedef std::array<unsigned char, chess::Field::kPackedSize> Key;
+
+  class KeyHash {
+   public:
+    ATTRIBUTE_NODISCARD ATTRIBUTE_PURE std::size_t operator()(
+        const Key& key) const;
+  };
+
+  // A move from a position of the previous depth
+  class Link {
+   public:
+    chess::Hash parent_;
+    chess::Move move_;
+
+    Link(chess::Hash parent, const chess::Move& my_move)
+      : parent_(parent), move_(my_move) {
+    }
+  };
+
+  // A position of the first half
+  class Node {
+   public:
+    bool found_;  // Whether a mate can be reached
+    std::vector<Link> links_;
+
+    Node() : found_(false) {
+    }
+  };
+
+  // A position in the middle (or an early mate in the first half)
+  class Meeting {
+   public:
+    int depth_;
+    chess::Hash hash_;
+    std::vector<chess::MoveList> mates_;  // the continuations
+  };
+
+  // A move from a position of the backward expansion to the position
+  // which is one half move nearer to the mate
+  class RetroLink {
+   public:
+    Key child_;
+    chess::Move move_;
+
+    RetroLink(const Key& child, const chess::Move& my_move)
+      : child_(child), move_(my_move) {
+    }
+  };
+
+  // The positions of the backward expansion at the same distance to mate
+  // with their successor links
+  typedef std::unordered_map<Key, std::vector<RetroLink>, KeyHash> Layer;
+
+  // A field which a figure of the initial position might reach: The
+  // (possibly transformed) figure, the number of moves it needs at least,
+  // and for pawns the number of hits which it needs at least
+  class Target {
+   public:
+    chess::Figure figure_;
+    chess::Pos pos_;
+    int moves_, hits_;
+
+    Target(chess::Figure figure, chess::Pos pos, int moves, int hits)
+      : figure_(figure), pos_(pos), moves_(moves), hits_(hits) {
+    }
+  };
+
+  // A figure of the initial position for the enumeration of the mates
+  class Candidate {
+   public:
+    chess::Figure color_;
+    bool king_;
+    std::vector<Target> targets_;
+  };
+
+  chess::Field *field_;
+  int half_moves_, middle_;
+  chess::Figure mating_color_;
+  std::uint64_t nodes_;
+
+  // Whether the second half is searched forward
+  bool forward_;
+
+  // The number of positions expanded in the first half and of the moves
+  // generated there (for estimating the branching factor)
+  std::uint64_t expanded_, generated_;
+
+  // Indexed by depth: The positions of the first half
+  std::vector<std::unordered_map<chess::Hash, Node>> visited_;
+
+  // The positions in the middle (for the backward expansion)
+  std::unordered_map<Key, chess::Hash, KeyHash> middle_positions_;
+
+  // The positions of the second half from which no mate can be reached
+  HashSet dead_;
+
+  std::vector<Meeting> meetings_;
+
+  // The line found by Join() in reverse order
+  chess::MoveList line_;
+
+  // The field for the enumeration of the mates and the backward expansion
+  chess::Field board_;
+
+  // The distance of the middle to the mates
+  int last_;
+
+  // The party on move and the castling rights of the initial position
+  chess::Figure first_;
+  chess::Castling castling_;
+
+  // Indexed by color: The number of figures of the initial position and of
+  // the moves of the party within half_moves_
+  std::array<std::array<unsigned int, chess::kMaxFigure + 1>, 2> figures_;
+  std::array<int, 2> moves_;
+
+  // Indexed by colored figure and field: The number of moves which the
+  // figures of the initial position need at least to reach the field
+  std::array<std::array<unsigned char, chess::Field::kFieldSize>,
+    chess::kMaxFigure + 1> reach_;
+
+  // The enumeration: The figures in the order of placement (the mated
+  // king, the figures of mating_color_, the other figures of the mated
+  // party), the index of the first figure of the last group, the flight
+  // fields of the mated king which must be blocked, and by color the
+  // remaining moves, the captured figures, and the hits needed by pawns
+  std::vector<Candidate> candidates_;
+  std::vector<Candidate>::size_type blockers_;
+  std::vector<chess::Pos> flights_;
+  std::array<int, 2> moves_left_, captured_, hits_;
+
+  // Indexed by the distance to mate
+  std::vector<Layer> layers_;
+
+  // The number of nodes which the enumeration and the backward expansion
+  // may use, and the number which they have used
+  std::uint64_t work_limit_, work_;
+
+  // The first half. Return true if a mate can be reached (or, unless
+  // forward_, if the position is in the middle).
+  // link is the move leading to the position or nullptr at depth 0.
+  bool Forward(int depth, const Link *link);
+
+  // The second half. Return true if a mate can be reached.
+  // line is the current line from the middle; mates are appended to *mates.
+  ATTRIBUTE_NONNULL_ bool Continue(int remaining_half_moves,
+      chess::MoveList *line, std::vector<chess::MoveList> *mates);
+
+  // The second half from the mates. Return false if work_limit_ is exceeded.
+  bool Backward();
+
+  // Calculate the targets of the figure at pos of the initial position
+  ATTRIBUTE_NONNULL_ void CalcTargets(Candidate *candidate,
+      chess::Pos pos) const;
+
+  // Place candidates_[index] and the subsequent figures onto board_ and
+  // expand the mates backward. Return false if work_limit_ is exceeded.
+  bool Place(std::vector<Candidate>::size_type index);
+
+  // Whether the mated king on board_ is in check and each of its flight
+  // fields is covered or (to be) blocked; the latter are stored in flights_
+  ATTRIBUTE_NODISCARD bool MateLikely();
+
+  // board_ contains all figures: Expand it backward if it is a mate.
+  // Return false if work_limit_ is exceeded.
+  bool TestMate();
+
+  // The number of moves of color within the first half_moves
+  ATTRIBUTE_NODISCARD int Moves(chess::Figure color, int half_moves) const {
+    return ((color == first_) ? ((half_moves + 1) / 2) : (half_moves / 2));
+  }
+
+  // Return false if board_ cannot arise from the initial position at the
+  // distance to mate: The material must fit, and the moves needed to reach
+  // the fields must fit into the half moves before.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE bool Reachable(int distance) const;
+
+  // Record key (which must be board_) at distance with the successor link
+  // and expand it. Return false if work_limit_ is exceeded.
+  bool Retract(int distance, const Key& key, const RetroLink *link);
+
+  // Append the lines from the position key at distance to the mates
+  ATTRIBUTE_NONNULL_ void Mates(int distance, const Key& key,
+      chess::MoveList *line, std::vector<chess::MoveList> *mates) const;
+
+  // Follow the predecessor links of the position hash at depth back to the
+  // initial position and append the solutions through meeting.
+  ATTRIBUTE_NONNULL_ void Join(int depth, chess::Hash hash,
+      const Meeting& meeting, std::vector<chess::MoveList> *solutions);
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_MEETINTHEMIDDLE_H_
@@ -0,0 +1,83 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/parse.h"
+#include <config.h>
+
+#include <cstdlib>  // atoi, exit
+
+#include <string>
+#include <vector>
+
+#include <osformat.h>  // NOLINT(build/include_order)
+
+#include "chessproblem/chess.h"
+
+using std::string;
+using std::vector;
+
+namespace chessproblem {
+
+bool PlaceFigures(chess::Field *field, chess::Figure color,
+    const string& str) {
+  vector<string> figures;
+  SplitString(&figures, str);
+  if (figures.empty()) {
+    osformat::SayError("No figures of color %s specified")
+      % chess::color_name[color];
+    return false;
+  }
+  for (const auto& s : figures) {
+    chess::Figure figure(chess::kNoFigure);
+    chess::Pos pos(chess::Field::kFieldEnd);
+    if (s.length() == 2) {
+      figure = chess::kPawn;
+      pos = chess::Field::CalcPos(s);
+    } else if (s.length() == 3) {
+      figure = chess::FigureValue(s[0]);
+      pos = chess::Field::CalcPos(s.substr(1));
+    }
+    if ((figure == chess::kNoFigure) || (pos == chess::Field::kFieldEnd)) {
+      osformat::SayError("Figure or placement not understood: %s") % s;
+      return false;
+    }
+    if (field->GetFigure(pos) != chess::kEmpty) {
+      osformat::SayError("Figure was already on this field: %s") % s;
+      return false;
+    }
+    field->PlaceFigure(chess::ColoredFigure(figure, color), pos);
+  }
+  return true;
+}
+
+int CheckNum(const char *num, int min_value, char c) {
+  int ret(std::atoi(num));
+  if (ret < min_value) {
+    osformat::SayError("Argument %s of -%s should be at least %d")
+      % num
+      % c
+      % min_value;
+    std::exit(EXIT_FAILURE);
+  }
+  return ret;
+}
+
+void SplitString(vector<string> *res, const string& str) {
+  string::size_type last_pos(0);
+  for (string::size_type pos(0);
+      (pos = str.find_first_of("\t\r\n ,.:;!?_-", pos)) != string::npos;
+      last_pos = ++pos) {
+    if (pos > last_pos) {
+      res->emplace_back(str, last_pos, pos - last_pos);
+    }
+  }
+  if (str.size() > last_pos) {
+    res->emplace_back(str, last_pos);
+  }
+}
+
+}  // namespace chessproblem
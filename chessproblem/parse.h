@@ -0,0 +1,40 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_PARSE_H_
+#define CHESSPROBLEM_PARSE_H_ 1
+
+#include <config.h>
+
+#include <string>
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+// The parsing of arguments which is shared by chessproblem and bench.
+// Errors are reported with osformat::SayError().
+
+namespace chessproblem {
+
+// Place the figures of color given in chess notation like "Ke1,Qd1,e2"
+// (see SplitString() for the admissible separators) onto field.
+// Return false if str is empty or not understood or if a figure would be
+// placed onto an occupied field.
+ATTRIBUTE_NODISCARD ATTRIBUTE_NONNULL_ bool PlaceFigures(chess::Field *field,
+    chess::Figure color, const std::string& str);
+
+// Return the number num of option -c; exit if it is smaller than min_value.
+ATTRIBUTE_NONNULL_ int CheckNum(const char *num, int min_value, char c);
+
+// Append the nonempty words of str to *res
+ATTRIBUTE_NONNULL_ void SplitString(std::vector<std::string> *res,
+    const std::string& str);
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_PARSE_H_
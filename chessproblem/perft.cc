@@ -0,0 +1,95 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/perft.h"
+#include <config.h>
+
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <memory>  // unique_ptr
+#ifndef NO_CHESSPROBLEM_THREADS
+#include <thread>  // NOLINT(build/c++11)
+#endif
+#include <utility>  // move
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+std::uint64_t Perft::Count(chess::Field *field, int half_moves,
+    std::vector<Divide> *divide) {
+  std::vector<Divide> first;
+  if (half_moves <= 0) {
+    if (divide != nullptr) {
+      divide->clear();
+    }
+    return 1;
+  }
+  chess::MoveList moves;
+  field->Generator(&moves);
+  first.reserve(moves.size());
+  for (const auto& my_move : moves) {
+    first.emplace_back(my_move);
+  }
+  Index next(0);
+#ifndef NO_CHESSPROBLEM_THREADS
+  std::size_t threads(static_cast<std::size_t>(max_threads_));
+  if (threads > first.size()) {
+    threads = first.size();
+  }
+  std::vector<std::unique_ptr<chess::Field>> fields;
+  std::vector<std::thread> pool;
+  for (std::size_t i(1); i < threads; ++i) {
+    fields.emplace_back(new chess::Field(*field));
+    pool.emplace_back(&Perft::CountFirstMoves, fields.back().get(),
+      half_moves, &next, &first);
+  }
+  CountFirstMoves(field, half_moves, &next, &first);
+  for (auto& thread : pool) {
+    thread.join();
+  }
+#else  // defined(NO_CHESSPROBLEM_THREADS)
+  CountFirstMoves(field, half_moves, &next, &first);
+#endif  // NO_CHESSPROBLEM_THREADS
+  std::uint64_t leaves(0);
+  for (const auto& entry : first) {
+    leaves += entry.leaves_;
+  }
+  if (divide != nullptr) {
+    *divide = std::move(first);
+  }
+  return leaves;
+}
+
+std::uint64_t Perft::Leaves(chess::Field *field, int half_moves) {
+  chess::MoveList moves;
+  field->Generator(&moves);
+  if (half_moves == 1) {
+    return moves.size();
+  }
+  std::uint64_t leaves(0);
+  for (const auto& my_move : moves) {
+    chess::push_guard guard(field, &my_move);
+    leaves += Leaves(field, half_moves - 1);
+  }
+  return leaves;
+}
+
+void Perft::CountFirstMoves(chess::Field *field, int half_moves, Index *next,
+    std::vector<Divide> *divide) {
+  std::size_t i;
+  while ((i = (*next)++) < divide->size()) {
+    Divide& entry = (*divide)[i];
+    chess::push_guard guard(field, &entry.move_);
+    entry.leaves_ = ((half_moves == 1) ? 1 : Leaves(field, half_moves - 1));
+  }
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,87 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_PERFT_H_
+#define CHESSPROBLEM_PERFT_H_ 1
+
+#include <config.h>
+
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#ifndef NO_CHESSPROBLEM_THREADS
+#include <atomic>
+#endif
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+Count the leaves of the tree of valid moves to a fixed depth ("perft").
+
+This tests chess::Field::Generator(), PushMove(), and PopMove() against
+the known values for standard positions and measures their speed
+independently of the solver. The leaves at the last half move are not
+pushed but only counted from the generated move list.
+
+The first moves are distributed among several threads; each thread works
+on its own copy of the field.
+
+This class itself is not thread-safe.
+*/
+
+class Perft {
+ public:
+  // The number of leaves below a first move
+  class Divide {
+   public:
+    chess::Move move_;
+    std::uint64_t leaves_;
+
+    explicit Divide(const chess::Move& my_move)
+      : move_(my_move), leaves_(0) {
+    }
+  };
+
+  // At most max_threads threads are used
+  explicit Perft(int max_threads)
+    : max_threads_((max_threads > 0) ? max_threads : 1) {
+  }
+
+  // Return the number of leaves of field within half_moves.
+  // If divide is not nullptr, the leaves for each first move are stored
+  // there in the order of the generator.
+  ATTRIBUTE_NONNULL((1)) std::uint64_t Count(chess::Field *field,
+      int half_moves, std::vector<Divide> *divide);
+
+  Perft(const Perft& p) = delete;
+  Perft& operator=(const Perft& p) = delete;
+
+ private:
+#ifndef NO_CHESSPROBLEM_THREADS
+  typedef std::atomic<std::size_t> Index;
+#else
+  typedef std::size_t Index;
+#endif
+
+  int max_threads_;
+
+  ATTRIBUTE_NONNULL_ static std::uint64_t Leaves(chess::Field *field,
+      int half_moves);
+
+  // Count the leaves below the first moves of *divide from number *next on;
+  // *next is incremented for each first move taken.
+  ATTRIBUTE_NONNULL_ static void CountFirstMoves(chess::Field *field,
+      int half_moves, Index *next, std::vector<Divide> *divide);
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_PERFT_H_
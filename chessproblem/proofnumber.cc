@@ -0,0 +1,200 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/proofnumber.h"
+#include <config.h>
+
+#include <cassert>
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+#include "chessproblem/m_likely.h"
+
+namespace chessproblem {
+
+const ProofNumberSearch::Number ProofNumberSearch::kInfinity;
+const std::size_t ProofNumberSearch::kBucketSize;
+
+// Saturated addition
+inline static ProofNumberSearch::Number Add(ProofNumberSearch::Number a,
+    ProofNumberSearch::Number b) {
+  return ((a >= ProofNumberSearch::kInfinity - b) ?
+    ProofNumberSearch::kInfinity : (a + b));
+}
+
+ProofNumberSearch::ProofNumberSearch(std::size_t megabytes) : nodes_(0) {
+  std::size_t wanted((megabytes << 20) / sizeof(Entry)), size(kBucketSize);
+  while (2 * size <= wanted) {
+    size *= 2;
+  }
+  Entry empty = { 0, 0, 0, 0 };
+  table_.assign(size, empty);
+  mask_ = size - kBucketSize;
+}
+
+bool ProofNumberSearch::Prove(chess::Field *field, int remaining_half_moves,
+    bool attacker, chess::Figure mating_color) {
+  assert(remaining_half_moves >= 0);
+  field_ = field;
+  mating_color_ = mating_color;
+  attacker_parity_ = ((remaining_half_moves & 1) ^ (attacker ? 0 : 1));
+  Number proof, disproof;
+  Mid(remaining_half_moves, kInfinity, kInfinity, &proof, &disproof);
+  return (proof == 0);
+}
+
+chess::Hash ProofNumberSearch::Key(int remaining_half_moves) const {
+  chess::Hash key(field_->get_canonical_hash() ^
+    (static_cast<chess::Hash>(remaining_half_moves + 1) *
+    0xD6E8FEB86659FD93U));
+  return ((key == 0) ? 1 : key);
+}
+
+bool ProofNumberSearch::Lookup(chess::Hash key, Number *proof,
+    Number *disproof) const {
+  const Entry *bucket(&table_[key & mask_]);
+  for (std::size_t i(0); i != kBucketSize; ++i) {
+    if (bucket[i].key_ == key) {
+      *proof = bucket[i].proof_;
+      *disproof = bucket[i].disproof_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ProofNumberSearch::Store(chess::Hash key, Number proof, Number disproof,
+    std::uint64_t work) {
+  Entry *bucket(&table_[key & mask_]);
+  Entry *replace(bucket);
+  for (std::size_t i(0); i != kBucketSize; ++i) {
+    if (bucket[i].key_ == key) {
+      replace = &bucket[i];
+      break;
+    }
+    if (bucket[i].work_ < replace->work_) {
+      replace = &bucket[i];
+    }
+  }
+  replace->key_ = key;
+  replace->proof_ = proof;
+  replace->disproof_ = disproof;
+  replace->work_ = ((work > UINT32_MAX) ? UINT32_MAX :
+    static_cast<std::uint32_t>(work));
+}
+
+void ProofNumberSearch::Mid(int remaining_half_moves,
+    Number proof_threshold, Number disproof_threshold,
+    Number *proof, Number *disproof) {
+  ++nodes_;
+  chess::Hash key(Key(remaining_half_moves));
+  if (Lookup(key, proof, disproof) &&
+    ((*proof >= proof_threshold) || (*disproof >= disproof_threshold))) {
+    return;
+  }
+  chess::MoveList moves;
+  bool terminal, won;
+  if (UNLIKELY(!field_->CanMate(mating_color_))) {
+    terminal = true;
+    won = false;
+  } else if (remaining_half_moves == 0) {
+    terminal = true;
+    won = field_->IsCheckMate();
+  } else if (UNLIKELY(!field_->Generator(&moves))) {
+    // Early mate or stalemate
+    terminal = true;
+    won = (((remaining_half_moves & 1) == 0) && field_->IsInCheck());
+  } else {
+    terminal = false;
+  }
+  bool attacker(IsAttacker(remaining_half_moves));
+  // For the attacker, "own" numbers are proof numbers.
+  // For the defender, "own" numbers are disproof numbers.
+  Number *own(attacker ? proof : disproof);
+  Number *other(attacker ? disproof : proof);
+  Number own_threshold(attacker ? proof_threshold : disproof_threshold);
+  Number other_threshold(attacker ? disproof_threshold : proof_threshold);
+  if (terminal) {
+    *proof = (won ? 0 : kInfinity);
+    *disproof = (won ? kInfinity : 0);
+    Store(key, *proof, *disproof, 1);
+    return;
+  }
+  std::uint64_t start(nodes_);
+  // The numbers of the children in own/other order
+  std::vector<Number> child_own, child_other;
+  child_own.reserve(moves.size());
+  child_other.reserve(moves.size());
+  int child_remaining(remaining_half_moves - 1);
+  for (const auto& my_move : moves) {
+    chess::push_guard guard(field_, &my_move);
+    Number child_proof, child_disproof;
+    if (child_remaining == 0) {
+      // Evaluate leaves immediately
+      bool child_won(field_->IsCheckMate());
+      child_proof = (child_won ? 0 : kInfinity);
+      child_disproof = (child_won ? kInfinity : 0);
+    } else if (!Lookup(Key(child_remaining), &child_proof, &child_disproof)) {
+      child_proof = child_disproof = 1;
+    }
+    child_own.push_back(attacker ? child_proof : child_disproof);
+    child_other.push_back(attacker ? child_disproof : child_proof);
+    if (child_own.back() == 0) {
+      // We have reached our goal with this move
+      break;
+    }
+  }
+  for (;;) {
+    Number sum(0), min1(kInfinity), min2(kInfinity);
+    std::vector<Number>::size_type best(0);
+    for (std::vector<Number>::size_type i(0); i != child_own.size(); ++i) {
+      sum = Add(sum, child_other[i]);
+      Number value(child_own[i]);
+      if (value < min1) {
+        min2 = min1;
+        min1 = value;
+        best = i;
+      } else if (value < min2) {
+        min2 = value;
+      }
+    }
+    if (min1 == 0) {
+      // This is also the case if not all children were initialized
+      *own = 0;
+      *other = kInfinity;
+      break;
+    }
+    *own = min1;
+    *other = sum;
+    if ((min1 >= own_threshold) || (sum >= other_threshold)) {
+      break;
+    }
+    // Search best child until it becomes worse than the second best.
+    // The 1 + epsilon trick (epsilon = 1/4) avoids frequent switching.
+    Number child_own_threshold(Add(min2, (min2 >> 2) + 1));
+    if (child_own_threshold > own_threshold) {
+      child_own_threshold = own_threshold;
+    }
+    Number child_other_threshold((other_threshold >= kInfinity) ?
+      kInfinity : (other_threshold - sum + child_other[best]));
+    chess::push_guard guard(field_, &moves[best]);
+    if (attacker) {
+      Mid(child_remaining, child_own_threshold, child_other_threshold,
+        &child_own[best], &child_other[best]);
+    } else {
+      Mid(child_remaining, child_other_threshold, child_own_threshold,
+        &child_other[best], &child_own[best]);
+    }
+  }
+  Store(key, *proof, *disproof, nodes_ - start);
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,104 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_PROOFNUMBER_H_
+#define CHESSPROBLEM_PROOFNUMBER_H_ 1
+
+#include <config.h>
+
+#include <cstddef>  // size_t
+#include <cstdint>
+
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+A depth-first proof-number search (df-pn) for kMate and kSelfMate.
+
+The party which has to reach the goal is called the attacker: Its nodes are
+OR nodes, the nodes of the defender are AND nodes. A node is described by the
+position and the number of remaining half moves; the results of all nodes
+are kept in a transposition table of fixed size (entries with little work
+are replaced first), so that the table can be used for several Prove() calls.
+Positions which are equal up to a symmetry of the board share their entries
+(chess::Field::get_canonical_hash()).
+
+The rules of ChessProblem are reproduced exactly:
+If the party which has to give mate has insufficient material
+(chess::Field::CanMate()), the attacker has lost.
+If no half moves remain, the attacker has won iff the moving party is mate.
+If the moving party cannot move earlier, the attacker has won iff the moving
+party is mate and is the party which would have to be mate in the last move.
+
+This class is not thread-safe.
+*/
+
+class ProofNumberSearch {
+ public:
+  typedef std::uint32_t Number;
+  constexpr static const Number kInfinity = 0x3FFFFFFF;
+
+  // The transposition table uses about the given amount of memory
+  explicit ProofNumberSearch(std::size_t megabytes);
+
+  // Return true if the attacker wins on field within remaining_half_moves.
+  // attacker tells whether the attacker is the moving party.
+  // mating_color is the party which has to give mate.
+  ATTRIBUTE_NONNULL_ bool Prove(chess::Field *field, int remaining_half_moves,
+      bool attacker, chess::Figure mating_color);
+
+  // The number of nodes visited by all Prove() calls
+  ATTRIBUTE_NODISCARD std::uint64_t get_nodes() const {
+    return nodes_;
+  }
+
+ private:
+  class Entry {
+   public:
+    chess::Hash key_;  // 0 if unused
+    Number proof_, disproof_;
+    std::uint32_t work_;  // number of nodes (truncated) used for the result
+  };
+
+  constexpr static const std::size_t kBucketSize = 4;
+
+  std::vector<Entry> table_;
+  std::size_t mask_;
+  chess::Field *field_;
+  int attacker_parity_;
+  chess::Figure mating_color_;
+  std::uint64_t nodes_;
+
+  ATTRIBUTE_NODISCARD bool IsAttacker(int remaining_half_moves) const {
+    return ((remaining_half_moves & 1) == attacker_parity_);
+  }
+
+  ATTRIBUTE_NODISCARD ATTRIBUTE_PURE chess::Hash Key(
+      int remaining_half_moves) const;
+
+  // Return false if the key is not in the table
+  ATTRIBUTE_NONNULL_ bool Lookup(chess::Hash key, Number *proof,
+      Number *disproof) const;
+
+  void Store(chess::Hash key, Number proof, Number disproof,
+      std::uint64_t work);
+
+  // The multiple iterative deepening step of df-pn for the current node.
+  // On return, proof/disproof contain the node's (possibly updated) values
+  // which exceed at least one of the thresholds or are final.
+  ATTRIBUTE_NONNULL_ void Mid(int remaining_half_moves,
+      Number proof_threshold, Number disproof_threshold,
+      Number *proof, Number *disproof);
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_PROOFNUMBER_H_
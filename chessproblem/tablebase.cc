@@ -0,0 +1,738 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#include "chessproblem/tablebase.h"
+#include <config.h>
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <fcntl.h>  // open
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>  // close
+#endif
+
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <cstdio>
+#include <cstring>  // memcmp
+
+#ifndef NO_CHESSPROBLEM_THREADS
+#include <atomic>
+#endif
+#include <memory>  // unique_ptr
+#include <string>
+#ifndef NO_CHESSPROBLEM_THREADS
+#include <thread>  // NOLINT(build/c++11)
+#endif
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+const unsigned char Tablebases::kNoMate;
+
+namespace {
+
+// The name and the figures (besides the kings) of the strong side
+class Info {
+ public:
+  const char *name_;
+  int pieces_;
+  chess::Figure figures_[2];
+};
+
+const Info kInfo[] = {
+  { "kqk", 1, { chess::kQueen, chess::kEmpty } },
+  { "krk", 1, { chess::kRook, chess::kEmpty } },
+  { "kbnk", 2, { chess::kBishop, chess::kKnight } },
+  { "kpk", 1, { chess::kPawn, chess::kEmpty } }
+};
+
+// The header of the files; the values follow immediately
+const char kHeader[16] = "chessproblemTB1";
+
+const unsigned char kIllegal = 254;
+
+const int kKingSteps[8][2] = {
+  { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 },
+  { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+};
+
+const int kKnightSteps[8][2] = {
+  { 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+  { -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 }
+};
+
+// The squares are numbered 0 (a1) ... 63 (h8)
+inline int File(int square) {
+  return (square & 7);
+}
+
+inline int Rank(int square) {
+  return (square >> 3);
+}
+
+// Return the square at the offset or -1 if it is not on the board
+inline int Offset(int square, int file, int rank) {
+  file += File(square);
+  rank += Rank(square);
+  return (((file & ~7) == 0) && ((rank & ~7) == 0)) ? (rank * 8 + file) : -1;
+}
+
+inline std::uint64_t Bit(int square) {
+  return (static_cast<std::uint64_t>(1) << square);
+}
+
+// Return true if the squares are equal or neighbours
+inline bool Near(int a, int b) {
+  int file(File(a) - File(b)), rank(Rank(a) - Rank(b));
+  return ((file * file <= 1) && (rank * rank <= 1));
+}
+
+// Return true if the white figure at from attacks to;
+// occupied are the squares which block the lines.
+bool Attacks(chess::Figure figure, int from, int to, std::uint64_t occupied) {
+  int file(File(to) - File(from)), rank(Rank(to) - Rank(from));
+  switch (figure) {
+    case chess::kPawn:
+      return ((rank == 1) && (file * file == 1));
+    case chess::kKnight:
+      return (file * file + rank * rank == 5);
+    case chess::kBishop:
+      if ((file == 0) || (file * file != rank * rank)) {
+        return false;
+      }
+      break;
+    case chess::kRook:
+      if ((file == 0) == (rank == 0)) {
+        return false;
+      }
+      break;
+    default:
+    // case chess::kQueen:
+      if (((file == 0) && (rank == 0)) || ((file != 0) && (rank != 0) &&
+        (file * file != rank * rank))) {
+        return false;
+      }
+  }
+  int step(((rank > 0) ? 8 : ((rank < 0) ? -8 : 0)) +
+    ((file > 0) ? 1 : ((file < 0) ? -1 : 0)));
+  for (int square(from + step); square != to; square += step) {
+    if ((occupied & Bit(square)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A position of a table. The side to move is 0 for white, 1 for black.
+class Squares {
+ public:
+  int stm_, white_king_, black_king_, piece_[2];
+
+  ATTRIBUTE_NODISCARD std::size_t Index(int pieces) const {
+    std::size_t index(static_cast<std::size_t>(stm_));
+    index = index * 64 + static_cast<std::size_t>(white_king_);
+    index = index * 64 + static_cast<std::size_t>(black_king_);
+    for (int i(0); i != pieces; ++i) {
+      index = index * 64 + static_cast<std::size_t>(piece_[i]);
+    }
+    return index;
+  }
+
+  void Decode(int pieces, std::size_t index) {
+    for (int i(pieces); i != 0; --i) {
+      piece_[i - 1] = static_cast<int>(index & 63);
+      index >>= 6;
+    }
+    black_king_ = static_cast<int>(index & 63);
+    white_king_ = static_cast<int>((index >> 6) & 63);
+    stm_ = static_cast<int>(index >> 12);
+  }
+};
+
+inline std::size_t TableSize(int pieces) {
+  return (static_cast<std::size_t>(2) << (12 + 6 * pieces));
+}
+
+#ifndef NO_CHESSPROBLEM_THREADS
+typedef std::atomic<unsigned char> Cell;
+
+inline unsigned char Get(const Cell& cell) {
+  return cell.load(std::memory_order_relaxed);
+}
+
+inline void Set(Cell *cell, unsigned char value) {
+  cell->store(value, std::memory_order_relaxed);
+}
+
+// Decrease and return true if 0 is reached
+inline bool Decrease(Cell *cell) {
+  return (cell->fetch_sub(1, std::memory_order_relaxed) == 1);
+}
+#else  // defined(NO_CHESSPROBLEM_THREADS)
+typedef unsigned char Cell;
+
+inline unsigned char Get(const Cell& cell) {
+  return cell;
+}
+
+inline void Set(Cell *cell, unsigned char value) {
+  *cell = value;
+}
+
+inline bool Decrease(Cell *cell) {
+  return (--(*cell) == 0);
+}
+#endif  // NO_CHESSPROBLEM_THREADS
+
+/*
+The retrograde analysis: Positions with black to move have even values,
+those with white to move have odd values. The value d is found in pass d:
+For d odd, the predecessors of the positions with value d - 1 are won;
+for d even, the counters of legal moves of the predecessors are decreased,
+and a position is lost if its counter reaches 0.
+Positions in which black can capture are never lost through that move.
+For KPK, the promotions are taken from the tables of KQK and KRK.
+*/
+
+class Retrograde {
+ public:
+  // At most max_threads threads are used
+  Retrograde(const Info& info, const unsigned char *queen,
+      const unsigned char *rook, int max_threads)
+    : info_(info), size_(TableSize(info.pieces_)), queen_(queen),
+    rook_(rook), max_threads_(max_threads), values_(new Cell[size_]),
+    counters_(new Cell[size_ / 2]) {
+    if (info.figures_[0] == chess::kPawn) {
+      promotions_.assign(size_ / 2, Tablebases::kNoMate);
+    }
+  }
+
+  ATTRIBUTE_NONNULL_ void Run(std::vector<unsigned char> *result);
+
+ private:
+  const Info& info_;
+  std::size_t size_;
+  const unsigned char *queen_, *rook_;
+  int max_threads_;
+  std::unique_ptr<Cell[]> values_;
+  std::unique_ptr<Cell[]> counters_;  // only for black to move
+
+  // For white to move: the value of the best promotion
+  std::vector<unsigned char> promotions_;
+
+  // Return true if the white figures attack square, ignoring figure skip
+  ATTRIBUTE_NODISCARD bool Attacked(const Squares& squares, int square,
+      std::uint64_t occupied, int skip) const;
+
+  // Return true if square contains no figure
+  ATTRIBUTE_NODISCARD bool Empty(const Squares& squares, int square) const;
+
+  void Init(std::size_t begin, std::size_t end);
+
+  // Pass depth for the indices from begin to end (exclusive).
+  // Set *changed if some value was found.
+  ATTRIBUTE_NONNULL_ void Pass(unsigned char depth, std::size_t begin,
+      std::size_t end, bool *changed);
+
+  // Set the unknown predecessors of (black to move) squares to depth
+  ATTRIBUTE_NONNULL_ void WhiteRetro(Squares *squares, unsigned char depth,
+      bool *changed);
+
+  // Decrease the counters of the predecessors of (white to move) squares
+  ATTRIBUTE_NONNULL_ void BlackRetro(Squares *squares, unsigned char depth,
+      bool *changed);
+};
+
+bool Retrograde::Attacked(const Squares& squares, int square,
+    std::uint64_t occupied, int skip) const {
+  if (Near(squares.white_king_, square)) {
+    return true;
+  }
+  for (int i(0); i != info_.pieces_; ++i) {
+    if ((i != skip) &&
+      Attacks(info_.figures_[i], squares.piece_[i], square, occupied)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Retrograde::Empty(const Squares& squares, int square) const {
+  if ((square == squares.white_king_) || (square == squares.black_king_)) {
+    return false;
+  }
+  for (int i(0); i != info_.pieces_; ++i) {
+    if (square == squares.piece_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Retrograde::Init(std::size_t begin, std::size_t end) {
+  Squares squares = {};
+  for (std::size_t index(begin); index != end; ++index) {
+    Cell *value(&values_[index]);
+    Set(value, kIllegal);
+    squares.Decode(info_.pieces_, index);
+    if (Near(squares.white_king_, squares.black_king_)) {
+      continue;
+    }
+    std::uint64_t occupied(Bit(squares.white_king_) |
+      Bit(squares.black_king_));
+    bool legal(true);
+    for (int i(0); i != info_.pieces_; ++i) {
+      int piece(squares.piece_[i]);
+      if (((occupied & Bit(piece)) != 0) ||
+        ((info_.figures_[i] == chess::kPawn) &&
+        ((Rank(piece) == 0) || (Rank(piece) == 7)))) {
+        legal = false;
+        break;
+      }
+      occupied |= Bit(piece);
+    }
+    if (!legal) {
+      continue;
+    }
+    bool check(Attacked(squares, squares.black_king_, occupied, -1));
+    if (squares.stm_ == 0) {
+      if (check) {
+        continue;
+      }
+      Set(value, Tablebases::kNoMate);
+      if (promotions_.empty() || (Rank(squares.piece_[0]) != 6)) {
+        continue;
+      }
+      int to(squares.piece_[0] + 8);
+      if (!Empty(squares, to)) {
+        continue;
+      }
+      Squares promoted(squares);
+      promoted.stm_ = 1;
+      promoted.piece_[0] = to;
+      std::size_t promoted_index(promoted.Index(1));
+      unsigned char best(Tablebases::kNoMate);
+      for (const unsigned char *table : { queen_, rook_ }) {
+        unsigned char result(table[promoted_index]);
+        if ((result != Tablebases::kNoMate) && (result < best - 1)) {
+          best = result + 1;
+        }
+      }
+      promotions_[index] = best;
+      continue;
+    }
+    // Count the legal moves of the black king
+    std::uint64_t without_king(occupied & ~Bit(squares.black_king_));
+    unsigned char moves(0);
+    for (const auto& step : kKingSteps) {
+      int to(Offset(squares.black_king_, step[0], step[1]));
+      if ((to < 0) || Near(squares.white_king_, to)) {
+        continue;
+      }
+      int captured(-1);
+      for (int i(0); i != info_.pieces_; ++i) {
+        if (squares.piece_[i] == to) {
+          captured = i;
+        }
+      }
+      if (!Attacked(squares, to, without_king, captured)) {
+        ++moves;
+      }
+    }
+    Set(&counters_[index - size_ / 2], moves);
+    Set(value, ((moves == 0) && check) ? 0 : Tablebases::kNoMate);
+  }
+}
+
+void Retrograde::WhiteRetro(Squares *squares, unsigned char depth,
+    bool *changed) {
+  squares->stm_ = 0;
+  int pieces(info_.pieces_);
+  int king(squares->white_king_);
+  for (const auto& step : kKingSteps) {
+    int from(Offset(king, step[0], step[1]));
+    if ((from < 0) || !Empty(*squares, from)) {
+      continue;
+    }
+    squares->white_king_ = from;
+    Cell *value(&values_[squares->Index(pieces)]);
+    if (Get(*value) == Tablebases::kNoMate) {
+      Set(value, depth);
+      *changed = true;
+    }
+  }
+  squares->white_king_ = king;
+  for (int i(0); i != pieces; ++i) {
+    int piece(squares->piece_[i]);
+    std::vector<int> froms;
+    switch (info_.figures_[i]) {
+      case chess::kPawn:
+        if (Rank(piece) >= 2) {
+          int from(piece - 8);
+          if (Empty(*squares, from)) {
+            froms.push_back(from);
+            if ((Rank(piece) == 3) && Empty(*squares, from - 8)) {
+              froms.push_back(from - 8);
+            }
+          }
+        }
+        break;
+      case chess::kKnight:
+        for (const auto& step : kKnightSteps) {
+          int from(Offset(piece, step[0], step[1]));
+          if ((from >= 0) && Empty(*squares, from)) {
+            froms.push_back(from);
+          }
+        }
+        break;
+      default: {
+        chess::Figure figure(info_.figures_[i]);
+        for (const auto& step : kKingSteps) {
+          bool diagonal((step[0] != 0) && (step[1] != 0));
+          if ((diagonal && (figure == chess::kRook)) ||
+            (!diagonal && (figure == chess::kBishop))) {
+            continue;
+          }
+          for (int from(Offset(piece, step[0], step[1]));
+            (from >= 0) && Empty(*squares, from);
+            from = Offset(from, step[0], step[1])) {
+            froms.push_back(from);
+          }
+        }
+      }
+    }
+    for (int from : froms) {
+      squares->piece_[i] = from;
+      Cell *value(&values_[squares->Index(pieces)]);
+      if (Get(*value) == Tablebases::kNoMate) {
+        Set(value, depth);
+        *changed = true;
+      }
+    }
+    squares->piece_[i] = piece;
+  }
+}
+
+void Retrograde::BlackRetro(Squares *squares, unsigned char depth,
+    bool *changed) {
+  squares->stm_ = 1;
+  int king(squares->black_king_);
+  for (const auto& step : kKingSteps) {
+    int from(Offset(king, step[0], step[1]));
+    if ((from < 0) || !Empty(*squares, from) ||
+      Near(squares->white_king_, from)) {
+      continue;
+    }
+    squares->black_king_ = from;
+    std::size_t index(squares->Index(info_.pieces_));
+    if ((Get(values_[index]) == Tablebases::kNoMate) &&
+      Decrease(&counters_[index - size_ / 2])) {
+      Set(&values_[index], depth);
+      *changed = true;
+    }
+  }
+}
+
+void Retrograde::Pass(unsigned char depth, std::size_t begin,
+    std::size_t end, bool *changed) {
+  Squares squares = {};
+  unsigned char previous(depth - 1);
+  for (std::size_t index(begin); index != end; ++index) {
+    unsigned char value(Get(values_[index]));
+    if (value == previous) {
+      squares.Decode(info_.pieces_, index);
+      if (squares.stm_ == 0) {
+        BlackRetro(&squares, depth, changed);
+      } else {
+        WhiteRetro(&squares, depth, changed);
+      }
+    } else if ((value == Tablebases::kNoMate) && !promotions_.empty() &&
+      (index < size_ / 2) && (promotions_[index] == depth)) {
+      Set(&values_[index], depth);
+      *changed = true;
+    }
+  }
+}
+
+void Retrograde::Run(std::vector<unsigned char> *result) {
+  // The last pass in which a promotion is found
+  unsigned char last(0);
+#ifndef NO_CHESSPROBLEM_THREADS
+  std::size_t threads(static_cast<std::size_t>(max_threads_));
+  std::size_t chunk(size_ / threads);
+#endif
+  for (unsigned char depth(0); depth < kIllegal; ++depth) {
+    bool changed(false);
+#ifndef NO_CHESSPROBLEM_THREADS
+    std::vector<std::thread> pool;
+    std::unique_ptr<bool[]> changes(new bool[threads]);
+    for (std::size_t i(0); i != threads; ++i) {
+      std::size_t begin(i * chunk);
+      std::size_t end((i + 1 == threads) ? size_ : (begin + chunk));
+      changes[i] = false;
+      if (depth == 0) {
+        pool.emplace_back(&Retrograde::Init, this, begin, end);
+      } else {
+        pool.emplace_back(&Retrograde::Pass, this, depth, begin, end,
+          &changes[i]);
+      }
+    }
+    for (std::size_t i(0); i != threads; ++i) {
+      pool[i].join();
+      if (changes[i]) {
+        changed = true;
+      }
+    }
+#else  // defined(NO_CHESSPROBLEM_THREADS)
+    if (depth == 0) {
+      Init(0, size_);
+    } else {
+      Pass(depth, 0, size_, &changed);
+    }
+#endif  // NO_CHESSPROBLEM_THREADS
+    if (depth == 0) {
+      for (unsigned char promotion : promotions_) {
+        if ((promotion != Tablebases::kNoMate) && (promotion > last)) {
+          last = promotion;
+        }
+      }
+    } else if (!changed && (depth >= last)) {
+      break;
+    }
+  }
+  result->resize(size_);
+  for (std::size_t index(0); index != size_; ++index) {
+    unsigned char value(Get(values_[index]));
+    (*result)[index] = ((value == kIllegal) ? Tablebases::kNoMate : value);
+  }
+}
+
+// The square number of pos
+inline int Square(chess::Pos pos) {
+  pos -= chess::Field::kFieldStart;
+  return static_cast<int>((pos / (chess::Field::kColumns + 2)) * 8 +
+    (pos % (chess::Field::kColumns + 2)));
+}
+
+}  // namespace
+
+Tablebases::Tablebases(const std::string& directory, int max_threads)
+  : directory_(directory), max_threads_((max_threads > 0) ? max_threads : 1) {
+  for (auto& data : data_) {
+    data.values_ = nullptr;
+    data.size_ = 0;
+    data.map_ = nullptr;
+  }
+}
+
+Tablebases::~Tablebases() {
+  for (int table(0); table != kTables; ++table) {
+    Unload(static_cast<Table>(table));
+  }
+}
+
+void Tablebases::Unload(Table table) {
+  Data& data = data_[table];
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  if (data.map_ != nullptr) {
+    munmap(data.map_, sizeof(kHeader) + data.size_);
+  }
+#endif
+  data.map_ = nullptr;
+  data.values_ = nullptr;
+  data.size_ = 0;
+  data.memory_.clear();
+}
+
+void Tablebases::FileName(std::string *name, Table table) const {
+  *name = directory_;
+  if (!name->empty() && (name->back() != '/')) {
+    name->push_back('/');
+  }
+  name->append(kInfo[table].name_);
+  name->append(".tb");
+}
+
+bool Tablebases::Load(Table table) {
+  Data& data = data_[table];
+  std::string name;
+  FileName(&name, table);
+  std::size_t size(TableSize(kInfo[table].pieces_));
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  int fd(open(name.c_str(), O_RDONLY));
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) ||
+    (static_cast<std::size_t>(st.st_size) != sizeof(kHeader) + size)) {
+    close(fd);
+    return false;
+  }
+  void *map(mmap(nullptr, sizeof(kHeader) + size, PROT_READ, MAP_SHARED,
+    fd, 0));
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  if (std::memcmp(map, kHeader, sizeof(kHeader)) != 0) {
+    munmap(map, sizeof(kHeader) + size);
+    return false;
+  }
+  data.map_ = map;
+  data.values_ = static_cast<const unsigned char *>(map) + sizeof(kHeader);
+#else  // !defined(HAVE_SYS_MMAN_H) || !defined(HAVE_MMAP)
+  std::FILE *file(std::fopen(name.c_str(), "rb"));
+  if (file == nullptr) {
+    return false;
+  }
+  char header[sizeof(kHeader)];
+  data.memory_.resize(size);
+  bool success((std::fread(header, sizeof(header), 1, file) == 1) &&
+    (std::memcmp(header, kHeader, sizeof(kHeader)) == 0) &&
+    (std::fread(data.memory_.data(), size, 1, file) == 1) &&
+    (std::fgetc(file) == EOF));
+  std::fclose(file);
+  if (!success) {
+    data.memory_.clear();
+    return false;
+  }
+  data.values_ = data.memory_.data();
+#endif  // HAVE_SYS_MMAN_H && HAVE_MMAP
+  data.size_ = size;
+  return true;
+}
+
+void Tablebases::Generate(Table table) {
+  const unsigned char *queen(nullptr), *rook(nullptr);
+  if (table == kKPK) {
+    Need(kKQK);
+    Need(kKRK);
+    queen = data_[kKQK].values_;
+    rook = data_[kKRK].values_;
+  }
+  Data& data = data_[table];
+  Retrograde(kInfo[table], queen, rook, max_threads_).Run(&data.memory_);
+  data.values_ = data.memory_.data();
+  data.size_ = data.memory_.size();
+  // Write to a temporary file first so that no partial file is ever loaded
+  std::string name;
+  FileName(&name, table);
+  std::string temp(name + ".tmp");
+  std::FILE *file(std::fopen(temp.c_str(), "wb"));
+  if (file == nullptr) {
+    return;
+  }
+  bool success((std::fwrite(kHeader, sizeof(kHeader), 1, file) == 1) &&
+    (std::fwrite(data.values_, data.size_, 1, file) == 1));
+  if ((std::fclose(file) != 0) || !success ||
+    (std::rename(temp.c_str(), name.c_str()) != 0)) {
+    std::remove(temp.c_str());
+  }
+}
+
+void Tablebases::Need(Table table) {
+  if ((data_[table].values_ == nullptr) && !Load(table)) {
+    Generate(table);
+  }
+}
+
+void Tablebases::Prepare(const chess::Field *field, chess::Figure color) {
+  bool pawns(field->CountFigures(chess::ColoredFigure(chess::kPawn, color))
+    != 0);
+  if (pawns ||
+    (field->CountFigures(chess::ColoredFigure(chess::kQueen, color)) != 0)) {
+    Need(kKQK);
+  }
+  if (pawns ||
+    (field->CountFigures(chess::ColoredFigure(chess::kRook, color)) != 0)) {
+    Need(kKRK);
+  }
+  if ((field->CountFigures(chess::ColoredFigure(chess::kBishop, color))
+    != 0) &&
+    (field->CountFigures(chess::ColoredFigure(chess::kKnight, color))
+    != 0)) {
+    Need(kKBNK);
+  }
+  if (pawns) {
+    Need(kKPK);
+  }
+}
+
+bool Tablebases::Probe(const chess::Field *field, int *half_moves) const {
+  if (field->get_castling() != chess::kNoCastling) {
+    return false;
+  }
+  chess::Figure strong;
+  if (field->GetPosList(chess::kBlack).size() == 1) {
+    strong = chess::kWhite;
+  } else if (field->GetPosList(chess::kWhite).size() == 1) {
+    strong = chess::kBlack;
+  } else {
+    return false;
+  }
+  const chess::PosList& list = field->GetPosList(strong);
+  if (list.size() > 3) {
+    return false;
+  }
+  Table table;
+  if (list.size() == 3) {
+    if ((field->CountFigures(chess::ColoredFigure(chess::kBishop, strong))
+      != 1) ||
+      (field->CountFigures(chess::ColoredFigure(chess::kKnight, strong))
+      != 1)) {
+      return false;
+    }
+    table = kKBNK;
+  } else if (list.size() == 2) {
+    if (field->CountFigures(chess::ColoredFigure(chess::kQueen, strong))
+      != 0) {
+      table = kKQK;
+    } else if (field->CountFigures(chess::ColoredFigure(chess::kRook,
+      strong)) != 0) {
+      table = kKRK;
+    } else if (field->CountFigures(chess::ColoredFigure(chess::kPawn,
+      strong)) != 0) {
+      table = kKPK;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  const unsigned char *values(data_[table].values_);
+  if (values == nullptr) {
+    return false;
+  }
+  // Mirror vertically if the strong side is black
+  int flip((strong == chess::kWhite) ? 0 : 56);
+  const Info& info = kInfo[table];
+  Squares squares = {};
+  squares.stm_ = ((field->get_color() == strong) ? 0 : 1);
+  squares.black_king_ = 0;  // Avoid a warning
+  for (chess::Pos pos : list) {
+    int square(Square(pos) ^ flip);
+    chess::Figure figure(chess::UncoloredFigure(field->GetFigure(pos)));
+    if (figure == chess::kKing) {
+      squares.white_king_ = square;
+    } else {
+      squares.piece_[(figure == info.figures_[0]) ? 0 : 1] = square;
+    }
+  }
+  for (chess::Pos pos : field->GetPosList(chess::InvertColor(strong))) {
+    squares.black_king_ = Square(pos) ^ flip;
+  }
+  unsigned char value(values[squares.Index(info.pieces_)]);
+  *half_moves = ((value == kNoMate) ? -1 : value);
+  return true;
+}
+
+}  // namespace chessproblem
@@ -0,0 +1,100 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_TABLEBASE_H_
+#define CHESSPROBLEM_TABLEBASE_H_ 1
+
+#include <config.h>
+
+#include <cstddef>  // size_t
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "chessproblem/chess.h"
+#include "chessproblem/m_attribute.h"
+
+namespace chessproblem {
+
+/*
+Depth-to-mate tables for a king against a bare king with the material
+KQK, KRK, KBNK, or KPK.
+
+Each table is generated by retrograde analysis (the passes are split among
+several threads) and stored in a file in the given directory. The file is
+the plain array of values (after a short header), so it is memory-mapped
+if possible when it is loaded later on.
+
+The strong side is stored as white; positions where the strong side is
+black are mirrored vertically. The value of a position is the number of
+half moves until mate against best defense (kNoMate if there is none).
+
+Probe() is read-only and can be called by several threads simultaneously.
+*/
+
+class Tablebases {
+ public:
+  // The value of a position without forced mate
+  constexpr static const unsigned char kNoMate = 255;
+
+  // The files are searched in and written to directory.
+  // At most max_threads threads are used for the generation.
+  Tablebases(const std::string& directory, int max_threads);
+
+  ~Tablebases();
+
+  // Load (and if necessary generate) all tables which can be needed in
+  // positions reachable from field in which color has to give mate.
+  // Tables needed only after an underpromotion are not loaded.
+  // If a generated table cannot be written, it is used anyway.
+  ATTRIBUTE_NONNULL_ void Prepare(const chess::Field *field,
+      chess::Figure color);
+
+  // If a loaded table matches the material of field, store the number of
+  // half moves until mate into *half_moves (or -1 if the strong side
+  // cannot force mate) and return true.
+  ATTRIBUTE_NODISCARD ATTRIBUTE_NONNULL_ bool Probe(const chess::Field *field,
+      int *half_moves) const;
+
+  Tablebases(const Tablebases& t) = delete;
+  Tablebases& operator=(const Tablebases& t) = delete;
+
+ private:
+  enum Table { kKQK, kKRK, kKBNK, kKPK, kTables };
+
+  // The values of a table: Either mapped, or in memory_
+  class Data {
+   public:
+    const unsigned char *values_;
+    std::size_t size_;
+    void *map_;
+    std::vector<unsigned char> memory_;
+  };
+
+  std::string directory_;
+  int max_threads_;
+  std::array<Data, kTables> data_;
+
+  // Set *name to the file of table
+  ATTRIBUTE_NONNULL_ void FileName(std::string *name, Table table) const;
+
+  // Load table from its file. Return false if this is not possible.
+  bool Load(Table table);
+
+  // Generate table (and the tables needed for it) and try to write it
+  void Generate(Table table);
+
+  // Load or generate table if this has not happened yet
+  void Need(Table table);
+
+  void Unload(Table table);
+};
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_TABLEBASE_H_
@@ -0,0 +1,30 @@
+// This file is part of the chessproblem project and distributed under the
+// terms of the GNU General Public License v2.
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Copyright (c)
+//   Martin Väth <martin@mvath.de>
+
+#ifndef CHESSPROBLEM_TIMER_H_
+#define CHESSPROBLEM_TIMER_H_ 1
+
+#include <config.h>
+
+#include <time.h>  // clock_gettime
+
+#include <cstdint>
+
+namespace chessproblem {
+
+// Return the time of a monotonic clock in nanoseconds.
+// std::chrono::steady_clock::now() is avoided since it returns an aggregate.
+inline std::uint64_t Nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (static_cast<std::uint64_t>(now.tv_sec) * 1000000000 +
+    static_cast<std::uint64_t>(now.tv_nsec));
+}
+
+}  // namespace chessproblem
+
+#endif  // CHESSPROBLEM_TIMER_H_
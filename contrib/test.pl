@@ -85,6 +85,8 @@ while (<DATA>) {
   while (<$fh>) {
     chomp();
     s{\s*$}{};
+    # A solution without moves (the position is already mate) is "-"
+    s{^Solution[^:]*\:$}{-};
     s{^.*\:\s*}{};
     s{No.*}{};
     next if($_ eq '');
@@ -102,8 +104,35 @@ __END__
 
 -M2 "Kc1" "Ka1"
 No solution exists
+-H3 "Kc3,Bd3,Bc2" "Ka1"
+No solution exists
+-M1 "Kb3,Be4,Bg1" "Ka1"
+Bg1-d4
+-H3 "Kc1,Nh1,Bh2" "Ke8,Rd8,Qf8,e7,d7,f7,g7"
+e7-e6 Nh1-g3 Ke8-e7 Ng3-e4 Qf8-e8 Bh2-d6;e7-e6 Nh1-f2 Ke8-e7 Nf2-e4 Qf8-e8 Bh2-d6
 -M3 "Kc1,Na2,c7" "Ka1"
 c7-c8=Q;c7-c8=R
+-M4 "Ke5,Ra7" "Kf8"
+Ke5-e6
+-b -M4 "Kf1" "Ke4,Ra2"
+Ke4-e3
+-M1 "Ke7,Qa2,Rc3,Rb4" "Ke5,c7,Qg6"
+Rc3-c5
+-M2 "Ke1,Rh1,Ra1,Qf2,Nh2" "Ke8"
+0-0-0;Ra1-a7
+-H2 "Ke1,Rh1,Rg1,Nc3,d2,g4,h2,h3,a4" "Kf3,g2,d3,a6"
+g2*h1=N Rg1-g2 Nh1-g3 Rg2-f2;g2*h1=N Rg1-g2 Nh1-f2 Rg2*f2;g2*h1=N Rg1-f1 Nh1-f2 Rf1*f2;g2*h1=B Rg1-g2 a6-a5 Rg2-f2;Kf3-f4 Rg1*g2 Kf4-f3 0-0;Kf3-f4 Rg1*g2 Kf4-f3 Rg2-f2
+-H2 "Kf3,Na1,Qa5,Rb6,a2" "Ka7,g6,Nf7"
+-
+-d -H2 "Kf3,Na1,Qa5,Rb6,a2" "Ka7,g6,Nf7"
+-
+# For -amitm, the second half of these is expanded backward from the mates
+-H2 "Kf1,e5,Re1,Qg4" "Kd1,c2"
+Kd1-d2 Qg4-d4;Kd1-d2 Re1-e3 c2-c1=B Qg4-e2
+-H3 "Kf1,f5,d6" "Kd7,Bh1,Ba2"
+Ba2-e6 f5*e6 Kd7-c8 e6-e7 Bh1-b7 e7-e8=Q
+-H3 "Ke1,d7,d4" "Ke8,Ra8,Rh8"
+Ke8-f8 Ke1-d1 Ra8-e8 d7-d8=Q Rh8-g8 Qd8-f6;Ke8-f8 Ke1-f1 Ra8-e8 d7-d8=Q Rh8-g8 Qd8-f6;Ke8-f8 Ke1-d2 Ra8-e8 d7-d8=Q Rh8-g8 Qd8-f6;Ke8-f8 Ke1-f2 Ra8-e8 d7-d8=Q Rh8-g8 Qd8-f6
 
 # Chess problems by Martin Väth <martin@mvath.de>
 #1
@@ -8,10 +8,30 @@ RunTests() {
   echo "Running $*" >&2
   perl contrib/test.pl -q chessproblem/chessproblem ${1+"$@"}
 }
+Perft() {
+  echo "Running perft $1" >&2
+  nodes=`chessproblem/chessproblem -q -N"$1" "$3" "$4" | sed -n -e 's/^Nodes: //p'`
+  [ "$nodes" = "$2" ] && return
+  echo "Wrong perft $1 of $3 $4: $nodes instead of $2" >&2
+  exit 1
+}
 if [ $# -ne 0 ]
 then	RunTests ${1+"$@"}
 	exit
 fi
+Perft 5 4865609 \
+	"Ke1,Qd1,Ra1,Rh1,Bc1,Bf1,Nb1,Ng1,a2,b2,c2,d2,e2,f2,g2,h2" \
+	"Ke8,Qd8,Ra8,Rh8,Bc8,Bf8,Nb8,Ng8,a7,b7,c7,d7,e7,f7,g7,h7"
+Perft 4 4085603 \
+	"d5,Ne5,e4,Nc3,Qf3,a2,b2,c2,Bd2,Be2,f2,g2,h2,Ra1,Ke1,Rh1" \
+	"Ra8,Ke8,Rh8,a7,c7,d7,Qe7,f7,Bg7,Ba6,Nb6,e6,Nf6,g6,b4,h3"
+Perft 6 11030083 "Ka5,b5,Rb4,e2,g2" "c7,d6,Rh5,f4,Kh4"
+Perft 4 422333 \
+	"a7,Nh6,b5,Ba4,Bb4,c4,e4,Nf3,a2,d2,g2,h2,Ra1,Qd1,Rf1,Kg1" \
+	"Ra8,Ke8,Rh8,b7,c7,d7,f7,g7,h7,Bb6,Nf6,Bg6,Na5,Qa3,b2"
+Perft 4 2103487 \
+	"d7,Bc4,a2,b2,c2,Ne2,g2,h2,Ra1,Nb1,Bc1,Qd1,Ke1,Rh1" \
+	"Ra8,Nb8,Bc8,Qd8,Kf8,Rh8,a7,b7,Be7,f7,g7,h7,c6,Nf2"
 max=`nproc` && [ -n "$max" ] && [ "$max" -gt 0 ] || max = 4
 i=0
 while [ "$i" -lt "$max" ]
@@ -19,3 +39,12 @@ do	i=$(( $i + 1 ))
 	RunTests "-j$i" "-J1"
 	RunTests "-j$i"
 done
+RunTests "-t2"
+RunTests "-d"
+RunTests "-apn"
+tablebases=`mktemp -d` && RunTests "-B$tablebases"
+rm -rf -- "$tablebases"
+RunTests "-amitm"
+RunTests "-abfs"
+RunTests "-Lverify"
+RunTests "-Lscalar"